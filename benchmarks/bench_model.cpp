@@ -0,0 +1,92 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* A trivial co-simulation slave for measuring the overhead of the FMI call
+ * path, i.e. everything in fmi_functions.cpp and cppfmu_cs.cpp.  It has
+ * 'variableCount' real variables with value references 0, 1, 2, ..., and
+ * its DoStep() does no work, so that the cost of a call is all overhead.
+ *
+ * Build it as a shared library with MODEL_IDENTIFIER=cppfmu_bench (see
+ * fmi_call_bench.cpp).
+ */
+#include <stdexcept>
+#include <vector>
+
+#include "cppfmu_cs.hpp"
+
+
+namespace
+{
+    const std::size_t variableCount = 4096;
+
+
+    class BenchSlave : public cppfmu::SlaveInstance
+    {
+    public:
+        explicit BenchSlave(const cppfmu::Memory& memory)
+            : m_values(variableCount, 0.0, cppfmu::Allocator<fmiReal>{memory})
+        {
+        }
+
+        void SetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiReal value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) At(vr[i]) = value[i];
+        }
+
+        void GetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiReal value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                value[i] = At(vr[i]);
+            }
+        }
+
+        bool DoStep(
+            fmiReal /*currentCommunicationPoint*/,
+            fmiReal /*communicationStepSize*/,
+            fmiBoolean /*newStep*/,
+            fmiReal& /*endOfStep*/) override
+        {
+            return true;
+        }
+
+    private:
+        const fmiReal& At(fmiValueReference vr) const
+        {
+            if (vr >= m_values.size()) {
+                throw std::out_of_range("Invalid value reference");
+            }
+            return m_values[vr];
+        }
+
+        fmiReal& At(fmiValueReference vr)
+        {
+            return const_cast<fmiReal&>(static_cast<const BenchSlave&>(*this).At(vr));
+        }
+
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_values;
+    };
+}
+
+
+cppfmu::UniquePtr<cppfmu::SlaveInstance> CppfmuInstantiateSlave(
+    fmiString  /*instanceName*/,
+    fmiString  /*fmuGUID*/,
+    fmiString  /*fmuLocation*/,
+    fmiString  /*mimeType*/,
+    fmiReal    /*timeout*/,
+    fmiBoolean /*visible*/,
+    fmiBoolean /*interactive*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger /*logger*/)
+{
+    return cppfmu::AllocateUnique<BenchSlave>(memory, memory);
+}
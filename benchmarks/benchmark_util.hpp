@@ -0,0 +1,192 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_BENCHMARK_UTIL_HPP
+#define CPPFMU_BENCHMARK_UTIL_HPP
+
+/* Utilities which are shared by the benchmark programs in this directory:
+ * timing, summary statistics, and output as a text table, CSV or JSON.
+ */
+
+#include <algorithm>    // std::sort
+#include <cstdint>      // std::uint64_t
+#include <cstdio>       // std::printf
+#include <cstdlib>      // std::strtoull
+#include <cstring>      // std::strcmp, std::strncmp
+#include <string>       // std::string
+#include <vector>       // std::vector
+
+#include "cppfmu_instrumentation.hpp"
+
+
+namespace bench
+{
+
+// Returns the current time of a monotonic clock in nanoseconds.
+inline std::uint64_t Now()
+{
+    return cppfmu::MonotonicNanoseconds();
+}
+
+
+// Prevents the compiler from optimising away the computation of 'value'.
+template<typename T>
+inline void DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+
+/* The results of one benchmark.  'samples' are the durations of individual
+ * operations in nanoseconds, if they were measured, and 'throughput' is
+ * the number of operations per second, measured over a batch of operations
+ * without per-operation timing.
+ */
+struct Result
+{
+    std::string name;
+    std::string parameters;     // e.g. "nvr=100"
+    std::uint64_t operations = 0;
+    double throughput = 0.0;
+    std::vector<std::uint64_t> samples;
+};
+
+
+/* Formats results as a text table, CSV or JSON, and writes them to stdout
+ * as they are added.
+ */
+class Reporter
+{
+public:
+    enum class Format { text, csv, json };
+
+    explicit Reporter(Format format) : m_format{format}
+    {
+        switch (m_format) {
+            case Format::text:
+                std::printf("%-40s %-14s %12s %14s %9s %9s %9s %9s %9s %9s\n",
+                    "benchmark", "parameters", "operations", "ops/s",
+                    "mean ns", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+                break;
+            case Format::csv:
+                std::printf("benchmark,parameters,operations,ops_per_s,"
+                    "mean_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+                break;
+            case Format::json:
+                std::printf("[");
+                break;
+        }
+    }
+
+    ~Reporter()
+    {
+        if (m_format == Format::json) std::printf("\n]\n");
+    }
+
+    Reporter(const Reporter&) = delete;
+    Reporter& operator=(const Reporter&) = delete;
+
+    void Add(Result result)
+    {
+        auto& s = result.samples;
+        std::sort(s.begin(), s.end());
+        std::uint64_t sum = 0;
+        for (const auto x : s) sum += x;
+        const auto mean = s.empty() ? 0.0 : static_cast<double>(sum) / s.size();
+        const auto q = [&s] (double p) -> unsigned long long {
+            if (s.empty()) return 0;
+            auto i = static_cast<std::size_t>(p * s.size());
+            if (i >= s.size()) i = s.size() - 1;
+            return s[i];
+        };
+        const auto min = s.empty() ? 0ull : static_cast<unsigned long long>(s.front());
+        const auto max = s.empty() ? 0ull : static_cast<unsigned long long>(s.back());
+        const auto ops = static_cast<unsigned long long>(result.operations);
+
+        switch (m_format) {
+            case Format::text:
+                std::printf("%-40s %-14s %12llu %14.0f %9.0f %9llu %9llu %9llu %9llu %9llu\n",
+                    result.name.c_str(), result.parameters.c_str(), ops,
+                    result.throughput, mean,
+                    q(0.5), q(0.9), q(0.99), q(0.999), max);
+                break;
+            case Format::csv:
+                std::printf("%s,%s,%llu,%.1f,%.1f,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                    result.name.c_str(), result.parameters.c_str(), ops,
+                    result.throughput, mean,
+                    min, q(0.5), q(0.9), q(0.99), q(0.999), max);
+                break;
+            case Format::json:
+                std::printf("%s\n  {\"benchmark\": \"%s\", \"parameters\": \"%s\", "
+                    "\"operations\": %llu, \"ops_per_s\": %.1f, \"mean_ns\": %.1f, "
+                    "\"min_ns\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+                    "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                    m_first ? "" : ",",
+                    result.name.c_str(), result.parameters.c_str(), ops,
+                    result.throughput, mean,
+                    min, q(0.5), q(0.9), q(0.99), q(0.999), max);
+                break;
+        }
+        m_first = false;
+        std::fflush(stdout);
+    }
+
+private:
+    Format m_format;
+    bool m_first = true;
+};
+
+
+/* Parses "--format=text|csv|json".  Returns false if 'arg' is not a format
+ * option, and exits with an error message if the format is unknown.
+ */
+inline bool ParseFormat(const char* arg, Reporter::Format& format)
+{
+    const char prefix[] = "--format=";
+    if (std::strncmp(arg, prefix, sizeof prefix - 1) != 0) return false;
+    const auto value = arg + sizeof prefix - 1;
+    if (std::strcmp(value, "text") == 0) format = Reporter::Format::text;
+    else if (std::strcmp(value, "csv") == 0) format = Reporter::Format::csv;
+    else if (std::strcmp(value, "json") == 0) format = Reporter::Format::json;
+    else {
+        std::fprintf(stderr, "Unknown output format: %s\n", value);
+        std::exit(2);
+    }
+    return true;
+}
+
+
+/* Parses "--<name>=<number>".  Returns false if 'arg' is not that option,
+ * and exits with an error message if the number is invalid.
+ */
+inline bool ParseCount(const char* arg, const char* name, std::uint64_t& count)
+{
+    if (std::strncmp(arg, "--", 2) != 0) return false;
+    const auto n = std::strlen(name);
+    if (std::strncmp(arg + 2, name, n) != 0 || arg[2 + n] != '=') return false;
+    char* end = nullptr;
+    count = std::strtoull(arg + 3 + n, &end, 10);
+    if (*end != '\0' || count == 0) {
+        std::fprintf(stderr, "Invalid value for --%s: %s\n", name, arg + 3 + n);
+        std::exit(2);
+    }
+    return true;
+}
+
+
+// Returns the throughput of 'operations' operations which took 'ns' ns.
+inline double Throughput(std::uint64_t operations, std::uint64_t ns)
+{
+    return ns == 0 ? 0.0 : operations * 1e9 / ns;
+}
+
+
+} // namespace bench
+#endif // header guard
@@ -0,0 +1,324 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* fmi_call_bench: Measures the cost of the FMI call path of a model built
+ * with CPPFMU, from the host's call to the return from SlaveInstance.
+ *
+ * Usage:
+ *
+ *     fmi_call_bench [options] library modelIdentifier
+ *
+ * Options:
+ *
+ *     --format=text|csv|json  Output format (default: text)
+ *     --iterations=N          Number of calls per benchmark (default: 100000)
+ *     --instances=N           Number of fmiInstantiateSlave() calls, and of
+ *                             instances which are alive at once in the
+ *                             "live" benchmark (default: 1000)
+ *     --nvr=N                 Largest number of variables per fmiGetReal() or
+ *                             fmiSetReal() call; powers of ten up to this are
+ *                             measured (default: 1000)
+ *
+ * For each benchmark, the throughput is measured over a batch of calls, and
+ * the latency percentiles by timing each call in a separate batch.  The
+ * latencies therefore include the overhead of reading the clock, which is
+ * reported as the "clock" benchmark.  fmiGetReal() and fmiSetReal() are
+ * called with the value references 0, 1, ..., nvr-1, so the model must
+ * have at least that many real variables.
+ *
+ * fmiInstantiateSlave() is measured twice: in a loop which frees each
+ * instance before the next is created, and with all the instances alive at
+ * once ("live").  For the latter, the memory which each instance takes up
+ * is printed to stderr, both what is allocated through the host's
+ * callbacks and what is allocated directly from the C++ heap (glibc only).
+ *
+ * Like the rest of CPPFMU, this comes without build scripts.  To build it
+ * and the trivial model in bench_model.cpp with GCC on Linux:
+ *
+ *     g++ -std=c++11 -O2 -shared -fPIC -I.. -I<fmi headers> \
+ *         -DMODEL_IDENTIFIER=cppfmu_bench -o cppfmu_bench.so \
+ *         bench_model.cpp ../fmi_functions.cpp ../cppfmu_cs.cpp
+ *     g++ -std=c++11 -O2 -I.. -I<fmi headers> -o fmi_call_bench \
+ *         fmi_call_bench.cpp -ldl
+ *     ./fmi_call_bench ./cppfmu_bench.so cppfmu_bench
+ *
+ * To measure the cost of a particular CPPFMU feature, build the model again
+ * with the corresponding macro defined, e.g. -DCPPFMU_ASYNC_LOGGING.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#   include <malloc.h>
+#   define HAVE_MALLINFO2
+#endif
+
+#include "benchmark_util.hpp"
+#include "fmi_host.hpp"
+
+
+namespace
+{
+    struct Options
+    {
+        bench::Reporter::Format format = bench::Reporter::Format::text;
+        std::uint64_t iterations = 100000;
+        std::uint64_t instances = 1000;
+        std::uint64_t maxNvr = 1000;
+        const char* library = nullptr;
+        const char* modelIdentifier = nullptr;
+    };
+
+
+    // The host's memory callbacks, which count the memory allocated.
+    std::uint64_t allocations = 0;
+    std::uint64_t liveBytes = 0;
+
+    // The size of each allocation is stored in front of it.
+    const std::size_t headerSize = alignof(std::max_align_t);
+
+    void* CountingAllocate(std::size_t nObj, std::size_t size)
+    {
+        if (size != 0 && nObj > (SIZE_MAX - headerSize) / size) return nullptr;
+        const auto bytes = nObj * size;
+        const auto block = std::calloc(1, headerSize + bytes);
+        if (!block) return nullptr;
+        std::memcpy(block, &bytes, sizeof bytes);
+        ++allocations;
+        liveBytes += bytes;
+        return static_cast<char*>(block) + headerSize;
+    }
+
+    void CountingFree(void* ptr)
+    {
+        if (!ptr) return;
+        const auto block = static_cast<char*>(ptr) - headerSize;
+        std::size_t bytes;
+        std::memcpy(&bytes, block, sizeof bytes);
+        liveBytes -= bytes;
+        std::free(block);
+    }
+
+
+    // Returns the number of bytes in use on the C++ heap, or 0 if unknown.
+    std::uint64_t HeapBytes()
+    {
+#ifdef HAVE_MALLINFO2
+        return mallinfo2().uordblks;
+#else
+        return 0;
+#endif
+    }
+
+
+    /* Runs 'call' 'iterations' times untimed to measure the throughput, and
+     * then as many times with each call timed.
+     */
+    template<typename Call>
+    bench::Result Measure(
+        const char* name,
+        std::string parameters,
+        std::uint64_t iterations,
+        Call call)
+    {
+        bench::Result result;
+        result.name = name;
+        result.parameters = std::move(parameters);
+        result.operations = iterations;
+
+        const auto start = bench::Now();
+        for (std::uint64_t i = 0; i < iterations; ++i) call(i);
+        result.throughput = bench::Throughput(iterations, bench::Now() - start);
+
+        result.samples.reserve(iterations);
+        for (std::uint64_t i = 0; i < iterations; ++i) {
+            const auto t0 = bench::Now();
+            call(i);
+            const auto t1 = bench::Now();
+            result.samples.push_back(t1 - t0);
+        }
+        return result;
+    }
+
+
+    void Check(fmiStatus status, const char* function)
+    {
+        if (status != fmiOK) {
+            throw std::runtime_error(std::string(function) + " failed");
+        }
+    }
+
+
+    void Run(const Options& options)
+    {
+        bench::FmuLibrary fmu{options.library, options.modelIdentifier};
+        auto callbacks = bench::HostCallbacks();
+        callbacks.allocateMemory = CountingAllocate;
+        callbacks.freeMemory = CountingFree;
+        bench::Reporter reporter{options.format};
+
+        reporter.Add(Measure("clock", "", options.iterations,
+            [] (std::uint64_t) { bench::DoNotOptimize(bench::Now()); }));
+
+        // Instantiation and destruction are measured together for the
+        // throughput, but timed separately.
+        {
+            bench::Result instantiate, free;
+            instantiate.name = "fmiInstantiateSlave";
+            free.name = "fmiFreeSlaveInstance";
+            instantiate.operations = free.operations = options.instances;
+            const auto instantiateOne = [&] {
+                const auto c = fmu.instantiateSlave("bench", "", "", "", 0.0,
+                    fmiFalse, fmiFalse, callbacks, fmiFalse);
+                if (!c) throw std::runtime_error("fmiInstantiateSlave failed");
+                return c;
+            };
+            const auto start = bench::Now();
+            for (std::uint64_t i = 0; i < options.instances; ++i) {
+                fmu.freeSlaveInstance(instantiateOne());
+            }
+            instantiate.throughput = free.throughput =
+                bench::Throughput(options.instances, bench::Now() - start);
+            for (std::uint64_t i = 0; i < options.instances; ++i) {
+                const auto t0 = bench::Now();
+                const auto c = instantiateOne();
+                const auto t1 = bench::Now();
+                fmu.freeSlaveInstance(c);
+                const auto t2 = bench::Now();
+                instantiate.samples.push_back(t1 - t0);
+                free.samples.push_back(t2 - t1);
+            }
+            reporter.Add(std::move(instantiate));
+            reporter.Add(std::move(free));
+        }
+
+        // Many instances alive at once
+        {
+            bench::Result instantiate, free;
+            instantiate.name = "fmiInstantiateSlave";
+            free.name = "fmiFreeSlaveInstance";
+            instantiate.parameters = free.parameters = "live";
+            instantiate.operations = free.operations = options.instances;
+            instantiate.samples.reserve(options.instances);
+            std::vector<fmiComponent> instances;
+            instances.reserve(options.instances);
+            std::vector<std::string> names;
+            for (std::uint64_t i = 0; i < options.instances; ++i) {
+                names.push_back("bench" + std::to_string(i));
+            }
+
+            const auto allocationsBefore = allocations;
+            const auto bytesBefore = liveBytes;
+            const auto heapBefore = HeapBytes();
+            const auto start = bench::Now();
+            for (std::uint64_t i = 0; i < options.instances; ++i) {
+                const auto t0 = bench::Now();
+                const auto c = fmu.instantiateSlave(names[i].c_str(), "", "", "", 0.0,
+                    fmiFalse, fmiFalse, callbacks, fmiFalse);
+                instantiate.samples.push_back(bench::Now() - t0);
+                if (!c) throw std::runtime_error("fmiInstantiateSlave failed");
+                instances.push_back(c);
+            }
+            instantiate.throughput =
+                bench::Throughput(options.instances, bench::Now() - start);
+            const auto n = static_cast<double>(options.instances);
+            const auto callbackBytes = static_cast<double>(liveBytes - bytesBefore);
+            const auto callbackAllocations =
+                static_cast<double>(allocations - allocationsBefore);
+            // The callbacks allocate from the heap too, headers included.
+            const auto directHeapBytes =
+                static_cast<double>(HeapBytes()) - static_cast<double>(heapBefore)
+                - callbackBytes - callbackAllocations * headerSize;
+            std::fprintf(stderr,
+                "%llu live instances: %.0f bytes in %.1f allocations per instance "
+                "through the host's callbacks, %.0f more bytes per instance "
+                "directly from the heap\n",
+                static_cast<unsigned long long>(options.instances),
+                callbackBytes / n,
+                callbackAllocations / n,
+                HeapBytes() == 0 ? 0.0 : directHeapBytes / n);
+
+            const auto freeStart = bench::Now();
+            for (const auto c : instances) {
+                const auto t0 = bench::Now();
+                fmu.freeSlaveInstance(c);
+                free.samples.push_back(bench::Now() - t0);
+            }
+            free.throughput = bench::Throughput(options.instances, bench::Now() - freeStart);
+            reporter.Add(std::move(instantiate));
+            reporter.Add(std::move(free));
+        }
+
+        const auto c = fmu.instantiateSlave("bench", "", "", "", 0.0,
+            fmiFalse, fmiFalse, callbacks, fmiFalse);
+        if (!c) throw std::runtime_error("fmiInstantiateSlave failed");
+        Check(fmu.initializeSlave(c, 0.0, fmiFalse, 0.0), "fmiInitializeSlave");
+
+        const double stepSize = 1e-3;
+        double time = 0.0;
+        reporter.Add(Measure("fmiDoStep", "", options.iterations,
+            [&] (std::uint64_t) {
+                Check(fmu.doStep(c, time, stepSize, fmiTrue), "fmiDoStep");
+                time += stepSize;
+            }));
+
+        for (std::uint64_t nvr = 1; nvr <= options.maxNvr; nvr *= 10) {
+            std::vector<fmiValueReference> vr(nvr);
+            for (std::size_t i = 0; i < vr.size(); ++i) {
+                vr[i] = static_cast<fmiValueReference>(i);
+            }
+            std::vector<fmiReal> values(nvr, 1.0);
+            const auto parameters = "nvr=" + std::to_string(nvr);
+            reporter.Add(Measure("fmiSetReal", parameters, options.iterations,
+                [&] (std::uint64_t) {
+                    Check(fmu.setReal(c, vr.data(), nvr, values.data()), "fmiSetReal");
+                }));
+            reporter.Add(Measure("fmiGetReal", parameters, options.iterations,
+                [&] (std::uint64_t) {
+                    Check(fmu.getReal(c, vr.data(), nvr, values.data()), "fmiGetReal");
+                }));
+        }
+
+        Check(fmu.terminateSlave(c), "fmiTerminateSlave");
+        fmu.freeSlaveInstance(c);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<const char*> positional;
+    for (int i = 1; i < argc; ++i) {
+        if (bench::ParseFormat(argv[i], options.format)) continue;
+        if (bench::ParseCount(argv[i], "iterations", options.iterations)) continue;
+        if (bench::ParseCount(argv[i], "instances", options.instances)) continue;
+        if (bench::ParseCount(argv[i], "nvr", options.maxNvr)) continue;
+        positional.push_back(argv[i]);
+    }
+    if (positional.size() != 2) {
+        std::fprintf(stderr,
+            "Usage: %s [--format=text|csv|json] [--iterations=N] [--instances=N] "
+            "[--nvr=N] library modelIdentifier\n",
+            argv[0]);
+        return 2;
+    }
+    options.library = positional[0];
+    options.modelIdentifier = positional[1];
+    try {
+        Run(options);
+        return 0;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,192 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_FMI_HOST_HPP
+#define CPPFMU_FMI_HOST_HPP
+
+/* A minimal FMI 1.0 co-simulation host, which stands in for a simulation
+ * environment in the benchmarks.  It loads the shared library of a model
+ * with dlopen() and looks up its functions by their prefixed names.  This
+ * is POSIX only.
+ */
+
+#include <atomic>       // std::atomic
+#include <cstdio>       // std::fprintf
+#include <cstdlib>      // std::calloc, std::free
+#include <stdexcept>    // std::runtime_error
+#include <string>       // std::string
+
+#include <dlfcn.h>      // dlopen, dlsym, dlclose
+
+extern "C"
+{
+#include <fmiFunctions.h>
+}
+
+
+namespace bench
+{
+
+// FMI 1.0 does not define types for its functions, so we do it here.
+typedef fmiComponent InstantiateSlaveFn(
+    fmiString, fmiString, fmiString, fmiString, fmiReal, fmiBoolean, fmiBoolean,
+    fmiCallbackFunctions, fmiBoolean);
+typedef fmiStatus InitializeSlaveFn(fmiComponent, fmiReal, fmiBoolean, fmiReal);
+typedef fmiStatus TerminateSlaveFn(fmiComponent);
+typedef fmiStatus ResetSlaveFn(fmiComponent);
+typedef void FreeSlaveInstanceFn(fmiComponent);
+typedef fmiStatus SetDebugLoggingFn(fmiComponent, fmiBoolean);
+typedef fmiStatus GetRealFn(fmiComponent, const fmiValueReference[], size_t, fmiReal[]);
+typedef fmiStatus GetIntegerFn(fmiComponent, const fmiValueReference[], size_t, fmiInteger[]);
+typedef fmiStatus GetBooleanFn(fmiComponent, const fmiValueReference[], size_t, fmiBoolean[]);
+typedef fmiStatus GetStringFn(fmiComponent, const fmiValueReference[], size_t, fmiString[]);
+typedef fmiStatus SetRealFn(fmiComponent, const fmiValueReference[], size_t, const fmiReal[]);
+typedef fmiStatus SetIntegerFn(fmiComponent, const fmiValueReference[], size_t, const fmiInteger[]);
+typedef fmiStatus SetBooleanFn(fmiComponent, const fmiValueReference[], size_t, const fmiBoolean[]);
+typedef fmiStatus SetStringFn(fmiComponent, const fmiValueReference[], size_t, const fmiString[]);
+typedef fmiStatus SetRealInputDerivativesFn(
+    fmiComponent, const fmiValueReference[], size_t, const fmiInteger[], const fmiReal[]);
+typedef fmiStatus GetRealOutputDerivativesFn(
+    fmiComponent, const fmiValueReference[], size_t, const fmiInteger[], fmiReal[]);
+typedef fmiStatus CancelStepFn(fmiComponent);
+typedef fmiStatus DoStepFn(fmiComponent, fmiReal, fmiReal, fmiBoolean);
+typedef fmiStatus GetStatusFn(fmiComponent, const fmiStatusKind, fmiStatus*);
+typedef fmiStatus GetRealStatusFn(fmiComponent, const fmiStatusKind, fmiReal*);
+typedef fmiStatus GetIntegerStatusFn(fmiComponent, const fmiStatusKind, fmiInteger*);
+typedef fmiStatus GetBooleanStatusFn(fmiComponent, const fmiStatusKind, fmiBoolean*);
+typedef fmiStatus GetStringStatusFn(fmiComponent, const fmiStatusKind, fmiString*);
+
+
+/* The FMI functions of a model, loaded from its shared library.  The
+ * library stays loaded for as long as the object exists.
+ */
+class FmuLibrary
+{
+public:
+    FmuLibrary(const char* path, const std::string& modelIdentifier)
+        : m_modelIdentifier(modelIdentifier)
+    {
+        m_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!m_handle) throw std::runtime_error(dlerror());
+        Load(instantiateSlave, "fmiInstantiateSlave");
+        Load(initializeSlave, "fmiInitializeSlave");
+        Load(terminateSlave, "fmiTerminateSlave");
+        Load(resetSlave, "fmiResetSlave");
+        Load(freeSlaveInstance, "fmiFreeSlaveInstance");
+        Load(setDebugLogging, "fmiSetDebugLogging");
+        Load(getReal, "fmiGetReal");
+        Load(getInteger, "fmiGetInteger");
+        Load(getBoolean, "fmiGetBoolean");
+        Load(getString, "fmiGetString");
+        Load(setReal, "fmiSetReal");
+        Load(setInteger, "fmiSetInteger");
+        Load(setBoolean, "fmiSetBoolean");
+        Load(setString, "fmiSetString");
+        Load(setRealInputDerivatives, "fmiSetRealInputDerivatives");
+        Load(getRealOutputDerivatives, "fmiGetRealOutputDerivatives");
+        Load(cancelStep, "fmiCancelStep");
+        Load(doStep, "fmiDoStep");
+        Load(getStatus, "fmiGetStatus");
+        Load(getRealStatus, "fmiGetRealStatus");
+        Load(getIntegerStatus, "fmiGetIntegerStatus");
+        Load(getBooleanStatus, "fmiGetBooleanStatus");
+        Load(getStringStatus, "fmiGetStringStatus");
+    }
+
+    ~FmuLibrary()
+    {
+        dlclose(m_handle);
+    }
+
+    FmuLibrary(const FmuLibrary&) = delete;
+    FmuLibrary& operator=(const FmuLibrary&) = delete;
+
+    /* Returns a non-standard function (see cppfmu_extensions.h), or null if
+     * the library does not export it.
+     */
+    void* Extension(const char* name) const
+    {
+        return dlsym(m_handle, (m_modelIdentifier + '_' + name).c_str());
+    }
+
+    InstantiateSlaveFn* instantiateSlave;
+    InitializeSlaveFn* initializeSlave;
+    TerminateSlaveFn* terminateSlave;
+    ResetSlaveFn* resetSlave;
+    FreeSlaveInstanceFn* freeSlaveInstance;
+    SetDebugLoggingFn* setDebugLogging;
+    GetRealFn* getReal;
+    GetIntegerFn* getInteger;
+    GetBooleanFn* getBoolean;
+    GetStringFn* getString;
+    SetRealFn* setReal;
+    SetIntegerFn* setInteger;
+    SetBooleanFn* setBoolean;
+    SetStringFn* setString;
+    SetRealInputDerivativesFn* setRealInputDerivatives;
+    GetRealOutputDerivativesFn* getRealOutputDerivatives;
+    CancelStepFn* cancelStep;
+    DoStepFn* doStep;
+    GetStatusFn* getStatus;
+    GetRealStatusFn* getRealStatus;
+    GetIntegerStatusFn* getIntegerStatus;
+    GetBooleanStatusFn* getBooleanStatus;
+    GetStringStatusFn* getStringStatus;
+
+private:
+    template<typename F>
+    void Load(F*& function, const char* name)
+    {
+        const auto fullName = m_modelIdentifier + '_' + name;
+        function = reinterpret_cast<F*>(dlsym(m_handle, fullName.c_str()));
+        if (!function) {
+            throw std::runtime_error("Function not found: " + fullName);
+        }
+    }
+
+    std::string m_modelIdentifier;
+    void* m_handle;
+};
+
+
+/* The callbacks which the host passes to fmiInstantiateSlave().  Memory is
+ * allocated with calloc() and free(), and log messages are counted and
+ * discarded, except errors, which are printed.
+ */
+inline std::atomic<unsigned long>& LoggedMessageCount()
+{
+    static std::atomic<unsigned long> count{0};
+    return count;
+}
+
+
+inline void DiscardingLogger(
+    fmiComponent /*c*/,
+    fmiString instanceName,
+    fmiStatus status,
+    fmiString /*category*/,
+    fmiString message,
+    ...)
+{
+    ++LoggedMessageCount();
+    if (status >= fmiError) {
+        std::fprintf(stderr, "%s: %s\n", instanceName, message);
+    }
+}
+
+
+inline fmiCallbackFunctions HostCallbacks()
+{
+    fmiCallbackFunctions functions;
+    functions.logger = DiscardingLogger;
+    functions.allocateMemory = std::calloc;
+    functions.freeMemory = std::free;
+    functions.stepFinished = nullptr;
+    return functions;
+}
+
+
+} // namespace bench
+#endif // header guard
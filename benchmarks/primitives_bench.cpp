@@ -0,0 +1,355 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* primitives_bench: Microbenchmarks of the memory management and logging
+ * primitives in cppfmu_common.hpp, run against fake host callbacks.
+ *
+ * Usage:
+ *
+ *     primitives_bench [options]
+ *
+ * Options:
+ *
+ *     --format=text|csv|json  Output format (default: text)
+ *     --allocator=NAME        The host's allocateMemory/freeMemory:
+ *                               calloc   - calloc() and free() (default)
+ *                               malloc   - malloc() and free(), i.e. without
+ *                                          the zeroing required by FMI
+ *                               locked   - calloc() and free() under a global
+ *                                          mutex, like some hosts do
+ *                               counting - calloc() and free(), counting the
+ *                                          calls, which are printed to stderr
+ *     --logger=NAME           The host's logger:
+ *                               discard  - ignores the message (default)
+ *                               format   - formats the message with
+ *                                          vsnprintf(), like most hosts do
+ *     --batches=N             Number of timed batches (default: 50)
+ *     --filter=TEXT           Only run benchmarks whose names contain TEXT
+ *
+ * Each benchmark is run in batches which take about a millisecond each.
+ * The throughput is measured over all batches, and the percentiles are
+ * those of the mean time per operation in each batch.
+ *
+ * Like the rest of CPPFMU, this comes without build scripts.  To build it
+ * with GCC:
+ *
+ *     g++ -std=c++11 -O2 -I.. -I<fmi headers> -o primitives_bench \
+ *         primitives_bench.cpp -lpthread
+ */
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cppfmu_common.hpp"
+#include "benchmark_util.hpp"
+
+
+namespace
+{
+    // =========================================================================
+    // Fake host callbacks
+    // =========================================================================
+
+    void* MallocAllocate(std::size_t nObj, std::size_t size)
+    {
+        return std::malloc(nObj * size);
+    }
+
+    std::mutex allocationMutex;
+
+    void* LockedAllocate(std::size_t nObj, std::size_t size)
+    {
+        std::lock_guard<std::mutex> lock{allocationMutex};
+        return std::calloc(nObj, size);
+    }
+
+    void LockedFree(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock{allocationMutex};
+        std::free(ptr);
+    }
+
+    std::atomic<unsigned long long> allocationCount{0};
+    std::atomic<unsigned long long> allocatedBytes{0};
+    std::atomic<unsigned long long> freeCount{0};
+
+    void* CountingAllocate(std::size_t nObj, std::size_t size)
+    {
+        ++allocationCount;
+        allocatedBytes += nObj * size;
+        return std::calloc(nObj, size);
+    }
+
+    void CountingFree(void* ptr)
+    {
+        if (ptr) ++freeCount;
+        std::free(ptr);
+    }
+
+    void DiscardingLogger(
+        fmiComponent, fmiString, fmiStatus, fmiString, fmiString, ...)
+    {
+    }
+
+    void FormattingLogger(
+        fmiComponent,
+        fmiString,
+        fmiStatus,
+        fmiString,
+        fmiString message,
+        ...)
+    {
+        char buffer[1024];
+        std::va_list args;
+        va_start(args, message);
+        std::vsnprintf(buffer, sizeof buffer, message, args);
+        va_end(args);
+        bench::DoNotOptimize(buffer);
+    }
+
+
+    // =========================================================================
+    // Benchmark runner
+    // =========================================================================
+
+    struct Benchmark
+    {
+        const char* name;
+        std::function<void(std::uint64_t)> run; // runs the operation n times
+    };
+
+
+    bench::Result RunBatches(const Benchmark& benchmark, std::uint64_t batches)
+    {
+        // Find a batch size which takes about 1 ms.
+        std::uint64_t batchSize = 1;
+        for (;;) {
+            const auto t0 = bench::Now();
+            benchmark.run(batchSize);
+            const auto t = bench::Now() - t0;
+            if (t >= 1000000 || batchSize >= (std::uint64_t{1} << 30)) break;
+            batchSize *= t < 100000 ? 10 : 2;
+        }
+
+        bench::Result result;
+        result.name = benchmark.name;
+        result.operations = batches * batchSize;
+        std::uint64_t total = 0;
+        for (std::uint64_t b = 0; b < batches; ++b) {
+            const auto t0 = bench::Now();
+            benchmark.run(batchSize);
+            const auto t = bench::Now() - t0;
+            total += t;
+            result.samples.push_back((t + batchSize / 2) / batchSize);
+        }
+        result.throughput = bench::Throughput(result.operations, total);
+        return result;
+    }
+
+
+    // =========================================================================
+    // Benchmarks
+    // =========================================================================
+
+    struct Object
+    {
+        double values[8];
+    };
+
+
+    std::vector<Benchmark> Benchmarks(const fmiCallbackFunctions& callbacks)
+    {
+        const cppfmu::Memory memory{callbacks};
+        // The loggers are copied into the benchmarks, which outlive this
+        // function, so the masks must too.
+        static std::atomic<std::uint32_t> enabledMask{cppfmu::allLogCategories};
+        static std::atomic<std::uint32_t> disabledMask{0u};
+        cppfmu::Logger enabled{nullptr, "bench", callbacks, &enabledMask};
+        cppfmu::Logger disabled{nullptr, "bench", callbacks, &disabledMask};
+        const char* const shortString = "x1";
+        const char* const longString =
+            "A string which is too long for the small-string optimisation";
+
+        return std::vector<Benchmark>{
+            // Memory
+            {"New/Delete<double>", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    auto p = cppfmu::New<double>(memory, 1.0);
+                    bench::DoNotOptimize(p);
+                    cppfmu::Delete(memory, p);
+                }
+            }},
+            {"New/Delete<Object>", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    auto p = cppfmu::New<Object>(memory);
+                    bench::DoNotOptimize(p);
+                    cppfmu::Delete(memory, p);
+                }
+            }},
+            {"new/delete Object", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    auto p = new Object;
+                    bench::DoNotOptimize(p);
+                    delete p;
+                }
+            }},
+            {"AllocateUnique<Object>", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    auto p = cppfmu::AllocateUnique<Object>(memory);
+                    bench::DoNotOptimize(p);
+                }
+            }},
+            {"std::unique_ptr<Object>", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::unique_ptr<Object> p{new Object};
+                    bench::DoNotOptimize(p);
+                }
+            }},
+            {"CopyString/short", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    auto s = cppfmu::CopyString(memory, shortString);
+                    bench::DoNotOptimize(s);
+                }
+            }},
+            {"CopyString/long", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    auto s = cppfmu::CopyString(memory, longString);
+                    bench::DoNotOptimize(s);
+                }
+            }},
+            {"std::string/long", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::string s{longString};
+                    bench::DoNotOptimize(s);
+                }
+            }},
+            {"vector<Allocator>/push_back x100", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::vector<double, cppfmu::Allocator<double>> v{
+                        cppfmu::Allocator<double>{memory}};
+                    for (int k = 0; k < 100; ++k) v.push_back(k);
+                    bench::DoNotOptimize(v);
+                }
+            }},
+            {"vector<std::allocator>/push_back x100", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::vector<double> v;
+                    for (int k = 0; k < 100; ++k) v.push_back(k);
+                    bench::DoNotOptimize(v);
+                }
+            }},
+            {"map<Allocator>/insert x100", [=] (std::uint64_t n) {
+                typedef std::pair<const int, double> Value;
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::map<int, double, std::less<int>, cppfmu::Allocator<Value>> m{
+                        std::less<int>{}, cppfmu::Allocator<Value>{memory}};
+                    for (int k = 0; k < 100; ++k) m.emplace(k, k);
+                    bench::DoNotOptimize(m);
+                }
+            }},
+            {"map<std::allocator>/insert x100", [=] (std::uint64_t n) {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    std::map<int, double> m;
+                    for (int k = 0; k < 100; ++k) m.emplace(k, k);
+                    bench::DoNotOptimize(m);
+                }
+            }},
+
+            // Logging
+            {"Logger::Log", [=] (std::uint64_t n) mutable {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    enabled.Log(fmiOK, "bench", "Step %d: x = %g", 42, 3.14);
+                }
+            }},
+            {"Logger::LogFormatted", [=] (std::uint64_t n) mutable {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    enabled.LogFormatted(fmiOK, "bench", "Step {}: x = {}", 42, 3.14);
+                }
+            }},
+            {"Logger::DebugLog/enabled", [=] (std::uint64_t n) mutable {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    enabled.DebugLog(fmiOK, "bench", "Step %d: x = %g", 42, 3.14);
+                }
+            }},
+            {"Logger::DebugLog/disabled", [=] (std::uint64_t n) mutable {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    disabled.DebugLog(fmiOK, "bench", "Step %d: x = %g", 42, 3.14);
+                }
+            }},
+            {"CPPFMU_DEBUG_LOG/disabled", [=] (std::uint64_t n) mutable {
+                for (std::uint64_t i = 0; i < n; ++i) {
+                    CPPFMU_DEBUG_LOG(disabled, fmiOK, "bench", "Step %d: x = %g", 42, 3.14);
+                }
+            }},
+        };
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    auto format = bench::Reporter::Format::text;
+    std::uint64_t batches = 50;
+    const char* filter = "";
+    auto callbacks = fmiCallbackFunctions{
+        DiscardingLogger, std::calloc, std::free, nullptr};
+    bool counting = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = argv[i];
+        if (bench::ParseFormat(arg, format)) continue;
+        if (bench::ParseCount(arg, "batches", batches)) continue;
+        if (std::strncmp(arg, "--filter=", 9) == 0) {
+            filter = arg + 9;
+        } else if (std::strcmp(arg, "--allocator=calloc") == 0) {
+            callbacks.allocateMemory = std::calloc;
+            callbacks.freeMemory = std::free;
+        } else if (std::strcmp(arg, "--allocator=malloc") == 0) {
+            callbacks.allocateMemory = MallocAllocate;
+            callbacks.freeMemory = std::free;
+        } else if (std::strcmp(arg, "--allocator=locked") == 0) {
+            callbacks.allocateMemory = LockedAllocate;
+            callbacks.freeMemory = LockedFree;
+        } else if (std::strcmp(arg, "--allocator=counting") == 0) {
+            callbacks.allocateMemory = CountingAllocate;
+            callbacks.freeMemory = CountingFree;
+            counting = true;
+        } else if (std::strcmp(arg, "--logger=discard") == 0) {
+            callbacks.logger = DiscardingLogger;
+        } else if (std::strcmp(arg, "--logger=format") == 0) {
+            callbacks.logger = FormattingLogger;
+        } else {
+            std::fprintf(stderr,
+                "Usage: %s [--format=text|csv|json] "
+                "[--allocator=calloc|malloc|locked|counting] "
+                "[--logger=discard|format] [--batches=N] [--filter=TEXT]\n",
+                argv[0]);
+            return 2;
+        }
+    }
+
+    {
+        bench::Reporter reporter{format};
+        for (const auto& benchmark : Benchmarks(callbacks)) {
+            if (!std::strstr(benchmark.name, filter)) continue;
+            reporter.Add(RunBatches(benchmark, batches));
+        }
+    }
+    if (counting) {
+        std::fprintf(stderr, "allocateMemory: %llu calls, %llu bytes; freeMemory: %llu calls\n",
+            allocationCount.load(), allocatedBytes.load(), freeCount.load());
+    }
+    return 0;
+}
@@ -0,0 +1,449 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* scaling_bench: Measures how the throughput of many instances of one model
+ * scales with the number of threads which step them, to expose contention
+ * in CPPFMU and in the host callbacks that single-instance benchmarks
+ * cannot show.
+ *
+ * Usage:
+ *
+ *     scaling_bench [options] library modelIdentifier
+ *
+ * Options:
+ *
+ *     --format=text|csv|json  Output format (default: text)
+ *     --instances=N           Number of instances (default: 100)
+ *     --threads=N             Largest number of threads; powers of two up to
+ *                             this, and this, are measured (default: the
+ *                             number of hardware threads)
+ *     --steps=N               Number of macro steps per measurement
+ *                             (default: 1000)
+ *     --nvr=N                 Number of variables exchanged between
+ *                             instances per macro step (default: 1)
+ *     --partition=NAME        How instances are assigned to threads:
+ *                               block  - contiguous ranges (default)
+ *                               cyclic - round robin, so that consecutively
+ *                                        allocated instances are stepped by
+ *                                        different threads
+ *     --allocator=NAME        The host's allocateMemory/freeMemory:
+ *                               calloc - calloc() and free() (default)
+ *                               locked - calloc() and free() under a global
+ *                                        mutex, like some hosts do
+ *
+ * The instances are created with fmiInstantiateSlave() and initialised
+ * on the main thread, and then simulated in Jacobi fashion: in each macro
+ * step, every instance takes a step with fmiDoStep(), and then the real
+ * variables 0, 1, ..., nvr-1 of each instance are read with fmiGetReal()
+ * and written to the same variables of the next instance with
+ * fmiSetReal().  The threads wait for each other at a barrier after the
+ * steps and after the reads.
+ *
+ * One result is reported per thread count.  The throughput is the number
+ * of fmiDoStep() calls per second, and the latency percentiles are those
+ * of the macro steps.  In addition, the memory which the instances
+ * allocate through the host's callbacks, and the number of callback calls
+ * per fmiDoStep() call in each measurement, are printed to stderr.  The
+ * callbacks are counted per thread, so counting does not add contention.
+ *
+ * Like the rest of CPPFMU, this comes without build scripts.  To build it
+ * with GCC on Linux:
+ *
+ *     g++ -std=c++11 -O2 -I.. -I<fmi headers> -o scaling_bench \
+ *         scaling_bench.cpp -ldl -lpthread
+ *     ./scaling_bench --instances=500 ./cppfmu_bench.so cppfmu_bench
+ *
+ * See fmi_call_bench.cpp for how to build cppfmu_bench.so.  The models in
+ * ../examples are more realistic workloads.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark_util.hpp"
+#include "fmi_host.hpp"
+
+
+namespace
+{
+    // =========================================================================
+    // Counting host allocator
+    // =========================================================================
+
+    // Every thread counts in its own slot, on its own cache line.
+    const std::size_t maxThreads = 255;
+
+    struct alignas(64) AllocationCounters
+    {
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> frees{0};
+        std::atomic<std::uint64_t> allocatedBytes{0};
+        std::atomic<std::uint64_t> freedBytes{0};
+    };
+
+    AllocationCounters allocationCounters[maxThreads + 1];
+    thread_local std::size_t threadSlot = 0;
+
+    bool lockedAllocator = false;
+    std::mutex allocationMutex;
+
+    // The size of each allocation is stored in front of it.
+    const std::size_t headerSize = alignof(std::max_align_t);
+
+    void* CountingAllocate(std::size_t nObj, std::size_t size)
+    {
+        if (size != 0 && nObj > (SIZE_MAX - headerSize) / size) return nullptr;
+        const auto bytes = nObj * size;
+        void* block;
+        if (lockedAllocator) {
+            std::lock_guard<std::mutex> lock{allocationMutex};
+            block = std::calloc(1, headerSize + bytes);
+        } else {
+            block = std::calloc(1, headerSize + bytes);
+        }
+        if (!block) return nullptr;
+        std::memcpy(block, &bytes, sizeof bytes);
+
+        auto& counters = allocationCounters[threadSlot];
+        counters.allocations.fetch_add(1, std::memory_order_relaxed);
+        counters.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        return static_cast<char*>(block) + headerSize;
+    }
+
+    void CountingFree(void* ptr)
+    {
+        if (!ptr) return;
+        const auto block = static_cast<char*>(ptr) - headerSize;
+        std::size_t bytes;
+        std::memcpy(&bytes, block, sizeof bytes);
+
+        auto& counters = allocationCounters[threadSlot];
+        counters.frees.fetch_add(1, std::memory_order_relaxed);
+        counters.freedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (lockedAllocator) {
+            std::lock_guard<std::mutex> lock{allocationMutex};
+            std::free(block);
+        } else {
+            std::free(block);
+        }
+    }
+
+    struct AllocationTotals
+    {
+        std::uint64_t allocations = 0;
+        std::uint64_t frees = 0;
+        std::uint64_t liveBytes = 0;
+    };
+
+    AllocationTotals CountAllocations()
+    {
+        AllocationTotals totals;
+        std::uint64_t allocated = 0, freed = 0;
+        for (const auto& counters : allocationCounters) {
+            totals.allocations += counters.allocations.load(std::memory_order_relaxed);
+            totals.frees += counters.frees.load(std::memory_order_relaxed);
+            allocated += counters.allocatedBytes.load(std::memory_order_relaxed);
+            freed += counters.freedBytes.load(std::memory_order_relaxed);
+        }
+        totals.liveBytes = allocated - freed;
+        return totals;
+    }
+
+
+    // =========================================================================
+    // Benchmark
+    // =========================================================================
+
+    /* A barrier for a fixed number of threads, which spins (politely) rather
+     * than sleeping, since the macro steps may be very short.
+     */
+    class SpinBarrier
+    {
+    public:
+        explicit SpinBarrier(std::size_t threads) : m_threads{threads} { }
+
+        void Wait()
+        {
+            const auto generation = m_generation.load(std::memory_order_acquire);
+            if (m_waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == m_threads) {
+                m_waiting.store(0, std::memory_order_relaxed);
+                m_generation.fetch_add(1, std::memory_order_release);
+            } else {
+                while (m_generation.load(std::memory_order_acquire) == generation) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        const std::size_t m_threads;
+        alignas(64) std::atomic<std::size_t> m_waiting{0};
+        alignas(64) std::atomic<std::size_t> m_generation{0};
+    };
+
+
+    struct Options
+    {
+        bench::Reporter::Format format = bench::Reporter::Format::text;
+        std::uint64_t instances = 100;
+        std::uint64_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+        std::uint64_t steps = 1000;
+        std::uint64_t nvr = 1;
+        bool cyclic = false;
+        const char* library = nullptr;
+        const char* modelIdentifier = nullptr;
+    };
+
+
+    class Simulation
+    {
+    public:
+        Simulation(const bench::FmuLibrary& fmu, const Options& options)
+            : m_fmu(fmu)
+            , m_options(options)
+            , m_vr(options.nvr)
+            , m_values(options.instances * options.nvr)
+        {
+            for (std::size_t i = 0; i < m_vr.size(); ++i) {
+                m_vr[i] = static_cast<fmiValueReference>(i);
+            }
+        }
+
+        Simulation(const Simulation&) = delete;
+        Simulation& operator=(const Simulation&) = delete;
+
+        ~Simulation()
+        {
+            for (const auto c : m_instances) {
+                m_fmu.terminateSlave(c);
+                m_fmu.freeSlaveInstance(c);
+            }
+        }
+
+        void Instantiate()
+        {
+            auto callbacks = bench::HostCallbacks();
+            callbacks.allocateMemory = CountingAllocate;
+            callbacks.freeMemory = CountingFree;
+            for (std::uint64_t i = 0; i < m_options.instances; ++i) {
+                const auto name = "instance" + std::to_string(i);
+                const auto c = m_fmu.instantiateSlave(name.c_str(), "", "", "",
+                    0.0, fmiFalse, fmiFalse, callbacks, fmiFalse);
+                if (!c) throw std::runtime_error("fmiInstantiateSlave failed");
+                m_instances.push_back(c);
+                if (m_fmu.initializeSlave(c, 0.0, fmiFalse, 0.0) != fmiOK) {
+                    throw std::runtime_error("fmiInitializeSlave failed");
+                }
+            }
+        }
+
+        // Runs one warm-up and m_options.steps measured macro steps.
+        bench::Result Run(std::size_t threadCount)
+        {
+            bench::Result result;
+            result.name = "jacobi";
+            result.parameters = "threads=" + std::to_string(threadCount);
+            result.operations = m_options.steps * m_instances.size();
+            result.samples.reserve(m_options.steps);
+
+            SpinBarrier barrier{threadCount};
+            std::uint64_t start = 0;
+            std::vector<std::thread> workers;
+            for (std::size_t t = 1; t < threadCount; ++t) {
+                workers.emplace_back([&, t] {
+                    threadSlot = t;
+                    Work(t, threadCount, barrier, nullptr, start);
+                });
+            }
+            Work(0, threadCount, barrier, &result.samples, start);
+            for (auto& w : workers) w.join();
+
+            result.throughput = bench::Throughput(result.operations, bench::Now() - start);
+            if (m_failed) throw std::runtime_error(m_failure);
+            return result;
+        }
+
+    private:
+        /* Thread 'thread' of 'threadCount' steps its share of the instances.
+         * Thread 0 records the duration of each macro step in 'samples' and
+         * the start time of the measurement in 'start'.
+         */
+        void Work(
+            std::size_t thread,
+            std::size_t threadCount,
+            SpinBarrier& barrier,
+            std::vector<std::uint64_t>* samples,
+            std::uint64_t& start)
+        {
+            const auto n = m_instances.size();
+            const auto nvr = m_vr.size();
+            std::vector<std::size_t> mine;
+            if (m_options.cyclic) {
+                for (auto i = thread; i < n; i += threadCount) mine.push_back(i);
+            } else {
+                for (auto i = thread * n / threadCount; i < (thread + 1) * n / threadCount; ++i) {
+                    mine.push_back(i);
+                }
+            }
+
+            const double stepSize = 1e-3;
+            auto t0 = bench::Now();
+            for (std::uint64_t step = 0; step <= m_options.steps; ++step) {
+                const auto time = m_time + step * stepSize;
+                for (const auto i : mine) {
+                    Check(m_fmu.doStep(m_instances[i], time, stepSize, fmiTrue), "fmiDoStep");
+                }
+                barrier.Wait();
+                for (const auto i : mine) {
+                    Check(m_fmu.getReal(m_instances[i], m_vr.data(), nvr, &m_values[i * nvr]),
+                        "fmiGetReal");
+                }
+                barrier.Wait();
+                for (const auto i : mine) {
+                    const auto from = (i + n - 1) % n;
+                    Check(m_fmu.setReal(m_instances[i], m_vr.data(), nvr, &m_values[from * nvr]),
+                        "fmiSetReal");
+                }
+                if (samples) {
+                    const auto t1 = bench::Now();
+                    if (step == 0) start = t1;
+                    else samples->push_back(t1 - t0);
+                    t0 = t1;
+                }
+            }
+            barrier.Wait();
+            if (thread == 0) m_time += (m_options.steps + 1) * stepSize;
+        }
+
+        // Records the first failure, without throwing, so that the threads
+        // keep meeting at the barrier.
+        void Check(fmiStatus status, const char* function)
+        {
+            if (status == fmiOK || m_failed.exchange(true)) return;
+            m_failure = std::string(function) + " failed";
+        }
+
+        const bench::FmuLibrary& m_fmu;
+        const Options& m_options;
+        std::vector<fmiComponent> m_instances;
+        std::vector<fmiValueReference> m_vr;
+        std::vector<fmiReal> m_values;
+        double m_time = 0.0;
+        std::atomic<bool> m_failed{false};
+        std::string m_failure;
+    };
+
+
+    void Run(const Options& options)
+    {
+        bench::FmuLibrary fmu{options.library, options.modelIdentifier};
+
+        const auto beforeInstantiation = CountAllocations();
+        {
+            Simulation simulation{fmu, options};
+            simulation.Instantiate();
+            const auto afterInstantiation = CountAllocations();
+            std::fprintf(stderr, "%llu instances: %.0f bytes in %.1f allocations per instance\n",
+                static_cast<unsigned long long>(options.instances),
+                static_cast<double>(afterInstantiation.liveBytes - beforeInstantiation.liveBytes)
+                    / options.instances,
+                static_cast<double>(afterInstantiation.allocations - beforeInstantiation.allocations)
+                    / options.instances);
+
+            std::vector<std::size_t> threadCounts;
+            for (std::size_t t = 1; t < options.maxThreads; t *= 2) threadCounts.push_back(t);
+            threadCounts.push_back(options.maxThreads);
+
+            bench::Reporter reporter{options.format};
+            double baseline = 0.0;
+            for (const auto threadCount : threadCounts) {
+                const auto before = CountAllocations();
+                const auto logged = bench::LoggedMessageCount().load();
+                auto result = simulation.Run(threadCount);
+                const auto after = CountAllocations();
+                const auto steps = static_cast<double>(
+                    (options.steps + 1) * options.instances);
+                if (threadCount == 1) baseline = result.throughput;
+                std::fprintf(stderr,
+                    "threads=%zu: speedup %.2f, efficiency %.0f%%; per fmiDoStep: "
+                    "%.3f allocateMemory, %.3f freeMemory, %.3f logger calls\n",
+                    threadCount,
+                    result.throughput / baseline,
+                    100.0 * result.throughput / baseline / threadCount,
+                    (after.allocations - before.allocations) / steps,
+                    (after.frees - before.frees) / steps,
+                    (bench::LoggedMessageCount().load() - logged) / steps);
+                reporter.Add(std::move(result));
+            }
+        }
+
+        const auto leaked = CountAllocations().liveBytes - beforeInstantiation.liveBytes;
+        if (leaked != 0) {
+            std::fprintf(stderr, "Warning: %llu bytes were not freed\n",
+                static_cast<unsigned long long>(leaked));
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<const char*> positional;
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = argv[i];
+        if (bench::ParseFormat(arg, options.format)) continue;
+        if (bench::ParseCount(arg, "instances", options.instances)) continue;
+        if (bench::ParseCount(arg, "threads", options.maxThreads)) continue;
+        if (bench::ParseCount(arg, "steps", options.steps)) continue;
+        if (bench::ParseCount(arg, "nvr", options.nvr)) continue;
+        if (std::strcmp(arg, "--partition=block") == 0) {
+            options.cyclic = false;
+        } else if (std::strcmp(arg, "--partition=cyclic") == 0) {
+            options.cyclic = true;
+        } else if (std::strcmp(arg, "--allocator=calloc") == 0) {
+            lockedAllocator = false;
+        } else if (std::strcmp(arg, "--allocator=locked") == 0) {
+            lockedAllocator = true;
+        } else if (std::strncmp(arg, "--", 2) == 0) {
+            positional.clear();
+            break;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2) {
+        std::fprintf(stderr,
+            "Usage: %s [--format=text|csv|json] [--instances=N] [--threads=N] "
+            "[--steps=N] [--nvr=N] [--partition=block|cyclic] "
+            "[--allocator=calloc|locked] library modelIdentifier\n",
+            argv[0]);
+        return 2;
+    }
+    if (options.maxThreads > maxThreads) {
+        std::fprintf(stderr, "At most %zu threads are supported\n", maxThreads);
+        return 2;
+    }
+    options.library = positional[0];
+    options.modelIdentifier = positional[1];
+    try {
+        Run(options);
+        return 0;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
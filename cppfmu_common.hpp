@@ -6,13 +6,20 @@
 #ifndef CPPFMU_COMMON_HPP
 #define CPPFMU_COMMON_HPP
 
-#include <cstddef>      // std::size_t
+#include <atomic>       // std::atomic, std::atomic_flag
+#include <chrono>       // std::chrono::steady_clock
+#include <cstdarg>      // std::va_list
+#include <cstddef>      // std::size_t, std::max_align_t
+#include <cstdint>      // std::uint32_t, std::uintptr_t
+#include <cstdio>       // std::snprintf, std::vsnprintf
+#include <cstring>      // std::memcpy, std::memset, std::strchr, std::strcmp, ...
 #include <functional>   // std::function
-#include <memory>       // std::shared_ptr, std::unique_ptr
-#include <new>          // std::bad_alloc
+#include <memory>       // std::make_shared, std::shared_ptr, std::unique_ptr
+#include <new>          // std::bad_alloc, placement new
 #include <stdexcept>    // std::runtime_error
 #include <string>       // std::basic_string, std::char_traits
-#include <utility>      // std::forward
+#include <type_traits>  // std::enable_if, std::integral_constant, ...
+#include <utility>      // std::forward, std::move
 
 
 extern "C"
@@ -29,6 +36,67 @@ extern "C"
 #endif
 
 
+/* Compile-time logging configuration.
+ *
+ * CPPFMU_LOG_MESSAGE_SIZE is the maximum length of every message which CPPFMU
+ * formats itself, including the terminating null character: messages logged
+ * with LogFormatted() and queued messages, messages dumped from a
+ * FlightRecorder, and messages which are escaped before they are passed to
+ * the simulation environment.  Longer messages are truncated.  The buffers
+ * for them are on the stack, so the size should be kept moderate.
+ *
+ * If CPPFMU_ASYNC_LOGGING is defined, log messages are not passed directly to
+ * the simulation environment, but formatted into a per-instance LogQueue (see
+ * below) and delivered when the current FMI function returns.  The following
+ * settings only apply in that case:
+ *
+ *     CPPFMU_LOG_QUEUE_CAPACITY   = The number of messages the queue can hold.
+ *     CPPFMU_LOG_DRAIN_INTERVAL_MS = If nonzero, a background thread will also
+ *                                   deliver queued messages at this interval,
+ *                                   so that messages logged during a long
+ *                                   fmiDoStep() call appear without delay.
+ *                                   Note that this means that the logger
+ *                                   callback may be called from a thread
+ *                                   other than that of the FMI function call.
+ */
+#ifndef CPPFMU_LOG_QUEUE_CAPACITY
+#   define CPPFMU_LOG_QUEUE_CAPACITY 1024
+#endif
+#ifndef CPPFMU_LOG_MESSAGE_SIZE
+#   define CPPFMU_LOG_MESSAGE_SIZE 256
+#endif
+#ifndef CPPFMU_LOG_DRAIN_INTERVAL_MS
+#   define CPPFMU_LOG_DRAIN_INTERVAL_MS 0
+#endif
+
+/* Debug messages whose status is less than CPPFMU_DEBUG_LOG_MIN_STATUS are
+ * compiled out of the CPPFMU_DEBUG_LOG macro (see below), and ignored by
+ * Logger::DebugLog().  For example, define it as 'fmiWarning' to remove all
+ * 'fmiOK' debug messages, or as a number greater than 'fmiFatal' to remove
+ * debug logging altogether.
+ */
+#ifndef CPPFMU_DEBUG_LOG_MIN_STATUS
+#   define CPPFMU_DEBUG_LOG_MIN_STATUS fmiOK
+#endif
+
+/* If CPPFMU_FLIGHT_RECORDER_SIZE is nonzero, each instance records its most
+ * recent debug messages in a FlightRecorder (see below) with room for this
+ * many messages, whether or not debug logging is enabled.  The recorded
+ * messages are logged if an FMI function fails with fmiError or fmiFatal.
+ */
+#ifndef CPPFMU_FLIGHT_RECORDER_SIZE
+#   define CPPFMU_FLIGHT_RECORDER_SIZE 0
+#endif
+
+/* The number of distinct call sites per instance for which repeated messages
+ * logged with CPPFMU_LOG_LIMITED or CPPFMU_LOG_FORMATTED_LIMITED (see below)
+ * can be counted and suppressed.
+ */
+#ifndef CPPFMU_LOG_RATE_LIMIT_SITES
+#   define CPPFMU_LOG_RATE_LIMIT_SITES 32
+#endif
+
+
 namespace cppfmu
 {
 
@@ -201,10 +269,15 @@ inline String CopyString(const Memory& memory, fmiString string)
 /* Allocates memory for a single object of type T and runs its constructor,
  * in the style of the built-in 'new' operator.  Any arguments in 'args'
  * are forwarded to the constructor.
+ *
+ * The simulation environment's allocator is only assumed to return memory
+ * with fundamental alignment, so T must not be over-aligned.
  */
 template<typename T, typename... Args>
 T* New(const Memory& memory, Args&&... args)
 {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+        "cppfmu::New() cannot allocate over-aligned types");
     auto alloc = Allocator<T>{memory};
     const auto ptr = std::allocator_traits<decltype(alloc)>::allocate(alloc, 1);
     try {
@@ -258,67 +331,1596 @@ UniquePtr<T> AllocateUnique(const Memory& memory, Args&&... args)
 // ============================================================================
 
 
-/* A class that can be used to log messages from model code.  All messages are
- * forwarded to the logging facilities provided by the simulation environment.
+/* Copies the null-terminated string 'in' to the buffer 'out', which has room
+ * for 'outSize' characters, doubling every '%' character on the way so that
+ * the result may be passed as the 'message' argument of the FMI logger
+ * callback without being subject to further formatting.  The output is
+ * truncated if necessary, but always null-terminated (unless outSize is 0).
  */
-class Logger
+inline void EscapeLogMessage(
+    const char* in,
+    char* out,
+    std::size_t outSize) CPPFMU_NOEXCEPT
+{
+    if (outSize == 0) return;
+    std::size_t n = 0;
+    for (; *in != '\0'; ++in) {
+        const std::size_t len = (*in == '%') ? 2 : 1;
+        if (n + len >= outSize) break;
+        out[n++] = *in;
+        if (len == 2) out[n++] = '%';
+    }
+    out[n] = '\0';
+}
+
+
+/* A fixed-size, stack-allocatable text buffer used for type-safe message
+ * formatting (see FormatMessage() below).  Text which does not fit is
+ * silently truncated.
+ */
+class MessageBuffer
 {
 public:
-    Logger(
-        fmiComponent component,
-        String instanceName,
-        fmiCallbackFunctions callbackFunctions,
-        std::shared_ptr<bool> debugLoggingEnabled)
-        : m_component{component}
-        , m_instanceName(std::move(instanceName))
-        , m_fmiLogger{callbackFunctions.logger}
-        , m_debugLoggingEnabled{debugLoggingEnabled}
+    MessageBuffer() CPPFMU_NOEXCEPT : m_size{0} { m_data[0] = '\0'; }
+
+    // Returns the contents of the buffer as a null-terminated string.
+    const char* c_str() const CPPFMU_NOEXCEPT { return m_data; }
+
+    // Returns the length of the contents.
+    std::size_t size() const CPPFMU_NOEXCEPT { return m_size; }
+
+    void Append(const char* str, std::size_t length) CPPFMU_NOEXCEPT
     {
+        const auto room = sizeof m_data - 1 - m_size;
+        if (length > room) length = room;
+        std::memcpy(m_data + m_size, str, length);
+        m_size += length;
+        m_data[m_size] = '\0';
     }
 
-    // Logs a message.
+    void Append(const char* str) CPPFMU_NOEXCEPT
+    {
+        if (!str) str = "(null)";
+        Append(str, std::strlen(str));
+    }
+
+    void Append(char* str) CPPFMU_NOEXCEPT
+    {
+        Append(static_cast<const char*>(str));
+    }
+
+    template<typename Traits, typename Alloc>
+    void Append(const std::basic_string<char, Traits, Alloc>& str) CPPFMU_NOEXCEPT
+    {
+        Append(str.data(), str.size());
+    }
+
+    void Append(char c) CPPFMU_NOEXCEPT
+    {
+        Append(&c, 1);
+    }
+
+    void Append(bool b) CPPFMU_NOEXCEPT
+    {
+        Append(b ? "true" : "false");
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        Append(T value) CPPFMU_NOEXCEPT
+    {
+        Printf("%lld", static_cast<long long>(value));
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        Append(T value) CPPFMU_NOEXCEPT
+    {
+        Printf("%llu", static_cast<unsigned long long>(value));
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_enum<T>::value>::type
+        Append(T value) CPPFMU_NOEXCEPT
+    {
+        Printf("%lld", static_cast<long long>(value));
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+        Append(T value) CPPFMU_NOEXCEPT
+    {
+        Printf("%g", static_cast<double>(value));
+    }
+
+    template<typename T>
+    void Append(T* ptr) CPPFMU_NOEXCEPT
+    {
+        Printf("%p", static_cast<const void*>(ptr));
+    }
+
+    void Append(std::nullptr_t) CPPFMU_NOEXCEPT
+    {
+        Append("(null)");
+    }
+
+private:
+    template<typename T>
+    void Printf(const char* format, T value) CPPFMU_NOEXCEPT
+    {
+        const auto room = sizeof m_data - m_size;
+        const auto n = std::snprintf(m_data + m_size, room, format, value);
+        if (n > 0) {
+            m_size += (static_cast<std::size_t>(n) < room)
+                ? static_cast<std::size_t>(n)
+                : room - 1;
+        }
+    }
+
+    char m_data[CPPFMU_LOG_MESSAGE_SIZE];
+    std::size_t m_size;
+};
+
+
+/* Appends 'format' to 'buffer', replacing each occurrence of "{}" with the
+ * next argument in 'args'.  "{{" and "}}" are replaced with "{" and "}".
+ *
+ * Arguments may be of any arithmetic, enum, pointer or string type (both
+ * C strings and std::basic_string, including cppfmu::String), and passing
+ * anything else is a compile-time error.  Placeholders which have no
+ * corresponding argument are replaced with "<?>", and excess arguments are
+ * ignored.  (CPPFMU_LOG_FORMATTED, below, checks the argument count at
+ * compile time.)
+ */
+inline const char* AppendFormatText(MessageBuffer& buffer, const char* format)
+    CPPFMU_NOEXCEPT
+{
+    for (;;) {
+        const auto start = format;
+        while (*format != '\0' && *format != '{' && *format != '}') ++format;
+        buffer.Append(start, static_cast<std::size_t>(format - start));
+        if (*format == '\0') return format;
+        if (format[0] == format[1]) {
+            buffer.Append(format, 1);
+            format += 2;
+        } else if (format[0] == '{' && format[1] == '}') {
+            return format;
+        } else {
+            buffer.Append(format++, 1);
+        }
+    }
+}
+
+inline void FormatMessage(MessageBuffer& buffer, fmiString format)
+    CPPFMU_NOEXCEPT
+{
+    for (;;) {
+        format = AppendFormatText(buffer, format);
+        if (*format == '\0') return;
+        buffer.Append("<?>");
+        format += 2;
+    }
+}
+
+template<typename Arg, typename... Args>
+void FormatMessage(
+    MessageBuffer& buffer,
+    fmiString format,
+    const Arg& arg,
+    const Args&... args) CPPFMU_NOEXCEPT
+{
+    format = AppendFormatText(buffer, format);
+    if (*format == '\0') return;
+    buffer.Append(arg);
+    FormatMessage(buffer, format + 2, args...);
+}
+
+
+/* Returns the number of "{}" placeholders in the format string 'format', or
+ * badFormatString if it contains an unmatched "{" or "}".  This is used to
+ * check format strings at compile time.
+ */
+const std::size_t badFormatString = static_cast<std::size_t>(-1);
+
+constexpr std::size_t CountFormatPlaceholders(
+    const char* format,
+    std::size_t count = 0) CPPFMU_NOEXCEPT
+{
+    return *format == '\0'
+            ? count
+        : (format[0] == '{' && format[1] == '}')
+            ? CountFormatPlaceholders(format + 2, count + 1)
+        : ((format[0] == '{' || format[0] == '}') && format[0] == format[1])
+            ? CountFormatPlaceholders(format + 2, count)
+        : (format[0] == '{' || format[0] == '}')
+            ? badFormatString
+        : CountFormatPlaceholders(format + 1, count);
+}
+
+
+// Used in unevaluated context to count the arguments to a macro.
+template<typename... Args>
+std::integral_constant<std::size_t, sizeof...(Args)> CountArguments(const Args&...);
+
+
+/* A bounded, lock-free, multiple-producer/single-consumer queue of formatted
+ * log messages, used to take the simulation environment's logger callback
+ * out of the path of the code that logs.
+ *
+ * Messages are formatted directly into preallocated slots, so Push() never
+ * allocates memory or blocks, and it may be called from any thread.  If the
+ * queue is full, the message is discarded and counted instead.  Drain() passes
+ * queued messages on in the order they were pushed.  It may also be called
+ * from any thread, but if another thread is already draining the queue, it
+ * returns immediately.
+ *
+ * The implementation is based on Dmitry Vyukov's bounded MPMC queue, in which
+ * each slot carries a sequence number that tells producers and the consumer
+ * whose turn it is to access it.
+ */
+class LogQueue
+{
+public:
+    // The maximum length of a category name, including the terminating null.
+    static const std::size_t maxCategorySize = 32;
+
+    /* Creates a queue with room for at least 'capacity' messages.  The slots
+     * are allocated up front, using 'memory'.
+     */
+    LogQueue(const Memory& memory, std::size_t capacity)
+        : m_memory{memory}
+        , m_mask{RoundUpToPowerOfTwo(capacity) - 1}
+        , m_slots{Allocator<Slot>{memory}.allocate(m_mask + 1)}
+        , m_enqueuePos{0}
+        , m_dequeuePos{0}
+        , m_dropped{0}
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i) {
+            ::new(static_cast<void*>(&m_slots[i])) Slot{};
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_draining.clear();
+    }
+
+    ~LogQueue() CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i) m_slots[i].~Slot();
+        Allocator<Slot>{m_memory}.deallocate(m_slots, m_mask + 1);
+    }
+
+    LogQueue(const LogQueue&) = delete;
+    LogQueue& operator=(const LogQueue&) = delete;
+
+    /* Formats a message printf-style and adds it to the queue.  Returns false
+     * if the queue was full, in which case the message is dropped.
+     */
     template<typename... Args>
-    void Log(
+    bool Push(
         fmiStatus status,
         fmiString category,
         fmiString message,
         Args&&... args) CPPFMU_NOEXCEPT
     {
-        m_fmiLogger(
-            m_component,
-            m_instanceName.c_str(),
-            status,
-            category,
-            message,
-            std::forward<Args>(args)...);
+        auto pos = m_enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &m_slots[pos & m_mask];
+            const auto seq = slot->sequence.load(std::memory_order_acquire);
+            const auto diff =
+                static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->status = status;
+        std::snprintf(slot->category, maxCategorySize, "%s", category);
+        FormatSlot(slot->message, message, std::forward<Args>(args)...);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
     }
 
-    /* Logs a debug message (if debug logging is enabled by the simulation
-     * environment).
+    /* Removes all messages from the queue, in order, calling
+     * 'sink(status, category, message)' for each of them.  If messages have
+     * been dropped since the last call, a warning to that effect is passed
+     * on last.  Returns the number of messages passed to 'sink'.
+     */
+    template<typename Sink>
+    std::size_t Drain(Sink&& sink) CPPFMU_NOEXCEPT
+    {
+        if (m_draining.test_and_set(std::memory_order_acquire)) return 0;
+        std::size_t count = 0;
+        for (;;) {
+            const auto pos = m_dequeuePos.load(std::memory_order_relaxed);
+            auto& slot = m_slots[pos & m_mask];
+            if (slot.sequence.load(std::memory_order_acquire) != pos + 1) break;
+            sink(slot.status, slot.category, slot.message);
+            slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+            m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+            ++count;
+        }
+        if (const auto dropped = m_dropped.exchange(0, std::memory_order_relaxed)) {
+            char message[64];
+            std::snprintf(
+                message,
+                sizeof message,
+                "%lu log message(s) dropped due to full queue",
+                static_cast<unsigned long>(dropped));
+            sink(fmiWarning, "cppfmu", message);
+            ++count;
+        }
+        m_draining.clear(std::memory_order_release);
+        return count;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence;
+        fmiStatus status;
+        char category[maxCategorySize];
+        char message[CPPFMU_LOG_MESSAGE_SIZE];
+    };
+
+    static std::size_t RoundUpToPowerOfTwo(std::size_t n) CPPFMU_NOEXCEPT
+    {
+        std::size_t p = 2;
+        while (p < n) p *= 2;
+        return p;
+    }
+
+    /* Equivalent to snprintf(), but also for a message without arguments,
+     * for which a direct call would trigger -Wformat-security.
      */
+    static void FormatSlot(char* out, fmiString message, ...) CPPFMU_NOEXCEPT
+    {
+        std::va_list args;
+        va_start(args, message);
+        std::vsnprintf(out, CPPFMU_LOG_MESSAGE_SIZE, message, args);
+        va_end(args);
+    }
+
+    const Memory m_memory;
+    const std::size_t m_mask;
+    Slot* const m_slots;
+
+    // Producer and consumer positions are kept on separate cache lines.  This
+    // makes LogQueue over-aligned, so objects which contain it must be
+    // allocated with care (see Component::Create() in fmi_functions.cpp).
+    alignas(64) std::atomic<std::size_t> m_enqueuePos;
+    alignas(64) std::atomic<std::size_t> m_dequeuePos;
+    std::atomic<std::size_t> m_dropped;
+    std::atomic_flag m_draining;
+};
+
+
+/* A fixed-size ring buffer which records the most recent debug messages of
+ * a model instance, regardless of whether debug logging is enabled, so that
+ * they can be logged after the fact if an error occurs.
+ *
+ * To keep recording cheap, messages are not formatted when they are recorded.
+ * Instead, the category, format string and arguments are stored in a binary
+ * record, and formatting is deferred until Dump() is called.  Only a limited
+ * number of arguments of arithmetic, enum, pointer and string types are
+ * supported, and the format string, category and string arguments are
+ * truncated to fit in the record.  Excess or unsupported arguments are
+ * replaced by a placeholder in the output.
+ *
+ * Record() may be called from any thread.  When the buffer is full, the
+ * oldest records are overwritten.
+ */
+class FlightRecorder
+{
+public:
+    // The maximum number of message arguments recorded.
+    static const std::size_t maxArgs = 8;
+
+    /* Creates a recorder with room for at least 'capacity' messages, which
+     * is allocated up front using 'memory'.
+     */
+    FlightRecorder(const Memory& memory, std::size_t capacity)
+        : m_memory{memory}
+        , m_mask{RoundUpToPowerOfTwo(capacity) - 1}
+        , m_records{Allocator<Rec>{memory}.allocate(m_mask + 1)}
+        , m_next{0}
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i) {
+            ::new(static_cast<void*>(&m_records[i])) Rec{};
+        }
+    }
+
+    ~FlightRecorder() CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i) m_records[i].~Rec();
+        Allocator<Rec>{m_memory}.deallocate(m_records, m_mask + 1);
+    }
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // Records a message, with arguments as for Logger::Log().
     template<typename... Args>
-    void DebugLog(
+    void Record(
         fmiStatus status,
         fmiString category,
         fmiString message,
-        Args&&... args) CPPFMU_NOEXCEPT
+        const Args&... args) CPPFMU_NOEXCEPT
     {
-        if (*m_debugLoggingEnabled) {
-            Log(
-                status,
-                category,
-                message,
-                std::forward<Args>(args)...);
+        Store(false, status, category, message, args...);
+    }
+
+    // Records a message, with arguments as for Logger::LogFormatted().
+    template<typename... Args>
+    void RecordFormatted(
+        fmiStatus status,
+        fmiString category,
+        fmiString format,
+        const Args&... args) CPPFMU_NOEXCEPT
+    {
+        Store(true, status, category, format, args...);
+    }
+
+    /* Formats the recorded messages, oldest first, calling
+     * 'sink(status, category, message)' for each of them, and then empties
+     * the buffer.  Records which are overwritten while this function runs
+     * are skipped.  Returns the number of messages passed to 'sink'.
+     */
+    template<typename Sink>
+    std::size_t Dump(Sink&& sink) CPPFMU_NOEXCEPT
+    {
+        const auto end = m_next.load(std::memory_order_acquire);
+        const auto capacity = static_cast<std::uint64_t>(m_mask + 1);
+        auto index = (end > capacity) ? end - capacity : m_dumped;
+        if (index < m_dumped) index = m_dumped;
+        std::size_t count = 0;
+        for (; index < end; ++index) {
+            const auto& live = m_records[index & m_mask];
+            if (live.sequence.load(std::memory_order_acquire) != 2 * index + 2) continue;
+            Rec copy;
+            copy.status = live.status;
+            copy.braces = live.braces;
+            copy.nArgs = live.nArgs;
+            copy.category = live.category;
+            copy.format = live.format;
+            std::memcpy(copy.argTypes, live.argTypes, sizeof copy.argTypes);
+            std::memcpy(copy.args, live.args, sizeof copy.args);
+            std::memcpy(copy.text, live.text, sizeof copy.text);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (live.sequence.load(std::memory_order_relaxed) != 2 * index + 2) continue;
+
+            char message[CPPFMU_LOG_MESSAGE_SIZE];
+            if (copy.braces) {
+                FormatBraces(copy, message, sizeof message);
+            } else {
+                Format(copy, message, sizeof message);
+            }
+            sink(copy.status, copy.text + copy.category, message);
+            ++count;
         }
+        m_dumped = end;
+        return count;
+    }
+
+    /* Forgets the recorded messages, so that the next Dump() only passes on
+     * those recorded after this call.  Must not be called concurrently with
+     * Dump().
+     */
+    void Clear() CPPFMU_NOEXCEPT
+    {
+        m_dumped = m_next.load(std::memory_order_acquire);
     }
 
 private:
-    const fmiComponent m_component;
-    const String m_instanceName;
-    const fmiCallbackLogger m_fmiLogger;
-    std::shared_ptr<bool> m_debugLoggingEnabled;
+    enum ArgType : unsigned char
+    {
+        signedArg,
+        unsignedArg,
+        floatArg,
+        pointerArg,
+        stringArg,
+        unsupportedArg
+    };
+
+    union ArgValue
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void* p;
+        std::size_t s; // offset of string in Rec::text
+    };
+
+    struct Rec
+    {
+        std::atomic<std::uint64_t> sequence;
+        fmiStatus status;
+        bool braces; // {}-style rather than printf-style format
+        unsigned char nArgs;
+        unsigned short category; // offset in 'text'
+        unsigned short format;   // offset in 'text'
+        ArgType argTypes[maxArgs];
+        ArgValue args[maxArgs];
+        char text[160];
+    };
+
+    static std::size_t RoundUpToPowerOfTwo(std::size_t n) CPPFMU_NOEXCEPT
+    {
+        std::size_t p = 2;
+        while (p < n) p *= 2;
+        return p;
+    }
+
+    template<typename... Args>
+    void Store(
+        bool braces,
+        fmiStatus status,
+        fmiString category,
+        fmiString format,
+        const Args&... args) CPPFMU_NOEXCEPT
+    {
+        // Each record is protected by a sequence lock.  The sequence number
+        // is odd while the record is being written, and even otherwise.
+        const auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+        auto& rec = m_records[index & m_mask];
+        rec.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        rec.status = status;
+        rec.braces = braces;
+        rec.nArgs = 0;
+        rec.text[sizeof rec.text - 1] = '\0';
+        std::size_t textPos = 0;
+        rec.category = StoreText(rec, textPos, category);
+        rec.format = StoreText(rec, textPos, format);
+        const int expand[] = { 0, (StoreArg(rec, textPos, args), 0)... };
+        (void) expand;
+
+        rec.sequence.store(2 * index + 2, std::memory_order_release);
+    }
+
+    // Copies a (possibly truncated) string into rec.text and returns its offset.
+    static unsigned short StoreText(
+        Rec& rec,
+        std::size_t& textPos,
+        const char* str) CPPFMU_NOEXCEPT
+    {
+        const auto pos = textPos;
+        if (pos >= sizeof rec.text) return sizeof rec.text - 1;
+        if (!str) str = "(null)";
+        while (textPos < sizeof rec.text - 1 && *str != '\0') {
+            rec.text[textPos++] = *str++;
+        }
+        rec.text[textPos++] = '\0';
+        return static_cast<unsigned short>(pos);
+    }
+
+    static ArgValue* NextArg(Rec& rec, ArgType type) CPPFMU_NOEXCEPT
+    {
+        if (rec.nArgs == maxArgs) return nullptr;
+        rec.argTypes[rec.nArgs] = type;
+        return &rec.args[rec.nArgs++];
+    }
+
+    template<typename T>
+    static typename std::enable_if<
+            std::is_integral<T>::value || std::is_enum<T>::value>::type
+        StoreArg(Rec& rec, std::size_t&, T value) CPPFMU_NOEXCEPT
+    {
+        if (std::is_signed<T>::value || std::is_enum<T>::value) {
+            if (auto a = NextArg(rec, signedArg)) a->i = static_cast<long long>(value);
+        } else {
+            if (auto a = NextArg(rec, unsignedArg)) a->u = static_cast<unsigned long long>(value);
+        }
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+        StoreArg(Rec& rec, std::size_t&, T value) CPPFMU_NOEXCEPT
+    {
+        if (auto a = NextArg(rec, floatArg)) a->d = static_cast<double>(value);
+    }
+
+    template<typename T>
+    static void StoreArg(Rec& rec, std::size_t&, T* value) CPPFMU_NOEXCEPT
+    {
+        if (auto a = NextArg(rec, pointerArg)) a->p = value;
+    }
+
+    static void StoreArg(Rec& rec, std::size_t& textPos, const char* value) CPPFMU_NOEXCEPT
+    {
+        if (auto a = NextArg(rec, stringArg)) a->s = StoreText(rec, textPos, value);
+    }
+
+    static void StoreArg(Rec& rec, std::size_t& textPos, char* value) CPPFMU_NOEXCEPT
+    {
+        StoreArg(rec, textPos, static_cast<const char*>(value));
+    }
+
+    template<typename Traits, typename Alloc>
+    static void StoreArg(
+        Rec& rec,
+        std::size_t& textPos,
+        const std::basic_string<char, Traits, Alloc>& value) CPPFMU_NOEXCEPT
+    {
+        StoreArg(rec, textPos, value.c_str());
+    }
+
+    template<typename T>
+    static typename std::enable_if<
+            !std::is_arithmetic<T>::value && !std::is_enum<T>::value &&
+            !std::is_pointer<T>::value && !std::is_array<T>::value>::type
+        StoreArg(Rec& rec, std::size_t&, const T&) CPPFMU_NOEXCEPT
+    {
+        NextArg(rec, unsupportedArg);
+    }
+
+    /* Formats a record by passing each conversion specification in its
+     * format string to snprintf() along with the corresponding argument,
+     * after adjusting its length modifier to the stored type.
+     */
+    static void Format(const Rec& rec, char* out, std::size_t outSize) CPPFMU_NOEXCEPT
+    {
+        std::size_t n = 0;
+        std::size_t arg = 0;
+        const auto append = [&] (int len) {
+            if (len > 0) n += static_cast<std::size_t>(len);
+            if (n >= outSize) n = outSize - 1;
+        };
+        const char* f = rec.text + rec.format;
+        while (*f != '\0' && n < outSize - 1) {
+            if (*f != '%') {
+                out[n++] = *f++;
+                continue;
+            }
+            if (f[1] == '%') {
+                out[n++] = '%';
+                f += 2;
+                continue;
+            }
+            // Copy flags, width and precision, and skip length modifiers.
+            char spec[32] = "%";
+            std::size_t s = 1;
+            ++f;
+            while (*f != '\0' && std::strchr("-+ #0123456789.", *f) && s < 24) {
+                spec[s++] = *f++;
+            }
+            while (*f != '\0' && std::strchr("hlLqjzt", *f)) ++f;
+            const char conv = *f;
+            if (conv == '\0') break;
+            ++f;
+            if (arg >= rec.nArgs || rec.argTypes[arg] == unsupportedArg) {
+                append(std::snprintf(out + n, outSize - n, "<?>"));
+                ++arg;
+                continue;
+            }
+            const auto type = rec.argTypes[arg];
+            const auto& value = rec.args[arg++];
+            const auto asDouble =
+                type == floatArg ? value.d :
+                type == signedArg ? static_cast<double>(value.i) :
+                static_cast<double>(value.u);
+            const auto asInt =
+                type == floatArg ? static_cast<long long>(value.d) :
+                type == signedArg ? value.i :
+                static_cast<long long>(value.u);
+            if (std::strchr("di", conv)) {
+                spec[s++] = 'l'; spec[s++] = 'l'; spec[s++] = 'd';
+                append(std::snprintf(out + n, outSize - n, spec, asInt));
+            } else if (std::strchr("uoxXc", conv)) {
+                if (conv != 'c') { spec[s++] = 'l'; spec[s++] = 'l'; }
+                spec[s++] = conv;
+                if (conv == 'c') {
+                    append(std::snprintf(out + n, outSize - n, spec, static_cast<int>(asInt)));
+                } else {
+                    append(std::snprintf(out + n, outSize - n, spec,
+                        static_cast<unsigned long long>(asInt)));
+                }
+            } else if (std::strchr("fFeEgGaA", conv)) {
+                spec[s++] = conv;
+                append(std::snprintf(out + n, outSize - n, spec, asDouble));
+            } else if (conv == 's') {
+                spec[s++] = 's';
+                append(std::snprintf(out + n, outSize - n, spec,
+                    type == stringArg ? rec.text + value.s : "<?>"));
+            } else if (conv == 'p') {
+                spec[s++] = 'p';
+                append(std::snprintf(out + n, outSize - n, spec,
+                    type == pointerArg ? value.p : nullptr));
+            } else {
+                append(std::snprintf(out + n, outSize - n, "<?>"));
+            }
+        }
+        out[n] = '\0';
+    }
+
+    // Formats a record with a {}-style format string.
+    static void FormatBraces(const Rec& rec, char* out, std::size_t outSize)
+        CPPFMU_NOEXCEPT
+    {
+        MessageBuffer buffer;
+        const char* f = rec.text + rec.format;
+        for (std::size_t arg = 0; ; ++arg) {
+            f = AppendFormatText(buffer, f);
+            if (*f == '\0') break;
+            f += 2;
+            if (arg >= rec.nArgs) {
+                buffer.Append("<?>");
+                continue;
+            }
+            const auto& value = rec.args[arg];
+            switch (rec.argTypes[arg]) {
+                case signedArg:   buffer.Append(value.i); break;
+                case unsignedArg: buffer.Append(value.u); break;
+                case floatArg:    buffer.Append(value.d); break;
+                case pointerArg:  buffer.Append(value.p); break;
+                case stringArg:   buffer.Append(rec.text + value.s); break;
+                default:          buffer.Append("<?>"); break;
+            }
+        }
+        std::snprintf(out, outSize, "%s", buffer.c_str());
+    }
+
+    const Memory m_memory;
+    const std::size_t m_mask;
+    Rec* const m_records;
+    std::atomic<std::uint64_t> m_next;
+    std::uint64_t m_dumped = 0;
+};
+
+
+/* Identifies a call site which logs a message that may be repeated many
+ * times, and the maximum number of times it should be logged in full.
+ * Objects of this type are normally created by the CPPFMU_LOG_LIMITED and
+ * CPPFMU_LOG_FORMATTED_LIMITED macros (below).
+ */
+struct LogSite
+{
+    fmiString format;
+    unsigned long limit;
 };
 
 
+/* A fixed-size table of per-call-site message counters, which is used to
+ * suppress repeated messages once they have been logged a certain number of
+ * times, and to summarise the ones that were suppressed.
+ *
+ * Call sites are identified by the address of their LogSite object, and
+ * table lookup is lock-free, so that suppressing a message costs little more
+ * than an atomic increment.  If the table is full, Count() always returns
+ * true, so messages from further call sites are never suppressed.
+ */
+class LogRateLimiter
+{
+public:
+    LogRateLimiter() CPPFMU_NOEXCEPT
+    {
+        for (auto& e : m_entries) {
+            e.site.store(nullptr, std::memory_order_relaxed);
+            e.count.store(0, std::memory_order_relaxed);
+            e.status.store(fmiOK, std::memory_order_relaxed);
+        }
+    }
+
+    LogRateLimiter(const LogRateLimiter&) = delete;
+    LogRateLimiter& operator=(const LogRateLimiter&) = delete;
+
+    /* Counts an occurrence of a message with the given status from 'site',
+     * and returns whether it should be logged.
+     */
+    bool Count(const LogSite& site, fmiStatus status) CPPFMU_NOEXCEPT
+    {
+        const auto entry = Find(site);
+        if (!entry) return true;
+        const auto n = entry->count.fetch_add(1, std::memory_order_relaxed);
+        if (n == 0) entry->status.store(status, std::memory_order_relaxed);
+        return n < site.limit;
+    }
+
+    /* For each call site from which messages have been suppressed, calls
+     * 'sink(status, site, suppressedCount)', and then resets all counters.
+     */
+    template<typename Sink>
+    void Summarize(Sink&& sink) CPPFMU_NOEXCEPT
+    {
+        for (auto& e : m_entries) {
+            const auto site = e.site.load(std::memory_order_acquire);
+            if (!site) continue;
+            const auto n = e.count.exchange(0, std::memory_order_relaxed);
+            if (n > site->limit) {
+                sink(e.status.load(std::memory_order_relaxed), *site, n - site->limit);
+            }
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::atomic<const LogSite*> site;
+        std::atomic<unsigned long> count;
+        std::atomic<fmiStatus> status;
+    };
+
+    Entry* Find(const LogSite& site) CPPFMU_NOEXCEPT
+    {
+        const auto hash = reinterpret_cast<std::uintptr_t>(&site) / alignof(LogSite);
+        for (std::size_t i = 0; i < tableSize; ++i) {
+            auto& e = m_entries[(hash + i) % tableSize];
+            auto current = e.site.load(std::memory_order_acquire);
+            if (current == &site) return &e;
+            if (current == nullptr
+                    && (e.site.compare_exchange_strong(current, &site, std::memory_order_acq_rel)
+                        || current == &site)) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    static const std::size_t tableSize = CPPFMU_LOG_RATE_LIMIT_SITES;
+    Entry m_entries[tableSize];
+};
+
+
+/* The binary trace file format.
+ *
+ * A trace file starts with a TraceFileHeader, which is followed by a
+ * sequence of records.  All fields are in the native byte order of the
+ * machine that wrote the file, and every record starts at an offset which
+ * is a multiple of 8.  Each record consists of:
+ *
+ *   - A TraceRecordHeader.
+ *   - 'payloadCount' type tags (one of the TraceValueType characters),
+ *     padded with zeros to a multiple of 8 bytes.
+ *   - The payload values, in the same order.  Numbers occupy 8 bytes.
+ *     A string is stored as an 8-byte length followed by the characters,
+ *     padded with zeros to a multiple of 8 bytes.
+ *
+ * A record whose 'size' is less than sizeof(TraceRecordHeader), or whose
+ * message ID is tracePaddingId, is padding and should be skipped.  A size
+ * of zero marks the end of the data, in case 'dataSize' in the file header
+ * has not been updated (e.g. because the process crashed).
+ */
+const char traceFileMagic[8] = { 'C', 'P', 'P', 'F', 'M', 'U', 'T', 'R' };
+const std::uint32_t traceFileVersion = 1;
+
+// Reserved message IDs.
+const std::uint32_t tracePaddingId = 0xFFFFFFFFu;
+const std::uint32_t traceDefinitionId = 0xFFFFFFFEu; // payload: (u) id, (s) name
+
+struct TraceFileHeader
+{
+    char magic[8];             // traceFileMagic
+    std::uint32_t version;     // traceFileVersion
+    std::uint32_t headerSize;  // sizeof(TraceFileHeader)
+    std::uint64_t dataSize;    // total size of records, 0 if unknown
+    std::int64_t startTime;    // wall clock time in ns since the Unix epoch
+    char instanceName[96];     // null-terminated, possibly truncated
+};
+
+struct TraceRecordHeader
+{
+    std::uint32_t size;        // total record size in bytes, incl. header
+    std::uint32_t messageId;
+    std::uint64_t timestamp;   // steady clock, ns since the start of the trace
+    double simulationTime;
+    std::uint32_t payloadCount;
+    std::uint32_t reserved;
+};
+
+enum TraceValueType : char
+{
+    traceSigned = 'i',         // std::int64_t
+    traceUnsigned = 'u',       // std::uint64_t
+    traceFloat = 'f',          // double
+    traceBool = 'b',           // std::uint64_t, 0 or 1
+    traceString = 's'
+};
+
+
+/* A channel for compact, binary trace records, which are written to
+ * memory provided by a subclass (see TraceFile in cppfmu_trace.hpp).
+ *
+ * Each record contains a timestamp, the current simulation time, a message
+ * ID and a payload of typed values.  Write() may be called from any thread.
+ * It is protected by a spin lock, which is only held while a record is
+ * copied into memory (or in the rare case that the subclass needs to
+ * provide more).
+ */
+class TraceChannel
+{
+public:
+    TraceChannel() CPPFMU_NOEXCEPT
+        : m_startTime{std::chrono::steady_clock::now()}
+        , m_simulationTime{0.0}
+        , m_dropped{0}
+    {
+        m_lock.clear();
+    }
+
+    virtual ~TraceChannel() CPPFMU_NOEXCEPT { }
+
+    TraceChannel(const TraceChannel&) = delete;
+    TraceChannel& operator=(const TraceChannel&) = delete;
+
+    // Sets the simulation time which is stored in subsequent records.
+    void SetSimulationTime(double t) CPPFMU_NOEXCEPT
+    {
+        m_simulationTime.store(t, std::memory_order_relaxed);
+    }
+
+    /* Writes a record.  The values may be of any arithmetic, enum or string
+     * type, and passing anything else is a compile-time error.  If no memory
+     * can be obtained for the record, it is dropped and counted.
+     */
+    template<typename... Args>
+    void Write(std::uint32_t messageId, const Args&... values) CPPFMU_NOEXCEPT
+    {
+        const std::size_t size = sizeof(TraceRecordHeader)
+            + Pad(sizeof...(Args))
+            + PayloadSize(values...);
+        const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_startTime).count();
+
+        while (m_lock.test_and_set(std::memory_order_acquire)) { }
+        if (const auto p = Reserve(size)) {
+            TraceRecordHeader header;
+            header.size = static_cast<std::uint32_t>(size);
+            header.messageId = messageId;
+            header.timestamp = static_cast<std::uint64_t>(timestamp);
+            header.simulationTime = m_simulationTime.load(std::memory_order_relaxed);
+            header.payloadCount = static_cast<std::uint32_t>(sizeof...(Args));
+            header.reserved = 0;
+            std::memcpy(p, &header, sizeof header);
+
+            char* tags = p + sizeof header;
+            char* data = tags + Pad(sizeof...(Args));
+            std::memset(tags, 0, static_cast<std::size_t>(data - tags));
+            const int expand[] = { 0, (WriteValue(tags, data, values), 0)... };
+            (void) expand;
+        } else {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_lock.clear(std::memory_order_release);
+    }
+
+    // Returns the number of records which have been dropped.
+    std::size_t Dropped() const CPPFMU_NOEXCEPT
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+protected:
+    /* Sets the memory area to which records are written.  This should be
+     * called by subclasses in their constructor and in NextWindow().
+     */
+    void SetWindow(char* begin, char* end) CPPFMU_NOEXCEPT
+    {
+        m_pos = begin;
+        m_end = end;
+    }
+
+    /* Called when the current memory area does not have room for a record of
+     * 'minSize' bytes.  The remainder of the area has been filled with
+     * padding.  The function should call SetWindow() with a new area of at
+     * least 'minSize' bytes, and return whether it succeeded.
+     */
+    virtual bool NextWindow(std::size_t minSize) CPPFMU_NOEXCEPT = 0;
+
+    // Returns the number of bytes left in the current window.
+    std::size_t WindowRemaining() const CPPFMU_NOEXCEPT
+    {
+        return static_cast<std::size_t>(m_end - m_pos);
+    }
+
+private:
+    static std::size_t Pad(std::size_t n) CPPFMU_NOEXCEPT
+    {
+        return (n + 7) & ~static_cast<std::size_t>(7);
+    }
+
+    char* Reserve(std::size_t size) CPPFMU_NOEXCEPT
+    {
+        if (WindowRemaining() < size) {
+            if (m_pos && m_pos < m_end) {
+                const auto padding = static_cast<std::uint32_t>(WindowRemaining());
+                std::memcpy(m_pos, &padding, sizeof padding);
+                if (padding >= sizeof(TraceRecordHeader)) {
+                    std::memcpy(m_pos + sizeof padding, &tracePaddingId, sizeof tracePaddingId);
+                }
+            }
+            if (!NextWindow(size) || WindowRemaining() < size) return nullptr;
+        }
+        const auto p = m_pos;
+        m_pos += size;
+        return p;
+    }
+
+    static std::size_t PayloadSize() CPPFMU_NOEXCEPT { return 0; }
+
+    template<typename T, typename... Ts>
+    static std::size_t PayloadSize(const T& value, const Ts&... rest) CPPFMU_NOEXCEPT
+    {
+        return ValueSize(value) + PayloadSize(rest...);
+    }
+
+    template<typename T>
+    static typename std::enable_if<
+            std::is_arithmetic<T>::value || std::is_enum<T>::value,
+            std::size_t>::type
+        ValueSize(T) CPPFMU_NOEXCEPT
+    {
+        return 8;
+    }
+
+    static std::size_t ValueSize(const char* s) CPPFMU_NOEXCEPT
+    {
+        return 8 + Pad(s ? std::strlen(s) : 0);
+    }
+
+    template<typename Traits, typename Alloc>
+    static std::size_t ValueSize(const std::basic_string<char, Traits, Alloc>& s)
+        CPPFMU_NOEXCEPT
+    {
+        return 8 + Pad(s.size());
+    }
+
+    template<typename T>
+    static void WriteNumber(char*& tags, char*& data, TraceValueType type, T value)
+        CPPFMU_NOEXCEPT
+    {
+        *tags++ = type;
+        std::memcpy(data, &value, 8);
+        data += 8;
+    }
+
+    static void WriteValue(char*& tags, char*& data, bool value) CPPFMU_NOEXCEPT
+    {
+        WriteNumber(tags, data, traceBool, static_cast<std::uint64_t>(value));
+    }
+
+    template<typename T>
+    static typename std::enable_if<
+            (std::is_integral<T>::value && std::is_signed<T>::value)
+            || std::is_enum<T>::value>::type
+        WriteValue(char*& tags, char*& data, T value) CPPFMU_NOEXCEPT
+    {
+        WriteNumber(tags, data, traceSigned, static_cast<std::int64_t>(value));
+    }
+
+    template<typename T>
+    static typename std::enable_if<
+            std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        WriteValue(char*& tags, char*& data, T value) CPPFMU_NOEXCEPT
+    {
+        WriteNumber(tags, data, traceUnsigned, static_cast<std::uint64_t>(value));
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+        WriteValue(char*& tags, char*& data, T value) CPPFMU_NOEXCEPT
+    {
+        WriteNumber(tags, data, traceFloat, static_cast<double>(value));
+    }
+
+    static void WriteString(char*& tags, char*& data, const char* s, std::size_t n)
+        CPPFMU_NOEXCEPT
+    {
+        *tags++ = traceString;
+        const auto length = static_cast<std::uint64_t>(n);
+        std::memcpy(data, &length, 8);
+        data += 8;
+        std::memcpy(data, s, n);
+        std::memset(data + n, 0, Pad(n) - n);
+        data += Pad(n);
+    }
+
+    static void WriteValue(char*& tags, char*& data, const char* s) CPPFMU_NOEXCEPT
+    {
+        WriteString(tags, data, s ? s : "", s ? std::strlen(s) : 0);
+    }
+
+    template<typename Traits, typename Alloc>
+    static void WriteValue(
+        char*& tags,
+        char*& data,
+        const std::basic_string<char, Traits, Alloc>& s) CPPFMU_NOEXCEPT
+    {
+        WriteString(tags, data, s.data(), s.size());
+    }
+
+    const std::chrono::steady_clock::time_point m_startTime;
+    std::atomic<double> m_simulationTime;
+    std::atomic<std::size_t> m_dropped;
+    std::atomic_flag m_lock;
+    char* m_pos = nullptr;
+    char* m_end = nullptr;
+};
+
+
+/* A category of debug messages.
+ *
+ * Debug logging can be enabled and disabled separately for each category.
+ * A category is identified by a bit number in the range 0-31, which must be
+ * unique within the model, and has a name which is passed on to the
+ * simulation environment along with each message.  Categories are typically
+ * defined as constants, for example:
+ *
+ *     constexpr cppfmu::LogCategory solverLog{"solver", 1};
+ *
+ * Bit 0 is reserved for messages whose category is only given by name (as
+ * in the variants of Logger::DebugLog() that take an fmiString).
+ */
+struct LogCategory
+{
+    fmiString name;
+    unsigned bit;
+
+    constexpr std::uint32_t Mask() const CPPFMU_NOEXCEPT
+    {
+        return std::uint32_t{1} << bit;
+    }
+};
+
+
+// A debug log mask which enables all categories.
+const std::uint32_t allLogCategories = 0xFFFFFFFFu;
+
+
+/* Returns the debug log mask which enables the categories in 'known' whose
+ * names are listed in 'names'.  Unknown names are ignored, and if 'nNames'
+ * is zero, all categories are enabled.  This corresponds to the semantics of
+ * fmi2SetDebugLogging() in FMI 2.0.
+ */
+template<std::size_t N>
+std::uint32_t DebugLogMask(
+    const LogCategory (&known)[N],
+    const fmiString names[],
+    std::size_t nNames) CPPFMU_NOEXCEPT
+{
+    if (nNames == 0) return allLogCategories;
+    std::uint32_t mask = 0;
+    for (std::size_t i = 0; i < nNames; ++i) {
+        for (const auto& category : known) {
+            if (std::strcmp(names[i], category.name) == 0) mask |= category.Mask();
+        }
+    }
+    return mask;
+}
+
+
+/* A class that can be used to log messages from model code.  All messages are
+ * forwarded to the logging facilities provided by the simulation environment.
+ *
+ * If the logger has been given a LogQueue, messages are formatted into the
+ * queue rather than passed on immediately, and they are only delivered to the
+ * simulation environment when Flush() is called.  This is done automatically
+ * when an FMI function returns.
+ *
+ * If the logger has been given a FlightRecorder, all debug messages are
+ * recorded in it, whether or not debug logging is enabled.
+ *
+ * If the logger has been given a LogRateLimiter, messages logged with
+ * CPPFMU_LOG_LIMITED or CPPFMU_LOG_FORMATTED_LIMITED are suppressed after
+ * they have been logged a certain number of times, and summarised when
+ * FlushSuppressed() is called.  This is done automatically by
+ * fmiTerminateSlave().
+ *
+ * If the logger has been given a TraceChannel, Trace() writes binary trace
+ * records to it.  Otherwise, Trace() does nothing.
+ *
+ * The logger does not copy the instance name or the debug log mask; both are
+ * owned by the FMI component and must outlive the logger and all its copies.
+ * Copying a logger therefore never allocates memory.  In particular, the
+ * logger which is passed to CppfmuInstantiateSlave(), and any copy of it,
+ * must not be used after fmiFreeSlaveInstance() has been called for the
+ * instance.
+ */
+class Logger
+{
+public:
+    /* Creates a logger which refers to the instance name and debug log mask
+     * (see above).
+     */
+    Logger(
+        fmiComponent component,
+        fmiString instanceName,
+        fmiCallbackFunctions callbackFunctions,
+        std::atomic<std::uint32_t>* debugLogMask,
+        LogQueue* queue = nullptr,
+        FlightRecorder* recorder = nullptr,
+        LogRateLimiter* rateLimiter = nullptr,
+        TraceChannel* trace = nullptr)
+        : m_component{component}
+        , m_instanceName{instanceName}
+        , m_fmiLogger{callbackFunctions.logger}
+        , m_debugLogMask{debugLogMask}
+        , m_queue{queue}
+        , m_recorder{recorder}
+        , m_rateLimiter{rateLimiter}
+        , m_trace{trace}
+    {
+    }
+
+    /* Creates a logger which owns a copy of the instance name, and which
+     * logs debug messages in all categories if '*debugLoggingEnabled' is
+     * true.  This is the constructor of earlier versions of CPPFMU, and is
+     * kept for code which creates its own loggers.
+     */
+    Logger(
+        fmiComponent component,
+        String instanceName,
+        fmiCallbackFunctions callbackFunctions,
+        std::shared_ptr<bool> debugLoggingEnabled)
+        : m_ownedName{std::make_shared<const String>(std::move(instanceName))}
+        , m_debugLoggingEnabled{std::move(debugLoggingEnabled)}
+        , m_component{component}
+        , m_instanceName{m_ownedName->c_str()}
+        , m_fmiLogger{callbackFunctions.logger}
+        , m_debugLogMask{nullptr}
+        , m_queue{nullptr}
+        , m_recorder{nullptr}
+        , m_rateLimiter{nullptr}
+        , m_trace{nullptr}
+    {
+    }
+
+    // Returns the name of the instance on whose behalf messages are logged.
+    fmiString InstanceName() const CPPFMU_NOEXCEPT
+    {
+        return m_instanceName;
+    }
+
+    // Logs a message.
+    template<typename... Args>
+    void Log(
+        fmiStatus status,
+        fmiString category,
+        fmiString message,
+        Args&&... args) CPPFMU_NOEXCEPT
+    {
+        if (m_queue) {
+            m_queue->Push(status, category, message, std::forward<Args>(args)...);
+            return;
+        }
+        m_fmiLogger(
+            m_component,
+            m_instanceName,
+            status,
+            category,
+            message,
+            std::forward<Args>(args)...);
+    }
+
+    /* Logs a message which is formatted by FormatMessage(), i.e., with "{}"
+     * placeholders for the arguments, in a stack buffer.  The formatted
+     * message is passed on to the simulation environment with any '%'
+     * characters escaped, so it is not subject to further formatting there.
+     */
+    template<typename... Args>
+    void LogFormatted(
+        fmiStatus status,
+        fmiString category,
+        fmiString format,
+        const Args&... args) CPPFMU_NOEXCEPT
+    {
+        MessageBuffer buffer;
+        FormatMessage(buffer, format, args...);
+        if (m_queue) {
+            m_queue->Push(status, category, "%s", buffer.c_str());
+            return;
+        }
+        char escaped[2 * CPPFMU_LOG_MESSAGE_SIZE];
+        EscapeLogMessage(buffer.c_str(), escaped, sizeof escaped);
+        m_fmiLogger(
+            m_component,
+            m_instanceName,
+            status,
+            category,
+            escaped);
+    }
+
+    /* Logs a debug message (if debug logging is enabled by the simulation
+     * environment).
+     *
+     * Note that the arguments are evaluated even if debug logging is
+     * disabled.  Use CPPFMU_DEBUG_LOG (below) in places where this matters.
+     */
+    template<typename... Args>
+    void DebugLog(
+        fmiStatus status,
+        fmiString category,
+        fmiString message,
+        Args&&... args) CPPFMU_NOEXCEPT
+    {
+        if (status < CPPFMU_DEBUG_LOG_MIN_STATUS) return;
+        if (m_recorder) m_recorder->Record(status, category, message, args...);
+        if (DebugLogEnabled(category)) {
+            Log(
+                status,
+                category,
+                message,
+                std::forward<Args>(args)...);
+        }
+    }
+
+    // Same as the above, but for a specific category.
+    template<typename... Args>
+    void DebugLog(
+        fmiStatus status,
+        const LogCategory& category,
+        fmiString message,
+        Args&&... args) CPPFMU_NOEXCEPT
+    {
+        if (status < CPPFMU_DEBUG_LOG_MIN_STATUS) return;
+        if (m_recorder) m_recorder->Record(status, category.name, message, args...);
+        if (DebugLogEnabled(category)) {
+            Log(
+                status,
+                category.name,
+                message,
+                std::forward<Args>(args)...);
+        }
+    }
+
+    // Logs a debug message formatted as for LogFormatted().
+    template<typename... Args>
+    void DebugLogFormatted(
+        fmiStatus status,
+        fmiString category,
+        fmiString format,
+        const Args&... args) CPPFMU_NOEXCEPT
+    {
+        if (status < CPPFMU_DEBUG_LOG_MIN_STATUS) return;
+        if (m_recorder) m_recorder->RecordFormatted(status, category, format, args...);
+        if (DebugLogEnabled(category)) LogFormatted(status, category, format, args...);
+    }
+
+    // Same as the above, but for a specific category.
+    template<typename... Args>
+    void DebugLogFormatted(
+        fmiStatus status,
+        const LogCategory& category,
+        fmiString format,
+        const Args&... args) CPPFMU_NOEXCEPT
+    {
+        if (status < CPPFMU_DEBUG_LOG_MIN_STATUS) return;
+        if (m_recorder) m_recorder->RecordFormatted(status, category.name, format, args...);
+        if (DebugLogEnabled(category)) LogFormatted(status, category.name, format, args...);
+    }
+
+    // Returns whether debug logging is enabled for 'category'.
+    bool DebugLogEnabled(const LogCategory& category) const CPPFMU_NOEXCEPT
+    {
+        if (!m_debugLogMask) return m_debugLoggingEnabled && *m_debugLoggingEnabled;
+        return (m_debugLogMask->load(std::memory_order_relaxed) & category.Mask()) != 0;
+    }
+
+    /* Returns whether debug logging is enabled for messages whose category is
+     * only given by name.
+     */
+    bool DebugLogEnabled(fmiString /*category*/) const CPPFMU_NOEXCEPT
+    {
+        if (!m_debugLogMask) return m_debugLoggingEnabled && *m_debugLoggingEnabled;
+        return (m_debugLogMask->load(std::memory_order_relaxed) & 1u) != 0;
+    }
+
+    // Returns whether debug messages are being recorded by a FlightRecorder.
+    bool IsRecording() const CPPFMU_NOEXCEPT
+    {
+        return m_recorder != nullptr;
+    }
+
+    /* Sets the debug log mask, in which bit N enables the category with
+     * bit number N.  This affects all copies of this logger.
+     */
+    void SetDebugLogMask(std::uint32_t mask) CPPFMU_NOEXCEPT
+    {
+        if (m_debugLogMask) {
+            m_debugLogMask->store(mask, std::memory_order_relaxed);
+        } else if (m_debugLoggingEnabled) {
+            *m_debugLoggingEnabled = mask != 0;
+        }
+    }
+
+    /* Delivers any queued messages to the simulation environment.  Does
+     * nothing if the logger has no queue.
+     */
+    void Flush() CPPFMU_NOEXCEPT
+    {
+        if (!m_queue) return;
+        m_queue->Drain([this] (fmiStatus status, fmiString category, fmiString message) {
+            char escaped[2 * CPPFMU_LOG_MESSAGE_SIZE];
+            EscapeLogMessage(message, escaped, sizeof escaped);
+            m_fmiLogger(
+                m_component,
+                m_instanceName,
+                status,
+                category,
+                escaped);
+        });
+    }
+
+    /* Writes a binary trace record with the given message ID and payload
+     * values (see TraceChannel::Write()), if tracing is enabled.  Message IDs
+     * are defined by the model; DefineTraceMessage() may be used to give them
+     * names which are shown by the decoder.
+     */
+    template<typename... Args>
+    void Trace(std::uint32_t messageId, const Args&... values) CPPFMU_NOEXCEPT
+    {
+        if (m_trace) m_trace->Write(messageId, values...);
+    }
+
+    // Records the name of a trace message ID in the trace, if enabled.
+    void DefineTraceMessage(std::uint32_t messageId, fmiString name) CPPFMU_NOEXCEPT
+    {
+        if (m_trace) m_trace->Write(traceDefinitionId, messageId, name);
+    }
+
+    // Returns whether binary tracing is enabled.
+    bool IsTracing() const CPPFMU_NOEXCEPT
+    {
+        return m_trace != nullptr;
+    }
+
+    /* Counts an occurrence of a message from 'site', and returns whether it
+     * should be logged.  This is used by CPPFMU_LOG_LIMITED and
+     * CPPFMU_LOG_FORMATTED_LIMITED.
+     */
+    bool CountOccurrence(const LogSite& site, fmiStatus status) CPPFMU_NOEXCEPT
+    {
+        return !m_rateLimiter || m_rateLimiter->Count(site, status);
+    }
+
+    /* Logs a summary for each rate-limited message which has been suppressed
+     * since the last call, and resets the message counters.
+     */
+    void FlushSuppressed() CPPFMU_NOEXCEPT
+    {
+        if (!m_rateLimiter) return;
+        m_rateLimiter->Summarize(
+            [this] (fmiStatus status, const LogSite& site, unsigned long count) {
+                // Insert thousands separators for readability
+                char digits[32];
+                char grouped[48];
+                const auto n = std::snprintf(digits, sizeof digits, "%lu", count);
+                std::size_t j = 0;
+                for (int i = 0; i < n; ++i) {
+                    if (i > 0 && (n - i) % 3 == 0) grouped[j++] = ',';
+                    grouped[j++] = digits[i];
+                }
+                grouped[j] = '\0';
+                LogFormatted(status, "cppfmu", "\"{}\" repeated {} more times", site.format, grouped);
+            });
+    }
+
+    /* Logs the messages held by the flight recorder, if any, and empties it.
+     * This is done automatically when an FMI function fails.
+     */
+    void DumpFlightRecorder() CPPFMU_NOEXCEPT
+    {
+        if (!m_recorder) return;
+        bool first = true;
+        m_recorder->Dump([&] (fmiStatus status, fmiString category, fmiString message) {
+            if (first) {
+                Log(fmiOK, "cppfmu", "Most recent debug messages:");
+                first = false;
+            }
+            char escaped[2 * CPPFMU_LOG_MESSAGE_SIZE];
+            EscapeLogMessage(message, escaped, sizeof escaped);
+            Log(status, category, escaped);
+        });
+    }
+
+private:
+    // Only set by the compatibility constructor.
+    std::shared_ptr<const String> m_ownedName;
+    std::shared_ptr<bool> m_debugLoggingEnabled;
+
+    const fmiComponent m_component;
+    const fmiString m_instanceName;
+    const fmiCallbackLogger m_fmiLogger;
+    std::atomic<std::uint32_t>* m_debugLogMask;
+    LogQueue* m_queue;
+    FlightRecorder* m_recorder;
+    LogRateLimiter* m_rateLimiter;
+    TraceChannel* m_trace;
+};
+
+
+/* Logs a debug message using 'logger', if its status is not below
+ * CPPFMU_DEBUG_LOG_MIN_STATUS and debug logging is enabled for 'category'
+ * (or the logger has a FlightRecorder).  Unlike Logger::DebugLog(), the
+ * message arguments are not evaluated unless the message is actually logged,
+ * and the whole statement is removed by the compiler if the status is a
+ * constant below the threshold.
+ *
+ * 'category' may be a LogCategory or an fmiString, and the remaining
+ * arguments are the same as for Logger::Log(), for example:
+ *
+ *     CPPFMU_DEBUG_LOG(logger, fmiOK, solverLog, "%d iterations", Count());
+ */
+#define CPPFMU_DEBUG_LOG(logger, status, category, ...) \
+    do { \
+        if ((status) >= CPPFMU_DEBUG_LOG_MIN_STATUS \
+                && ((logger).DebugLogEnabled(category) \
+                    || (logger).IsRecording())) { \
+            (logger).DebugLog((status), (category), __VA_ARGS__); \
+        } \
+    } while (false)
+
+
+/* Logs a message using Logger::LogFormatted(), after checking at compile time
+ * that the number of arguments matches the number of placeholders in the
+ * format string, which must be a string literal.  For example:
+ *
+ *     CPPFMU_LOG_FORMATTED(logger, fmiWarning, "", "{} clamped to {}", name, x);
+ */
+#define CPPFMU_LOG_FORMATTED(logger, status, category, ...) \
+    do { \
+        CPPFMU_CHECK_FORMAT(__VA_ARGS__); \
+        (logger).LogFormatted((status), (category), __VA_ARGS__); \
+    } while (false)
+
+
+/* The Logger::DebugLogFormatted() equivalent of CPPFMU_LOG_FORMATTED, which
+ * otherwise works like CPPFMU_DEBUG_LOG.
+ */
+#define CPPFMU_DEBUG_LOG_FORMATTED(logger, status, category, ...) \
+    do { \
+        CPPFMU_CHECK_FORMAT(__VA_ARGS__); \
+        if ((status) >= CPPFMU_DEBUG_LOG_MIN_STATUS \
+                && ((logger).DebugLogEnabled(category) \
+                    || (logger).IsRecording())) { \
+            (logger).DebugLogFormatted((status), (category), __VA_ARGS__); \
+        } \
+    } while (false)
+
+
+/* Logs a message with Logger::Log() or Logger::LogFormatted(), respectively,
+ * at most 'limit' times per instance.  Further messages from the same call
+ * site are only counted, and a summary is logged by fmiTerminateSlave().
+ * The format string must be a string literal, for example:
+ *
+ *     CPPFMU_LOG_LIMITED(logger, 10, fmiWarning, "", "Input clamped: %g", u);
+ */
+#define CPPFMU_LOG_LIMITED(logger, limit, status, category, ...) \
+    do { \
+        static const ::cppfmu::LogSite cppfmuLogSite = { \
+            CPPFMU_EXPAND(CPPFMU_FIRST_ARG_(__VA_ARGS__, ~)), (limit) }; \
+        if ((logger).CountOccurrence(cppfmuLogSite, (status))) { \
+            (logger).Log((status), (category), __VA_ARGS__); \
+        } \
+    } while (false)
+
+#define CPPFMU_LOG_FORMATTED_LIMITED(logger, limit, status, category, ...) \
+    do { \
+        CPPFMU_CHECK_FORMAT(__VA_ARGS__); \
+        static const ::cppfmu::LogSite cppfmuLogSite = { \
+            CPPFMU_EXPAND(CPPFMU_FIRST_ARG_(__VA_ARGS__, ~)), (limit) }; \
+        if ((logger).CountOccurrence(cppfmuLogSite, (status))) { \
+            (logger).LogFormatted((status), (category), __VA_ARGS__); \
+        } \
+    } while (false)
+
+
+// Helper macros for the above.
+#define CPPFMU_CHECK_FORMAT(...) \
+    static_assert( \
+        ::cppfmu::CountFormatPlaceholders( \
+            CPPFMU_EXPAND(CPPFMU_FIRST_ARG_(__VA_ARGS__, ~))) + 1 \
+        == decltype(::cppfmu::CountArguments(__VA_ARGS__))::value, \
+        "Format string is malformed or does not match the number of arguments")
+#define CPPFMU_FIRST_ARG_(first, ...) first
+#define CPPFMU_EXPAND(x) x
+
+
 } // namespace cppfmu
 #endif // header guard
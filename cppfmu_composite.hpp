@@ -0,0 +1,671 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_COMPOSITE_HPP
+#define CPPFMU_COMPOSITE_HPP
+
+#include <algorithm>            // std::copy, std::max, std::min, std::sort
+#include <atomic>               // std::atomic
+#include <condition_variable>   // std::condition_variable
+#include <cstddef>              // std::size_t
+#include <cstdint>              // std::uint32_t
+#include <exception>            // std::exception_ptr, std::current_exception
+#include <mutex>                // std::mutex, std::lock_guard, std::unique_lock
+#include <stdexcept>            // std::invalid_argument, std::out_of_range
+#include <thread>               // std::thread
+#include <utility>              // std::move
+#include <vector>               // std::vector
+
+#include "cppfmu_cs.hpp"
+#include "cppfmu_instrumentation.hpp"
+
+
+namespace cppfmu
+{
+
+/* A pool of threads which run the iterations of a loop in parallel.
+ *
+ * ForEach() runs on the calling thread too, and returns when all iterations
+ * are done.  The threads sleep between calls.  Only one thread may call
+ * ForEach() at a time.
+ */
+class ParallelExecutor
+{
+public:
+    // Creates a pool with 'threads' threads in all, including the caller.
+    explicit ParallelExecutor(std::size_t threads)
+    {
+        for (std::size_t i = 1; i < threads; ++i) {
+            m_threads.emplace_back(&ParallelExecutor::Work, this);
+        }
+    }
+
+    ~ParallelExecutor() CPPFMU_NOEXCEPT
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (auto& t : m_threads) t.join();
+    }
+
+    ParallelExecutor(const ParallelExecutor&) = delete;
+    ParallelExecutor& operator=(const ParallelExecutor&) = delete;
+
+    /* Calls 'f(i)' for each i in [0, count), in parallel.  If any of the
+     * calls throw, the first exception is rethrown when all are done.
+     */
+    template<typename F>
+    void ForEach(std::size_t count, F& f)
+    {
+        if (m_threads.empty() || count <= 1) {
+            for (std::size_t i = 0; i < count; ++i) f(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_invoke = [] (void* context, std::size_t i) { (*static_cast<F*>(context))(i); };
+            m_context = &f;
+            m_count = count;
+            m_next.store(0, std::memory_order_relaxed);
+            m_busy = m_threads.size();
+            m_error = nullptr;
+            ++m_generation;
+        }
+        m_start.notify_all();
+        RunTasks();
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_done.wait(lock, [this] { return m_busy == 0; });
+        if (m_error) std::rethrow_exception(m_error);
+    }
+
+private:
+    void Work()
+    {
+        unsigned generation = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock{m_mutex};
+                m_start.wait(lock, [&] { return m_stop || m_generation != generation; });
+                if (m_stop) return;
+                generation = m_generation;
+            }
+            RunTasks();
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (--m_busy == 0) m_done.notify_one();
+        }
+    }
+
+    void RunTasks() CPPFMU_NOEXCEPT
+    {
+        for (;;) {
+            const auto i = m_next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= m_count) return;
+            try {
+                m_invoke(m_context, i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                if (!m_error) m_error = std::current_exception();
+            }
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    bool m_stop = false;
+    unsigned m_generation = 0;
+    std::size_t m_busy = 0;
+    std::exception_ptr m_error;
+
+    // The current loop
+    void (*m_invoke)(void*, std::size_t) = nullptr;
+    void* m_context = nullptr;
+    std::size_t m_count = 0;
+    std::atomic<std::size_t> m_next{0};
+};
+
+
+/* A slave which consists of other slaves (its children), and acts as a
+ * master for them.
+ *
+ * The composite's variables are mapped to variables of the children with
+ * Expose(), and outputs of children are connected to inputs of others with
+ * Connect().  In DoStep(), each child gets the values of its connected
+ * inputs, and is then stepped, according to the schedule:
+ *
+ *     jacobi       All children are stepped at once, with the inputs they
+ *                  had at the start of the step.
+ *
+ *     gaussSeidel  Children are stepped in the order they were added, and
+ *                  inputs connected to children earlier in the order get
+ *                  the values those had at the end of the step, while
+ *                  inputs connected to later children get the values those
+ *                  had at the start of it.  Children which do not depend
+ *                  on earlier ones in this way are stepped at once.
+ *
+ * Children which are stepped at once run in parallel, on up to 'threads'
+ * threads.  The connections are resolved into flat copy lists the first
+ * time they are needed, so that each step makes only one GetXxx() and one
+ * SetXxx() call per child and type, and copies each value once.  Real,
+ * integer and boolean variables can be connected.
+ *
+ * If a child's DoStep() returns false, the composite's does too, with the
+ * earliest 'endOfStep' of the children which did so.  Exceptions from
+ * children are passed on.
+ *
+ * The worker threads are created with std::thread, and so do not use the
+ * simulation environment's memory functions.  Everything else does.
+ */
+class CompositeSlave : public SlaveInstance
+{
+public:
+    enum class Schedule
+    {
+        jacobi,
+        gaussSeidel
+    };
+
+    /* 'threads' is the maximum number of threads to step children on,
+     * including the calling thread, or 0 to use one per hardware thread.
+     */
+    CompositeSlave(const Memory& memory, Schedule schedule, std::size_t threads = 0)
+        : m_memory{memory}
+        , m_schedule{schedule}
+        , m_maxThreads{threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())}
+        , m_children(Allocator<UniquePtr<SlaveInstance>>{memory})
+        , m_levels(Allocator<std::size_t>{memory})
+        , m_levelBegin(Allocator<std::size_t>{memory})
+        , m_completed(Allocator<char>{memory})
+        , m_endOfStep(Allocator<fmiReal>{memory})
+        , m_vrScratch(Allocator<fmiValueReference>{memory})
+        , m_reals{memory}
+        , m_integers{memory}
+        , m_booleans{memory}
+        , m_exposedReals{memory}
+        , m_exposedIntegers{memory}
+        , m_exposedBooleans{memory}
+        , m_exposedStrings{memory}
+    {
+    }
+
+    // Adds a child, and returns its index.
+    std::size_t AddChild(UniquePtr<SlaveInstance> child)
+    {
+        m_children.push_back(std::move(child));
+        m_resolved = false;
+        return m_children.size() - 1;
+    }
+
+    // Returns the child with index 'child'.
+    SlaveInstance& Child(std::size_t child) const
+    {
+        return *m_children.at(child);
+    }
+
+    /* Makes the variable 'childVr' of the given type of the child with index
+     * 'child' available as the composite's variable 'vr'.
+     */
+    void Expose(
+        VariableType type,
+        fmiValueReference vr,
+        std::size_t child,
+        fmiValueReference childVr)
+    {
+        const Mapping mapping{vr, static_cast<std::uint32_t>(child), childVr};
+        switch (type) {
+            case VariableType::real:    m_exposedReals.entries.push_back(mapping); break;
+            case VariableType::integer: m_exposedIntegers.entries.push_back(mapping); break;
+            case VariableType::boolean: m_exposedBooleans.entries.push_back(mapping); break;
+            case VariableType::string:  m_exposedStrings.entries.push_back(mapping); break;
+            default: throw std::invalid_argument("Invalid variable type");
+        }
+        m_resolved = false;
+    }
+
+    /* Connects the output 'fromVr' of the child 'fromChild' to the input
+     * 'toVr' of the child 'toChild'.  String variables cannot be connected.
+     */
+    void Connect(
+        VariableType type,
+        std::size_t fromChild,
+        fmiValueReference fromVr,
+        std::size_t toChild,
+        fmiValueReference toVr)
+    {
+        const Connection connection{
+            static_cast<std::uint32_t>(fromChild), fromVr,
+            static_cast<std::uint32_t>(toChild), toVr
+        };
+        switch (type) {
+            case VariableType::real:    m_reals.connections.push_back(connection); break;
+            case VariableType::integer: m_integers.connections.push_back(connection); break;
+            case VariableType::boolean: m_booleans.connections.push_back(connection); break;
+            default: throw std::invalid_argument("Only real, integer and boolean variables can be connected");
+        }
+        m_resolved = false;
+    }
+
+    void Initialize(fmiReal tStart, fmiBoolean stopTimeDefined, fmiReal tStop) override
+    {
+        Resolve();
+        for (auto& c : m_children) c->Initialize(tStart, stopTimeDefined, tStop);
+        m_stale = true;
+    }
+
+    void Terminate() override
+    {
+        for (auto& c : m_children) c->Terminate();
+    }
+
+    void Reset() override
+    {
+        for (auto& c : m_children) c->Reset();
+        m_stale = true;
+    }
+
+    void SetReal(const fmiValueReference vr[], std::size_t nvr, const fmiReal value[]) override
+    {
+        Set(m_exposedReals, vr, nvr, value);
+    }
+
+    void SetInteger(const fmiValueReference vr[], std::size_t nvr, const fmiInteger value[]) override
+    {
+        Set(m_exposedIntegers, vr, nvr, value);
+    }
+
+    void SetBoolean(const fmiValueReference vr[], std::size_t nvr, const fmiBoolean value[]) override
+    {
+        Set(m_exposedBooleans, vr, nvr, value);
+    }
+
+    void SetString(const fmiValueReference vr[], std::size_t nvr, const fmiString value[]) override
+    {
+        Set(m_exposedStrings, vr, nvr, value);
+    }
+
+    void GetReal(const fmiValueReference vr[], std::size_t nvr, fmiReal value[]) const override
+    {
+        Get(m_exposedReals, vr, nvr, value);
+    }
+
+    void GetInteger(const fmiValueReference vr[], std::size_t nvr, fmiInteger value[]) const override
+    {
+        Get(m_exposedIntegers, vr, nvr, value);
+    }
+
+    void GetBoolean(const fmiValueReference vr[], std::size_t nvr, fmiBoolean value[]) const override
+    {
+        Get(m_exposedBooleans, vr, nvr, value);
+    }
+
+    void GetString(const fmiValueReference vr[], std::size_t nvr, fmiString value[]) const override
+    {
+        Get(m_exposedStrings, vr, nvr, value);
+    }
+
+    bool DoStep(
+        fmiReal currentCommunicationPoint,
+        fmiReal communicationStepSize,
+        fmiBoolean newStep,
+        fmiReal& endOfStep) override
+    {
+        Resolve();
+        if (m_stale) {
+            for (std::size_t c = 0; c < m_children.size(); ++c) Gather(c);
+            m_stale = false;
+        }
+        SaveStartValues(m_reals);
+        SaveStartValues(m_integers);
+        SaveStartValues(m_booleans);
+        for (std::size_t level = 0; level + 1 < m_levelBegin.size(); ++level) {
+            const auto begin = m_levelBegin[level];
+            const auto count = m_levelBegin[level + 1] - begin;
+            auto step = [&] (std::size_t i) {
+                const auto c = m_levels[begin + i];
+                Scatter(c);
+                m_endOfStep[c] = currentCommunicationPoint + communicationStepSize;
+                m_completed[c] = m_children[c]->DoStep(
+                    currentCommunicationPoint,
+                    communicationStepSize,
+                    newStep,
+                    m_endOfStep[c]);
+            };
+            auto gather = [&] (std::size_t i) { Gather(m_levels[begin + i]); };
+            m_executor->ForEach(count, step);
+            m_executor->ForEach(count, gather);
+        }
+        auto completed = true;
+        for (std::size_t c = 0; c < m_children.size(); ++c) {
+            if (!m_completed[c]) {
+                endOfStep = completed ? m_endOfStep[c] : std::min(endOfStep, m_endOfStep[c]);
+                completed = false;
+            }
+        }
+        return completed;
+    }
+
+private:
+    template<typename T>
+    using Vector = std::vector<T, Allocator<T>>;
+
+    struct Mapping
+    {
+        fmiValueReference vr;
+        std::uint32_t child;
+        fmiValueReference childVr;
+    };
+
+    struct Connection
+    {
+        std::uint32_t fromChild;
+        fmiValueReference fromVr;
+        std::uint32_t toChild;
+        fmiValueReference toVr;
+    };
+
+    // The composite's variables of one type, sorted by value reference.
+    struct Exposed
+    {
+        explicit Exposed(const Memory& memory) : entries(Allocator<Mapping>{memory}) { }
+
+        Vector<Mapping> entries;
+    };
+
+    /* The connections of one type, and the flat copy lists they are
+     * resolved into.  The connected outputs of child c are 'outVrs[i]' for i
+     * in [outBegin[c], outBegin[c+1]), and their values are kept in
+     * 'values[i]'.  Likewise, the connected inputs of child c are 'inVrs[j]'
+     * for j in [inBegin[c], inBegin[c+1]), and get their values from
+     * 'values[inSource[j]]', through 'inValues[j]'.
+     */
+    template<typename T>
+    struct Transfers
+    {
+        explicit Transfers(const Memory& memory)
+            : connections(Allocator<Connection>{memory})
+            , outVrs(Allocator<fmiValueReference>{memory})
+            , outBegin(Allocator<std::size_t>{memory})
+            , inVrs(Allocator<fmiValueReference>{memory})
+            , inSource(Allocator<std::size_t>{memory})
+            , inBegin(Allocator<std::size_t>{memory})
+            , inFromStart(Allocator<char>{memory})
+            , values(Allocator<T>{memory})
+            , startValues(Allocator<T>{memory})
+            , inValues(Allocator<T>{memory})
+        {
+        }
+
+        Vector<Connection> connections;
+        Vector<fmiValueReference> outVrs;
+        Vector<std::size_t> outBegin;
+        Vector<fmiValueReference> inVrs;
+        Vector<std::size_t> inSource;
+        Vector<std::size_t> inBegin;
+        Vector<char> inFromStart; // whether the input gets a start-of-step value
+        Vector<T> values;
+        Vector<T> startValues;    // 'values' at the start of the step, if needed
+        Vector<T> inValues;
+    };
+
+    static void SetValues(SlaveInstance& s, const fmiValueReference vr[], std::size_t n, const fmiReal v[]) { s.SetReal(vr, n, v); }
+    static void SetValues(SlaveInstance& s, const fmiValueReference vr[], std::size_t n, const fmiInteger v[]) { s.SetInteger(vr, n, v); }
+    static void SetValues(SlaveInstance& s, const fmiValueReference vr[], std::size_t n, const fmiBoolean v[]) { s.SetBoolean(vr, n, v); }
+    static void SetValues(SlaveInstance& s, const fmiValueReference vr[], std::size_t n, const fmiString v[]) { s.SetString(vr, n, v); }
+    static void GetValues(const SlaveInstance& s, const fmiValueReference vr[], std::size_t n, fmiReal v[]) { s.GetReal(vr, n, v); }
+    static void GetValues(const SlaveInstance& s, const fmiValueReference vr[], std::size_t n, fmiInteger v[]) { s.GetInteger(vr, n, v); }
+    static void GetValues(const SlaveInstance& s, const fmiValueReference vr[], std::size_t n, fmiBoolean v[]) { s.GetBoolean(vr, n, v); }
+    static void GetValues(const SlaveInstance& s, const fmiValueReference vr[], std::size_t n, fmiString v[]) { s.GetString(vr, n, v); }
+
+    /* Resolves the connections into copy lists and the schedule into levels
+     * of children which can be stepped at once, if anything has changed.
+     */
+    void Resolve()
+    {
+        if (m_resolved) return;
+        const auto n = m_children.size();
+        for (auto e : { &m_exposedReals, &m_exposedIntegers, &m_exposedBooleans, &m_exposedStrings }) {
+            SortExposed(*e);
+        }
+        ResolveTransfers(m_reals);
+        ResolveTransfers(m_integers);
+        ResolveTransfers(m_booleans);
+
+        // Gauss-Seidel: a child comes after the children it depends on.
+        Vector<std::size_t> level(n, 0, Allocator<std::size_t>{m_memory});
+        if (m_schedule == Schedule::gaussSeidel) {
+            for (std::size_t c = 0; c < n; ++c) {
+                ForEachDependency(c, [&] (std::size_t from) {
+                    if (from < c) level[c] = std::max(level[c], level[from] + 1);
+                });
+            }
+        }
+        const auto levelCount = n == 0 ? 0 : *std::max_element(level.begin(), level.end()) + 1;
+        m_levels.clear();
+        m_levelBegin.assign(1, 0);
+        std::size_t widest = 0;
+        for (std::size_t l = 0; l < levelCount; ++l) {
+            for (std::size_t c = 0; c < n; ++c) {
+                if (level[c] == l) m_levels.push_back(c);
+            }
+            widest = std::max(widest, m_levels.size() - m_levelBegin.back());
+            m_levelBegin.push_back(m_levels.size());
+        }
+        m_completed.assign(n, 1);
+        m_endOfStep.assign(n, 0.0);
+
+        const auto threads = std::max<std::size_t>(1, std::min(m_maxThreads, widest));
+        m_executor = AllocateUnique<ParallelExecutor>(m_memory, threads);
+        m_resolved = true;
+    }
+
+    void SortExposed(Exposed& exposed)
+    {
+        auto& e = exposed.entries;
+        std::sort(e.begin(), e.end(), [] (const Mapping& a, const Mapping& b) { return a.vr < b.vr; });
+        for (std::size_t i = 0; i < e.size(); ++i) {
+            if (e[i].child >= m_children.size()) {
+                throw std::out_of_range("Variable mapped to a nonexistent child");
+            }
+            if (i > 0 && e[i].vr == e[i-1].vr) {
+                throw std::invalid_argument("Value reference mapped twice");
+            }
+        }
+    }
+
+    template<typename T>
+    void ResolveTransfers(Transfers<T>& t)
+    {
+        const auto n = m_children.size();
+        for (const auto& c : t.connections) {
+            if (c.fromChild >= n || c.toChild >= n) {
+                throw std::out_of_range("Connection to a nonexistent child");
+            }
+        }
+        // Outputs, grouped by child, each once
+        t.outVrs.clear();
+        t.outBegin.assign(1, 0);
+        Vector<std::size_t> source(t.connections.size(), 0, Allocator<std::size_t>{m_memory});
+        for (std::size_t child = 0; child < n; ++child) {
+            const auto first = t.outVrs.size();
+            for (std::size_t k = 0; k < t.connections.size(); ++k) {
+                const auto& c = t.connections[k];
+                if (c.fromChild != child) continue;
+                auto i = first;
+                while (i < t.outVrs.size() && t.outVrs[i] != c.fromVr) ++i;
+                if (i == t.outVrs.size()) t.outVrs.push_back(c.fromVr);
+                source[k] = i;
+            }
+            t.outBegin.push_back(t.outVrs.size());
+        }
+        // Inputs, grouped by child
+        // With Gauss-Seidel, an input connected to a child which is not
+        // earlier in the order gets the value it had at the start of the
+        // step, even if that child happens to be stepped first.
+        t.inVrs.clear();
+        t.inSource.clear();
+        t.inFromStart.clear();
+        t.inBegin.assign(1, 0);
+        auto needStart = false;
+        for (std::size_t child = 0; child < n; ++child) {
+            for (std::size_t k = 0; k < t.connections.size(); ++k) {
+                const auto& c = t.connections[k];
+                if (c.toChild != child) continue;
+                const auto fromStart = m_schedule == Schedule::gaussSeidel
+                    && c.fromChild >= c.toChild;
+                t.inVrs.push_back(c.toVr);
+                t.inSource.push_back(source[k]);
+                t.inFromStart.push_back(fromStart);
+                needStart = needStart || fromStart;
+            }
+            t.inBegin.push_back(t.inVrs.size());
+        }
+        t.values.assign(t.outVrs.size(), T());
+        t.startValues.assign(needStart ? t.outVrs.size() : 0, T());
+        t.inValues.assign(t.inVrs.size(), T());
+    }
+
+    // Calls 'f(from)' for each child 'from' on which the child 'c' depends.
+    template<typename F>
+    void ForEachDependency(std::size_t c, F&& f) const
+    {
+        for (const auto& x : m_reals.connections) if (x.toChild == c) f(x.fromChild);
+        for (const auto& x : m_integers.connections) if (x.toChild == c) f(x.fromChild);
+        for (const auto& x : m_booleans.connections) if (x.toChild == c) f(x.fromChild);
+    }
+
+    // Copies the connected outputs of child 'c' to the copy lists.
+    void Gather(std::size_t c)
+    {
+        GatherTransfers(m_reals, c);
+        GatherTransfers(m_integers, c);
+        GatherTransfers(m_booleans, c);
+    }
+
+    // Saves the outputs at the start of a step, for the inputs that need them.
+    template<typename T>
+    static void SaveStartValues(Transfers<T>& t)
+    {
+        if (!t.startValues.empty()) {
+            std::copy(t.values.begin(), t.values.end(), t.startValues.begin());
+        }
+    }
+
+    // Sets the connected inputs of child 'c' from the copy lists.
+    void Scatter(std::size_t c)
+    {
+        ScatterTransfers(m_reals, c);
+        ScatterTransfers(m_integers, c);
+        ScatterTransfers(m_booleans, c);
+    }
+
+    template<typename T>
+    void GatherTransfers(Transfers<T>& t, std::size_t c)
+    {
+        const auto begin = t.outBegin[c];
+        const auto count = t.outBegin[c + 1] - begin;
+        if (count > 0) GetValues(*m_children[c], &t.outVrs[begin], count, &t.values[begin]);
+    }
+
+    template<typename T>
+    void ScatterTransfers(Transfers<T>& t, std::size_t c)
+    {
+        const auto begin = t.inBegin[c];
+        const auto count = t.inBegin[c + 1] - begin;
+        if (count == 0) return;
+        for (auto j = begin; j < begin + count; ++j) {
+            t.inValues[j] = t.inFromStart[j]
+                ? t.startValues[t.inSource[j]]
+                : t.values[t.inSource[j]];
+        }
+        SetValues(*m_children[c], &t.inVrs[begin], count, &t.inValues[begin]);
+    }
+
+    /* Looks up the composite variables 'vr', and calls
+     * 'f(child, childVrs, count, offset)' for each run of consecutive
+     * variables which belong to the same child.
+     */
+    template<typename F>
+    void ForEachRun(
+        const Exposed& exposed,
+        const fmiValueReference vr[],
+        std::size_t nvr,
+        F&& f) const
+    {
+        const auto& e = exposed.entries;
+        m_vrScratch.resize(nvr);
+        std::size_t runStart = 0;
+        std::uint32_t runChild = 0;
+        for (std::size_t i = 0; i < nvr; ++i) {
+            const auto it = std::lower_bound(e.begin(), e.end(), vr[i],
+                [] (const Mapping& m, fmiValueReference v) { return m.vr < v; });
+            if (it == e.end() || it->vr != vr[i]) {
+                throw std::out_of_range("Invalid value reference");
+            }
+            if (i > runStart && it->child != runChild) {
+                f(runChild, &m_vrScratch[runStart], i - runStart, runStart);
+                runStart = i;
+            }
+            runChild = it->child;
+            m_vrScratch[i] = it->childVr;
+        }
+        if (nvr > runStart) f(runChild, &m_vrScratch[runStart], nvr - runStart, runStart);
+    }
+
+    template<typename T>
+    void Set(Exposed& exposed, const fmiValueReference vr[], std::size_t nvr, const T value[])
+    {
+        Resolve();
+        m_stale = true;
+        ForEachRun(exposed, vr, nvr,
+            [&] (std::size_t child, const fmiValueReference* childVrs, std::size_t n, std::size_t offset) {
+                SetValues(*m_children[child], childVrs, n, value + offset);
+            });
+    }
+
+    template<typename T>
+    void Get(const Exposed& exposed, const fmiValueReference vr[], std::size_t nvr, T value[]) const
+    {
+        const_cast<CompositeSlave*>(this)->Resolve();
+        ForEachRun(exposed, vr, nvr,
+            [&] (std::size_t child, const fmiValueReference* childVrs, std::size_t n, std::size_t offset) {
+                GetValues(*m_children[child], childVrs, n, value + offset);
+            });
+    }
+
+    Memory m_memory;
+    Schedule m_schedule;
+    std::size_t m_maxThreads;
+    Vector<UniquePtr<SlaveInstance>> m_children;
+    bool m_resolved = false;
+
+    // Whether the outputs may have changed since they were last gathered
+    bool m_stale = true;
+
+    // The children in the order they are stepped, level by level.  The
+    // children of level l are m_levels[m_levelBegin[l] ... m_levelBegin[l+1]).
+    Vector<std::size_t> m_levels;
+    Vector<std::size_t> m_levelBegin;
+    UniquePtr<ParallelExecutor> m_executor;
+
+    // The results of the children's last DoStep()
+    Vector<char> m_completed;
+    Vector<fmiReal> m_endOfStep;
+
+    mutable Vector<fmiValueReference> m_vrScratch;
+    Transfers<fmiReal> m_reals;
+    Transfers<fmiInteger> m_integers;
+    Transfers<fmiBoolean> m_booleans;
+    Exposed m_exposedReals;
+    Exposed m_exposedIntegers;
+    Exposed m_exposedBooleans;
+    Exposed m_exposedStrings;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
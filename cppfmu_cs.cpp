@@ -125,6 +125,14 @@ void SlaveInstance::GetString(
 }
 
 
+UniquePtr<SlaveInstance> SlaveInstance::Clone(
+    Memory /*memory*/,
+    Logger /*logger*/) const
+{
+    return nullptr;
+}
+
+
 SlaveInstance::~SlaveInstance() CPPFMU_NOEXCEPT
 {
     // Do nothing
@@ -8,6 +8,7 @@
 
 #include <vector>
 #include "cppfmu_common.hpp"
+#include "cppfmu_timeline_scope.hpp"
 
 namespace cppfmu
 {
@@ -85,6 +86,26 @@ public:
         fmiBoolean newStep,
         fmiReal& endOfStep) = 0;
 
+    /* Returns a new instance with the same state as this one, which uses
+     * 'memory' and 'logger', or null if the instance cannot be cloned (the
+     * default).
+     *
+     * If fmi_functions.cpp is compiled with CPPFMU_ENABLE_PROTOTYPES, and
+     * CppfmuInstantiateSlave() has created the first instance for a given
+     * set of arguments, CPPFMU clones it to make a prototype, and
+     * creates further instances with the same arguments by cloning the
+     * prototype rather than by calling CppfmuInstantiateSlave() again (see
+     * cppfmu_prototype.hpp).  NOTE: The instance name is not one of these
+     * arguments, so a model which overrides this function must not depend
+     * on the instance name it was created with, except through the logger.
+     *
+     * Data which never changes after construction, e.g. tables, should be
+     * shared between the clones (through a std::shared_ptr<const T>, say)
+     * rather than copied.  The prototype is never used for anything else,
+     * but it may be cloned by several threads at once.
+     */
+    virtual UniquePtr<SlaveInstance> Clone(Memory memory, Logger logger) const;
+
     // The instance is destroyed in fmiFreeSlaveInstance().
     virtual ~SlaveInstance() CPPFMU_NOEXCEPT;
 };
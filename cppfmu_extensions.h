@@ -0,0 +1,127 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_EXTENSIONS_H
+#define CPPFMU_EXTENSIONS_H
+
+/* Declarations of the non-standard functions which are exported by FMUs
+ * built with CPPFMU, in addition to the FMI functions.  This header is
+ * intended for simulation environments (and tests and benchmarks) that
+ * want to use them, and may be included from C code.
+ *
+ * Like the FMI functions, the extension functions are exported with the
+ * model identifier as a prefix, e.g. "MyModel_cppfmuGetCallStatistics".
+ * Hosts should look them up with e.g. dlsym() or GetProcAddress(), and treat
+ * their absence as a sign that the FMU does not support them.
+ */
+
+#include <stddef.h>
+#include <fmiPlatformTypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Statistics for calls to one FMI function on one instance.  Times are in
+ * nanoseconds.  The percentiles are upper bounds, with a resolution of
+ * about 6%.
+ */
+typedef struct
+{
+    const char*        function;    /* e.g. "fmiDoStep" */
+    unsigned long long calls;
+    unsigned long long elements;    /* total 'nvr' for fmiGetXxx/fmiSetXxx */
+    unsigned long long totalTime;
+    unsigned long long minTime;
+    unsigned long long maxTime;
+    unsigned long long p50Time;
+    unsigned long long p90Time;
+    unsigned long long p99Time;
+    unsigned long long p999Time;
+} cppfmuCallStatistics;
+
+
+/* Copies the statistics for up to 'maxCount' FMI functions which have been
+ * called on the instance 'c' to 'stats', and returns the number of functions
+ * for which statistics are available.  Returns 0 if the FMU was built
+ * without CPPFMU_ENABLE_STATISTICS.
+ */
+typedef size_t cppfmuGetCallStatisticsTYPE(
+    fmiComponent c,
+    cppfmuCallStatistics stats[],
+    size_t maxCount);
+
+
+/* The counts of a hardware event during the fmiDoStep() calls of one
+ * instance.  The percentiles and extremes are per step, and the percentiles
+ * are upper bounds, with a resolution of about 6%.
+ */
+typedef struct
+{
+    const char*        event;       /* e.g. "cycles" or "cache_misses" */
+    unsigned long long steps;
+    unsigned long long total;
+    unsigned long long min;
+    unsigned long long max;
+    unsigned long long p50;
+    unsigned long long p90;
+    unsigned long long p99;
+} cppfmuStepCounters;
+
+
+/* Copies the counts for up to 'maxCount' hardware events which have been
+ * counted for the instance 'c' to 'counters', and returns the number of
+ * events for which counts are available.  Returns 0 if the FMU was built
+ * without CPPFMU_ENABLE_PERF_COUNTERS, or if no counters were available.
+ */
+typedef size_t cppfmuGetStepCountersTYPE(
+    fmiComponent c,
+    cppfmuStepCounters counters[],
+    size_t maxCount);
+
+
+/* A connection on the signal bus (see cppfmu_signal_bus.hpp), through which
+ * the instance 'writer' passes 'size' values to the instance 'reader'
+ * without the involvement of the simulation environment.
+ */
+typedef struct
+{
+    const char* signal;
+    const char* writer;
+    const char* reader;
+    size_t      size;
+} cppfmuSignalConnection;
+
+
+/* Copies up to 'maxCount' of the signal bus connections between instances
+ * of the models in this FMU's shared library to 'connections', and returns
+ * the total number of connections.  The strings are copied to 'buffer',
+ * which has room for 'bufferSize' characters, and the pointers in
+ * 'connections' point into it.  Strings which do not fit in 'buffer' are
+ * set to null, in which case the function may be called again with a
+ * larger buffer.
+ */
+typedef size_t cppfmuGetSignalConnectionsTYPE(
+    cppfmuSignalConnection connections[],
+    size_t maxCount,
+    char buffer[],
+    size_t bufferSize);
+
+
+/* Destroys the instances which have been freed with fmiFreeSlaveInstance()
+ * and kept for reuse, and returns their number.  Returns 0 if the FMU was
+ * built without CPPFMU_INSTANCE_POOL_SIZE.  Kept instances are destroyed
+ * with the memory and logger callbacks they were created with, so this must
+ * be called while those are still valid, e.g. before the FMU is unloaded.
+ * Instances which are still kept when the FMU is unloaded are leaked.
+ */
+typedef size_t cppfmuDrainInstancePoolTYPE(void);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* header guard */
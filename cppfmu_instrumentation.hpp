@@ -0,0 +1,856 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_INSTRUMENTATION_HPP
+#define CPPFMU_INSTRUMENTATION_HPP
+
+#include <algorithm>    // std::min
+#include <chrono>       // std::chrono::steady_clock
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <cstring>      // std::memset
+#include <new>          // placement new
+#include <type_traits>  // std::aligned_storage
+
+#ifndef _WIN32
+#   include <time.h>    // clock_gettime
+#endif
+#ifdef CPPFMU_ENABLE_USDT
+#   include <sys/sdt.h> // DTRACE_PROBE5
+#endif
+#ifdef __linux__
+#   include <cerrno>    // errno
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>  // close, read, syscall
+#endif
+
+#include "cppfmu_common.hpp"
+
+
+/* Instrumentation of the FMI functions in fmi_functions.cpp.
+ *
+ * If CPPFMU_ENABLE_STATISTICS is defined, the number of calls, the number of
+ * variables transferred and a latency histogram are recorded for each FMI
+ * function and instance.  The statistics can be queried with the extension
+ * function cppfmuGetCallStatistics() (see cppfmu_extensions.h), and they are
+ * reported by fmiFreeSlaveInstance(): If the CPPFMU_STATISTICS_FILE
+ * environment variable is set, they are appended to the CSV file it names,
+ * otherwise they are logged.
+ *
+ * If CPPFMU_ENABLE_PERF_COUNTERS is defined, each instance also counts CPU
+ * cycles, instructions, last-level cache misses and branch mispredictions
+ * during each fmiDoStep() call, using perf_event_open() on the thread which
+ * calls it.  The totals and per-step distributions are reported along with
+ * the call statistics, and can be queried with cppfmuGetStepCounters().
+ * Counters which the system does not permit (see perf_event_paranoid) or
+ * support (e.g. in many virtual machines) are skipped, with a warning.
+ * This is only supported on Linux.
+ *
+ * If CPPFMU_ENABLE_VARIABLE_PROFILE is defined, each instance counts, per
+ * variable, how often it is written by fmiSetXxx() and read by
+ * fmiGetXxx(), and how many of those transfers were redundant, i.e. how
+ * often a value was written which equals the last known value of the
+ * variable, or read without having changed since it was last transferred.
+ * The profile is reported by fmiFreeSlaveInstance(): If the
+ * CPPFMU_VARIABLE_PROFILE_FILE environment variable is set, it is appended
+ * to the CSV file it names, otherwise a summary is logged.
+ *
+ * If CPPFMU_ENABLE_USDT is defined, user-level statically defined tracing
+ * (USDT) probes are placed at the entry and exit of each FMI function, for
+ * use with e.g. bpftrace, perf or SystemTap.  This requires <sys/sdt.h>,
+ * which is part of SystemTap (on Debian and Ubuntu: systemtap-sdt-dev).
+ * A probe which no tool is attached to costs a single NOP instruction, so
+ * the probes can be left enabled in production builds.  The provider is
+ * "cppfmu", and both probes have the same arguments:
+ *
+ *     cppfmu:fmi_entry, cppfmu:fmi_return
+ *         arg0 = const char*  Name of the FMI function, e.g. "fmiDoStep"
+ *         arg1 = const char*  Instance name
+ *         arg2 = double       Simulation time (communication point)
+ *         arg3 = double       Step size (fmiDoStep only, otherwise 0)
+ *         arg4 = size_t       Number of variables (fmiGetXxx/fmiSetXxx only)
+ *
+ * For example, to print the duration of each fmiDoStep() call per instance:
+ *
+ *     bpftrace -e 'usdt:./MyModel.so:cppfmu:fmi_entry { @t[tid] = nsecs; }
+ *         usdt:./MyModel.so:cppfmu:fmi_return /@t[tid]/ {
+ *             printf("%s %s %d\n", str(arg1), str(arg0), nsecs - @t[tid]);
+ *             delete(@t[tid]); }'
+ */
+#ifdef CPPFMU_ENABLE_USDT
+#   define CPPFMU_PROBE(name, function, instance, time, stepSize, count) \
+        DTRACE_PROBE5(cppfmu, name, function, instance, time, stepSize, count)
+#else
+#   define CPPFMU_PROBE(name, function, instance, time, stepSize, count) \
+        static_cast<void>(0)
+#endif
+
+
+namespace cppfmu
+{
+
+// Identifies an FMI function.
+enum class FmiFunction
+{
+    instantiateSlave,
+    initializeSlave,
+    terminateSlave,
+    resetSlave,
+    freeSlaveInstance,
+    setDebugLogging,
+    getReal,
+    getInteger,
+    getBoolean,
+    getString,
+    setReal,
+    setInteger,
+    setBoolean,
+    setString,
+    setRealInputDerivatives,
+    getRealOutputDerivatives,
+    cancelStep,
+    doStep,
+    getStatus,
+    getRealStatus,
+    getIntegerStatus,
+    getBooleanStatus,
+    getStringStatus,
+
+    count // The number of functions; not a function.
+};
+
+
+// Returns the name of an FMI function, e.g. "fmiDoStep".
+inline const char* FmiFunctionName(FmiFunction function) CPPFMU_NOEXCEPT
+{
+    static const char* const names[] = {
+        "fmiInstantiateSlave",
+        "fmiInitializeSlave",
+        "fmiTerminateSlave",
+        "fmiResetSlave",
+        "fmiFreeSlaveInstance",
+        "fmiSetDebugLogging",
+        "fmiGetReal",
+        "fmiGetInteger",
+        "fmiGetBoolean",
+        "fmiGetString",
+        "fmiSetReal",
+        "fmiSetInteger",
+        "fmiSetBoolean",
+        "fmiSetString",
+        "fmiSetRealInputDerivatives",
+        "fmiGetRealOutputDerivatives",
+        "fmiCancelStep",
+        "fmiDoStep",
+        "fmiGetStatus",
+        "fmiGetRealStatus",
+        "fmiGetIntegerStatus",
+        "fmiGetBooleanStatus",
+        "fmiGetStringStatus",
+    };
+    static_assert(
+        sizeof names / sizeof names[0] == static_cast<std::size_t>(FmiFunction::count),
+        "FmiFunction and its names are out of sync");
+    return names[static_cast<std::size_t>(function)];
+}
+
+
+/* Returns the current time of a monotonic clock in nanoseconds, relative to
+ * an arbitrary, fixed point in time.  On POSIX systems, this is read with
+ * clock_gettime(CLOCK_MONOTONIC), which does not involve a system call on
+ * Linux.
+ */
+inline std::uint64_t MonotonicNanoseconds() CPPFMU_NOEXCEPT
+{
+#ifdef _WIN32
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u
+        + static_cast<std::uint64_t>(ts.tv_nsec);
+#endif
+}
+
+
+/* A histogram of durations in nanoseconds, in the style of HdrHistogram.
+ * It works equally well for other non-negative quantities, such as event
+ * counts.
+ *
+ * Values below 16 ns are counted exactly.  Above that, each power of two is
+ * divided into 16 linear sub-buckets, so that the relative error of the
+ * percentiles is at most 1/16.  Values above 2^40 ns (about 18 minutes) are
+ * counted in the last bucket.  The buckets are allocated on the first call
+ * to Record(), so unused histograms are cheap.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram(const Memory& memory) CPPFMU_NOEXCEPT
+        : m_memory{memory}
+    {
+    }
+
+    ~LatencyHistogram() CPPFMU_NOEXCEPT
+    {
+        if (m_buckets) m_memory.Free(m_buckets);
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Adds a value to the histogram.
+    void Record(std::uint64_t value) CPPFMU_NOEXCEPT
+    {
+        if (!m_buckets) {
+            m_buckets = static_cast<std::uint64_t*>(
+                m_memory.Alloc(bucketCount, sizeof(std::uint64_t)));
+            if (!m_buckets) return;
+            std::memset(m_buckets, 0, bucketCount * sizeof(std::uint64_t));
+        }
+        ++m_buckets[BucketIndex(value)];
+        ++m_count;
+        if (value < m_min) m_min = value;
+        if (value > m_max) m_max = value;
+    }
+
+    // Removes all values, but keeps the buckets for reuse.
+    void Reset() CPPFMU_NOEXCEPT
+    {
+        if (m_buckets) std::memset(m_buckets, 0, bucketCount * sizeof(std::uint64_t));
+        m_count = 0;
+        m_min = ~std::uint64_t{0};
+        m_max = 0;
+    }
+
+    // Returns the number of values recorded.
+    std::uint64_t Count() const CPPFMU_NOEXCEPT { return m_count; }
+
+    // Returns the smallest value recorded, or 0 if there are none.
+    std::uint64_t Min() const CPPFMU_NOEXCEPT { return m_count ? m_min : 0; }
+
+    // Returns the largest value recorded, or 0 if there are none.
+    std::uint64_t Max() const CPPFMU_NOEXCEPT { return m_max; }
+
+    /* Returns an upper bound for the value below which the fraction 'q' of
+     * the recorded values lie, where 0 <= q <= 1.  The bound never exceeds
+     * the largest value recorded.
+     */
+    std::uint64_t Quantile(double q) const CPPFMU_NOEXCEPT
+    {
+        if (m_count == 0) return 0;
+        auto rank = static_cast<std::uint64_t>(q * static_cast<double>(m_count));
+        if (rank >= m_count) rank = m_count - 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            seen += m_buckets[i];
+            if (seen > rank) return std::min(BucketUpperBound(i), m_max);
+        }
+        return m_max;
+    }
+
+private:
+    static const unsigned subBucketBits = 4;
+    static const std::size_t subBuckets = 1u << subBucketBits;
+    static const unsigned maxExponent = 40;
+    static const std::size_t bucketCount =
+        subBuckets + (maxExponent - subBucketBits + 1) * subBuckets;
+
+    static std::size_t BucketIndex(std::uint64_t value) CPPFMU_NOEXCEPT
+    {
+        if (value < subBuckets) return static_cast<std::size_t>(value);
+        unsigned exponent = subBucketBits;
+        while (exponent < maxExponent && (value >> (exponent + 1)) != 0) ++exponent;
+        if ((value >> (exponent + 1)) != 0) return bucketCount - 1;
+        const auto shift = exponent - subBucketBits;
+        const auto sub = static_cast<std::size_t>((value >> shift) & (subBuckets - 1));
+        return subBuckets + (exponent - subBucketBits) * subBuckets + sub;
+    }
+
+    static std::uint64_t BucketUpperBound(std::size_t index) CPPFMU_NOEXCEPT
+    {
+        if (index < subBuckets) return index;
+        const auto exponent =
+            static_cast<unsigned>((index - subBuckets) / subBuckets) + subBucketBits;
+        const auto sub = (index - subBuckets) % subBuckets;
+        const auto shift = exponent - subBucketBits;
+        return ((std::uint64_t{1} << exponent) + (sub << shift))
+            + ((std::uint64_t{1} << shift) - 1);
+    }
+
+    Memory m_memory;
+    std::uint64_t* m_buckets = nullptr;
+    std::uint64_t m_count = 0;
+    std::uint64_t m_min = ~std::uint64_t{0};
+    std::uint64_t m_max = 0;
+};
+
+
+// Call statistics for one FMI function.
+struct FunctionStatistics
+{
+    explicit FunctionStatistics(const Memory& memory) CPPFMU_NOEXCEPT
+        : latency{memory}
+    {
+    }
+
+    void Reset() CPPFMU_NOEXCEPT
+    {
+        calls = 0;
+        elements = 0;
+        totalTime = 0;
+        minTime = ~std::uint64_t{0};
+        maxTime = 0;
+        latency.Reset();
+    }
+
+    std::uint64_t calls = 0;
+    std::uint64_t elements = 0;
+    std::uint64_t totalTime = 0;
+    std::uint64_t minTime = ~std::uint64_t{0};
+    std::uint64_t maxTime = 0;
+    LatencyHistogram latency;
+};
+
+
+/* The hardware events counted by PerfCounters. */
+enum class PerfEvent
+{
+    cycles,
+    instructions,
+    cacheMisses,
+    branchMisses,
+
+    count // The number of events; not an event.
+};
+
+
+// Returns a short name for 'event', e.g. "cycles".
+inline const char* PerfEventName(PerfEvent event) CPPFMU_NOEXCEPT
+{
+    static const char* const names[] = {
+        "cycles",
+        "instructions",
+        "cache_misses",
+        "branch_misses",
+    };
+    return names[static_cast<std::size_t>(event)];
+}
+
+
+/* Hardware performance counters for the user-space execution of one thread,
+ * read with perf_event_open(2).  The counters are opened as one group, so
+ * they are always scheduled onto the CPU together, and read with a single
+ * system call.
+ */
+class PerfCounters
+{
+public:
+    static const std::size_t eventCount = static_cast<std::size_t>(PerfEvent::count);
+
+    PerfCounters() CPPFMU_NOEXCEPT
+    {
+        for (auto& fd : m_fd) fd = -1;
+    }
+
+    ~PerfCounters() CPPFMU_NOEXCEPT
+    {
+        Close();
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /* Makes sure that the counters count the events of the calling thread,
+     * opening them again if they were opened on another thread.  Returns the
+     * error code from the first counter which could not be opened, or 0 if
+     * all could.
+     */
+    int Open() CPPFMU_NOEXCEPT
+    {
+#ifdef __linux__
+        const auto thread = static_cast<long>(::syscall(SYS_gettid));
+        if (thread == m_thread) return m_error;
+        Close();
+        m_thread = thread;
+        m_error = 0;
+        static const std::uint64_t configs[eventCount] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        int leader = -1;
+        for (std::size_t i = 0; i < eventCount; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP
+                | PERF_FORMAT_TOTAL_TIME_ENABLED
+                | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const auto fd = static_cast<int>(::syscall(
+                SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+            if (fd < 0) {
+                if (m_error == 0) m_error = errno;
+                continue;
+            }
+            if (leader < 0) leader = fd;
+            m_fd[i] = fd;
+            m_slot[i] = m_members++;
+        }
+        if (leader >= 0) {
+            ::ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+        return m_error;
+#else
+        m_error = ENOSYS;
+        return m_error;
+#endif
+    }
+
+    // Returns whether 'event' is being counted.
+    bool IsCounting(PerfEvent event) const CPPFMU_NOEXCEPT
+    {
+        return m_fd[static_cast<std::size_t>(event)] >= 0;
+    }
+
+    /* Reads the current counter values into 'values', which is indexed by
+     * PerfEvent, scaled up if the counters have only been on the CPU part of
+     * the time.  Returns false if no counters could be read.
+     */
+    bool Read(std::uint64_t (&values)[eventCount]) const CPPFMU_NOEXCEPT
+    {
+#ifdef __linux__
+        if (m_members == 0) return false;
+        std::uint64_t data[3 + eventCount];
+        const auto leader = Leader();
+        if (::read(leader, data, sizeof data) < static_cast<ssize_t>(3 * sizeof data[0])) {
+            return false;
+        }
+        const auto enabled = data[1];
+        const auto running = data[2];
+        for (std::size_t i = 0; i < eventCount; ++i) {
+            if (m_fd[i] < 0) {
+                values[i] = 0;
+                continue;
+            }
+            const auto raw = data[3 + m_slot[i]];
+            values[i] = running == 0 || running == enabled
+                ? raw
+                : static_cast<std::uint64_t>(
+                    static_cast<double>(raw) * enabled / running);
+        }
+        return true;
+#else
+        (void) values;
+        return false;
+#endif
+    }
+
+private:
+    int Leader() const CPPFMU_NOEXCEPT
+    {
+        for (const auto fd : m_fd) if (fd >= 0) return fd;
+        return -1;
+    }
+
+    void Close() CPPFMU_NOEXCEPT
+    {
+#ifdef __linux__
+        for (auto& fd : m_fd) {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+#endif
+        m_members = 0;
+    }
+
+    int m_fd[eventCount];
+    std::size_t m_slot[eventCount] = {}; // index in the group read
+    std::size_t m_members = 0;
+    long m_thread = -1;
+    int m_error = 0;
+};
+
+
+/* Statistics for the hardware events counted during the fmiDoStep() calls
+ * of one instance.
+ */
+class StepCounters
+{
+public:
+    explicit StepCounters(const Memory& memory) CPPFMU_NOEXCEPT
+        : m_histograms{{memory}, {memory}, {memory}, {memory}}
+    {
+    }
+
+    /* Starts counting for a step on the calling thread.  Returns the error
+     * code from perf_event_open() the first time it fails, so that the
+     * caller can report it, or 0 otherwise.
+     */
+    int Start() CPPFMU_NOEXCEPT
+    {
+        const auto error = m_counters.Open();
+        m_started = m_counters.Read(m_start);
+        if (error == 0 || m_errorReported) return 0;
+        m_errorReported = true;
+        return error;
+    }
+
+    // Ends counting for a step which was started with Start().
+    void Stop() CPPFMU_NOEXCEPT
+    {
+        std::uint64_t end[PerfCounters::eventCount];
+        if (!m_started || !m_counters.Read(end)) return;
+        ++m_steps;
+        for (std::size_t i = 0; i < PerfCounters::eventCount; ++i) {
+            if (!m_counters.IsCounting(static_cast<PerfEvent>(i))) continue;
+            const auto delta = end[i] - m_start[i];
+            m_totals[i] += delta;
+            m_histograms[i].Record(delta);
+        }
+    }
+
+    // Returns whether 'event' has been counted.
+    bool IsCounted(PerfEvent event) const CPPFMU_NOEXCEPT
+    {
+        return Histogram(event).Count() > 0;
+    }
+
+    // The number of steps which have been counted.
+    std::uint64_t Steps() const CPPFMU_NOEXCEPT { return m_steps; }
+
+    // The total count of 'event' over all steps.
+    std::uint64_t Total(PerfEvent event) const CPPFMU_NOEXCEPT
+    {
+        return m_totals[static_cast<std::size_t>(event)];
+    }
+
+    // The distribution of the per-step counts of 'event'.
+    const LatencyHistogram& Histogram(PerfEvent event) const CPPFMU_NOEXCEPT
+    {
+        return m_histograms[static_cast<std::size_t>(event)];
+    }
+
+    // Forgets all steps counted so far.
+    void Reset() CPPFMU_NOEXCEPT
+    {
+        m_steps = 0;
+        for (std::size_t i = 0; i < PerfCounters::eventCount; ++i) {
+            m_totals[i] = 0;
+            m_histograms[i].Reset();
+        }
+    }
+
+private:
+    PerfCounters m_counters;
+    bool m_started = false;
+    bool m_errorReported = false;
+    std::uint64_t m_start[PerfCounters::eventCount] = {};
+    std::uint64_t m_steps = 0;
+    std::uint64_t m_totals[PerfCounters::eventCount] = {};
+    LatencyHistogram m_histograms[PerfCounters::eventCount];
+
+    static_assert(PerfCounters::eventCount == 4,
+        "The constructor must initialise all histograms");
+};
+
+
+/* Call statistics for all FMI functions, for one instance.  The FMI
+ * functions are not called concurrently for one instance, so the counters
+ * are not synchronised.
+ */
+class CallStatistics
+{
+public:
+    explicit CallStatistics(const Memory& memory) CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i < functionCount; ++i) {
+            ::new(static_cast<void*>(&m_storage[i])) FunctionStatistics{memory};
+        }
+    }
+
+    ~CallStatistics() CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i < functionCount; ++i) Get(i).~FunctionStatistics();
+    }
+
+    CallStatistics(const CallStatistics&) = delete;
+    CallStatistics& operator=(const CallStatistics&) = delete;
+
+    // Records a call to 'function' which took 'time' ns.
+    void Record(FmiFunction function, std::uint64_t time, std::size_t elements)
+        CPPFMU_NOEXCEPT
+    {
+        auto& f = Get(static_cast<std::size_t>(function));
+        ++f.calls;
+        f.elements += elements;
+        f.totalTime += time;
+        if (time < f.minTime) f.minTime = time;
+        if (time > f.maxTime) f.maxTime = time;
+        f.latency.Record(time);
+    }
+
+    // Returns the statistics for 'function'.
+    const FunctionStatistics& operator[](FmiFunction function) const CPPFMU_NOEXCEPT
+    {
+        return const_cast<CallStatistics*>(this)->Get(static_cast<std::size_t>(function));
+    }
+
+    // Forgets all calls recorded so far.
+    void Reset() CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i < functionCount; ++i) Get(i).Reset();
+    }
+
+private:
+    static const std::size_t functionCount =
+        static_cast<std::size_t>(FmiFunction::count);
+
+    FunctionStatistics& Get(std::size_t index) CPPFMU_NOEXCEPT
+    {
+        return *reinterpret_cast<FunctionStatistics*>(&m_storage[index]);
+    }
+
+    // FunctionStatistics is neither default constructible nor copyable, so
+    // the array elements are constructed in place.
+    typename std::aligned_storage<
+            sizeof(FunctionStatistics),
+            alignof(FunctionStatistics)>::type
+        m_storage[functionCount];
+};
+
+
+// The FMI variable types, each of which has its own value references.
+enum class VariableType
+{
+    real,
+    integer,
+    boolean,
+    string,
+
+    count // The number of types; not a type.
+};
+
+
+// Returns the name of a variable type, e.g. "Real".
+inline const char* VariableTypeName(VariableType type) CPPFMU_NOEXCEPT
+{
+    static const char* const names[] = { "Real", "Integer", "Boolean", "String" };
+    static_assert(sizeof names / sizeof names[0] ==
+        static_cast<std::size_t>(VariableType::count), "Missing type names");
+    return names[static_cast<std::size_t>(type)];
+}
+
+
+/* Counts the transfers of each variable of one instance, and how many of
+ * them were redundant (see CPPFMU_ENABLE_VARIABLE_PROFILE above).
+ *
+ * The last known value of each variable, whether it was written or read,
+ * is kept for comparison.  Real values are compared bit by bit, and string
+ * values by a 64-bit hash.  The variables are kept in an open-addressing
+ * hash table, which grows as needed.  If memory runs out, the transfers of
+ * variables which have not been seen before are no longer counted, and
+ * Incomplete() returns true.
+ */
+class VariableProfile
+{
+public:
+    struct Counters
+    {
+        std::uint64_t writes;
+        std::uint64_t unchangedWrites;
+        std::uint64_t reads;
+        std::uint64_t unchangedReads;
+    };
+
+    explicit VariableProfile(const Memory& memory) CPPFMU_NOEXCEPT
+        : m_memory{memory}
+    {
+    }
+
+    ~VariableProfile() CPPFMU_NOEXCEPT
+    {
+        if (m_entries) m_memory.Free(m_entries);
+    }
+
+    VariableProfile(const VariableProfile&) = delete;
+    VariableProfile& operator=(const VariableProfile&) = delete;
+
+    // Records that 'value' was written to the variables 'vr'.
+    template<typename T>
+    void RecordWrites(
+        VariableType type,
+        const fmiValueReference vr[],
+        std::size_t nvr,
+        const T value[]) CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i < nvr; ++i) Record(type, vr[i], Bits(value[i]), true);
+    }
+
+    // Records that 'value' was read from the variables 'vr'.
+    template<typename T>
+    void RecordReads(
+        VariableType type,
+        const fmiValueReference vr[],
+        std::size_t nvr,
+        const T value[]) CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i < nvr; ++i) Record(type, vr[i], Bits(value[i]), false);
+    }
+
+    /* Calls f(type, vr, counters) for each variable which has been
+     * transferred, in no particular order.
+     */
+    template<typename F>
+    void ForEach(F f) const
+    {
+        for (std::size_t i = 0; i < m_capacity; ++i) {
+            const auto& e = m_entries[i];
+            if (e.key == 0) continue;
+            f(static_cast<VariableType>((e.key >> 32) - 1),
+                static_cast<fmiValueReference>(e.key & 0xFFFFFFFFu),
+                e.counters);
+        }
+    }
+
+    // Returns true if some transfers were not counted for lack of memory.
+    bool Incomplete() const CPPFMU_NOEXCEPT
+    {
+        return m_incomplete;
+    }
+
+    // Forgets all transfers recorded so far, but keeps the table for reuse.
+    void Reset() CPPFMU_NOEXCEPT
+    {
+        if (m_entries) std::memset(m_entries, 0, m_capacity * sizeof(Entry));
+        m_size = 0;
+        m_incomplete = false;
+    }
+
+private:
+    struct Entry
+    {
+        std::uint64_t key;      // 0 if unused
+        std::uint64_t value;
+        bool known;
+        Counters counters;
+    };
+
+    static std::uint64_t Bits(fmiReal value) CPPFMU_NOEXCEPT
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    static std::uint64_t Bits(fmiInteger value) CPPFMU_NOEXCEPT
+    {
+        return static_cast<std::uint64_t>(value);
+    }
+
+    static std::uint64_t Bits(fmiBoolean value) CPPFMU_NOEXCEPT
+    {
+        return static_cast<std::uint64_t>(value);
+    }
+
+    // FNV-1a, with null distinct from the empty string.
+    static std::uint64_t Bits(fmiString value) CPPFMU_NOEXCEPT
+    {
+        if (!value) return 0;
+        std::uint64_t hash = 14695981039346656037ull;
+        for (auto p = value; *p != '\0'; ++p) {
+            hash = (hash ^ static_cast<unsigned char>(*p)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void Record(VariableType type, fmiValueReference vr, std::uint64_t value, bool write)
+        CPPFMU_NOEXCEPT
+    {
+        const auto key = (static_cast<std::uint64_t>(type) + 1) << 32 | vr;
+        const auto e = Find(key);
+        if (!e) return;
+        const bool unchanged = e->known && e->value == value;
+        auto& c = e->counters;
+        if (write) {
+            ++c.writes;
+            if (unchanged) ++c.unchangedWrites;
+        } else {
+            ++c.reads;
+            if (unchanged) ++c.unchangedReads;
+        }
+        e->value = value;
+        e->known = true;
+    }
+
+    // Returns the entry for 'key', which is added if necessary.
+    Entry* Find(std::uint64_t key) CPPFMU_NOEXCEPT
+    {
+        if (m_capacity > 0) {
+            for (auto i = Hash(key);; i = (i + 1) & (m_capacity - 1)) {
+                auto& e = m_entries[i];
+                if (e.key == key) return &e;
+                if (e.key == 0) break;
+            }
+        }
+        // Keep the load factor at or below 1/2.
+        if (2 * (m_size + 1) > m_capacity && !Grow()) {
+            m_incomplete = true;
+            return nullptr;
+        }
+        auto i = Hash(key);
+        while (m_entries[i].key != 0) i = (i + 1) & (m_capacity - 1);
+        m_entries[i].key = key;
+        ++m_size;
+        return &m_entries[i];
+    }
+
+    std::size_t Hash(std::uint64_t key) const CPPFMU_NOEXCEPT
+    {
+        return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32)
+            & (m_capacity - 1);
+    }
+
+    bool Grow() CPPFMU_NOEXCEPT
+    {
+        const auto oldEntries = m_entries;
+        const auto oldCapacity = m_capacity;
+        const auto capacity = oldCapacity == 0 ? std::size_t{256} : 2 * oldCapacity;
+        // The memory is zeroed by the allocator, as required by FMI.
+        const auto entries = static_cast<Entry*>(m_memory.Alloc(capacity, sizeof(Entry)));
+        if (!entries) return false;
+        m_entries = entries;
+        m_capacity = capacity;
+        for (std::size_t i = 0; i < oldCapacity; ++i) {
+            const auto& e = oldEntries[i];
+            if (e.key == 0) continue;
+            auto j = Hash(e.key);
+            while (m_entries[j].key != 0) j = (j + 1) & (m_capacity - 1);
+            m_entries[j] = e;
+        }
+        if (oldEntries) m_memory.Free(oldEntries);
+        return true;
+    }
+
+    Memory m_memory;
+    Entry* m_entries = nullptr;
+    std::size_t m_capacity = 0;
+    std::size_t m_size = 0;
+    bool m_incomplete = false;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,309 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_MONITOR_HPP
+#define CPPFMU_MONITOR_HPP
+
+#include <atomic>       // std::atomic, std::atomic_thread_fence
+#include <cctype>       // std::isalnum, std::isdigit
+#include <chrono>       // std::chrono::system_clock
+#include <cerrno>       // errno
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint32_t, std::uint64_t, std::int64_t
+#include <cstdio>       // std::snprintf
+#include <cstdlib>      // std::strtoul
+#include <cstring>      // std::memcpy, std::strerror
+#include <new>          // placement new
+#include <stdexcept>    // std::invalid_argument, std::runtime_error
+#include <string>       // std::string
+#include <vector>       // std::vector
+
+#ifndef _WIN32
+#   include <fcntl.h>      // O_CREAT, O_EXCL, O_RDWR
+#   include <sys/mman.h>   // mmap, munmap, shm_open, shm_unlink
+#   include <unistd.h>     // close, ftruncate, getpid
+#endif
+
+#include "cppfmu_common.hpp"
+
+
+/* The number of frames in the ring of an output monitor.  Must be a power of
+ * two.  A reader which falls further behind than this loses frames.
+ */
+#ifndef CPPFMU_MONITOR_FRAMES
+#   define CPPFMU_MONITOR_FRAMES 256
+#endif
+
+/* The maximum number of variables an output monitor publishes, which guards
+ * against typos such as "0-4294967295".
+ */
+#ifndef CPPFMU_MONITOR_MAX_VARIABLES
+#   define CPPFMU_MONITOR_MAX_VARIABLES 10000
+#endif
+
+
+namespace cppfmu
+{
+
+/* The layout of an output monitor's shared memory object.
+ *
+ * The object starts with an OutputMonitorHeader, which is followed by the
+ * value references of the published variables (std::uint32_t each), at
+ * offset 'headerSize', and by a ring of 'frameCapacity' frames, at offset
+ * 'framesOffset'.  Each frame is 'frameSize' bytes long, and consists of an
+ * OutputMonitorFrame followed by the values of the variables, as fmiReal,
+ * in the same order as the value references.
+ *
+ * Frame n, counting from 0, is stored in slot n % frameCapacity.  Its
+ * sequence number is 2n + 1 while it is written and 2n + 2 when it is
+ * complete, so a reader copies a frame and checks that the sequence number
+ * was 2n + 2 both before and after (a seqlock).  'published' is the number
+ * of frames completed so far, and 'closed' is set to 1 when the instance is
+ * freed.  The writer never waits for readers.
+ */
+const char outputMonitorMagic[8] = { 'C', 'P', 'P', 'F', 'M', 'U', 'M', 'N' };
+const std::uint32_t outputMonitorVersion = 1;
+
+struct OutputMonitorHeader
+{
+    char magic[8];                  // outputMonitorMagic
+    std::uint32_t version;          // outputMonitorVersion
+    std::uint32_t headerSize;       // sizeof(OutputMonitorHeader)
+    std::uint32_t variableCount;
+    std::uint32_t frameCapacity;
+    std::uint32_t frameSize;
+    std::uint32_t framesOffset;
+    std::int64_t startTime;         // wall clock time in ns since the Unix epoch
+    char instanceName[96];          // null-terminated, possibly truncated
+    alignas(64) std::atomic<std::uint64_t> published;
+    std::atomic<std::uint32_t> closed;
+};
+
+struct OutputMonitorFrame
+{
+    std::atomic<std::uint64_t> sequence;
+    fmiReal time;                   // the communication point after the step
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+    "Output monitoring requires lock-free 64-bit atomics");
+
+
+/* Publishes the values of selected real variables after each time step in a
+ * named POSIX shared memory object, from which other processes can read them
+ * (see tools/cppfmu_monitor.cpp).
+ *
+ * Publish() is not thread safe, but FMI does not allow concurrent calls to
+ * the same instance anyway.  The object is removed when the monitor is
+ * destroyed, but processes which have it open can still read it.
+ */
+class OutputMonitor
+{
+public:
+    /* Creates a monitor of the variables listed in 'variables', a comma
+     * separated list of real value references and ranges of them, e.g.
+     * "0,3,10-19".  The name of the shared memory object is made unique by
+     * the addition of the process ID and a serial number.  Returns null if
+     * 'variables' is null or empty, and throws if it is invalid, if it
+     * lists more than CPPFMU_MONITOR_MAX_VARIABLES variables, or if the
+     * object could not be created.
+     */
+    static UniquePtr<OutputMonitor> Create(
+        const Memory& memory,
+        const char* variables,
+        const char* instanceName)
+    {
+        if (!variables || *variables == '\0') return nullptr;
+#ifdef _WIN32
+        (void) memory; (void) instanceName;
+        throw std::runtime_error("Output monitoring requires POSIX shared memory");
+#else
+        static std::atomic<unsigned> serial{0};
+
+        char name[96];
+        std::snprintf(name, sizeof name, "%s", instanceName ? instanceName : "");
+        for (auto p = name; *p != '\0'; ++p) {
+            if (!std::isalnum(static_cast<unsigned char>(*p)) && *p != '-') *p = '_';
+        }
+        char objectName[128];
+        std::snprintf(objectName, sizeof objectName, "/cppfmu-%s-%d-%u",
+            name, static_cast<int>(getpid()), serial++);
+
+        return AllocateUnique<OutputMonitor>(
+            memory, memory, variables, objectName, instanceName);
+#endif
+    }
+
+    // Use Create() instead.
+    OutputMonitor(
+        const Memory& memory,
+        const char* variables,
+        const char* objectName,
+        const char* instanceName)
+        : m_references(Allocator<fmiValueReference>{memory})
+    {
+        ParseVariables(variables);
+#ifndef _WIN32
+        std::snprintf(m_name, sizeof m_name, "%s", objectName);
+        const auto frameSize = RoundUp(
+            sizeof(OutputMonitorFrame) + m_references.size() * sizeof(fmiReal), 64);
+        const auto framesOffset = RoundUp(
+            sizeof(OutputMonitorHeader) + m_references.size() * sizeof(fmiValueReference), 64);
+        m_size = framesOffset + CPPFMU_MONITOR_FRAMES * frameSize;
+
+        const auto fd = shm_open(m_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) throw std::runtime_error(std::strerror(errno));
+        if (ftruncate(fd, static_cast<off_t>(m_size)) != 0) {
+            const auto error = errno;
+            close(fd);
+            shm_unlink(m_name);
+            throw std::runtime_error(std::strerror(error));
+        }
+        const auto address = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const auto error = errno;
+        close(fd);
+        if (address == MAP_FAILED) {
+            shm_unlink(m_name);
+            throw std::runtime_error(std::strerror(error));
+        }
+        m_base = static_cast<char*>(address);
+
+        m_header = ::new(m_base) OutputMonitorHeader();
+        std::memcpy(m_header->magic, outputMonitorMagic, sizeof m_header->magic);
+        m_header->version = outputMonitorVersion;
+        m_header->headerSize = sizeof(OutputMonitorHeader);
+        m_header->variableCount = static_cast<std::uint32_t>(m_references.size());
+        m_header->frameCapacity = CPPFMU_MONITOR_FRAMES;
+        m_header->frameSize = static_cast<std::uint32_t>(frameSize);
+        m_header->framesOffset = static_cast<std::uint32_t>(framesOffset);
+        m_header->startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::snprintf(m_header->instanceName, sizeof m_header->instanceName, "%s",
+            instanceName ? instanceName : "");
+        std::memcpy(m_base + sizeof(OutputMonitorHeader), m_references.data(),
+            m_references.size() * sizeof(fmiValueReference));
+        for (std::size_t i = 0; i < CPPFMU_MONITOR_FRAMES; ++i) {
+            ::new(m_base + framesOffset + i * frameSize) OutputMonitorFrame();
+        }
+#else
+        (void) objectName; (void) instanceName;
+#endif
+    }
+
+    ~OutputMonitor() CPPFMU_NOEXCEPT
+    {
+#ifndef _WIN32
+        m_header->closed.store(1, std::memory_order_release);
+        munmap(m_base, m_size);
+        shm_unlink(m_name);
+#endif
+    }
+
+    OutputMonitor(const OutputMonitor&) = delete;
+    OutputMonitor& operator=(const OutputMonitor&) = delete;
+
+    // The name of the shared memory object.
+    const char* Name() const CPPFMU_NOEXCEPT
+    {
+        return m_name;
+    }
+
+    // The number of variables in each frame.
+    std::size_t VariableCount() const CPPFMU_NOEXCEPT
+    {
+        return m_references.size();
+    }
+
+    /* Publishes a frame for the communication point 'time', whose values are
+     * filled in by 'getReal(vr, nvr, value)', typically a call to
+     * SlaveInstance::GetReal().  If 'getReal' throws, the frame is not
+     * published, and its slot is reused for the next one.
+     */
+    template<typename GetReal>
+    void Publish(fmiReal time, GetReal&& getReal)
+    {
+        const auto n = m_published;
+        const auto frame = reinterpret_cast<OutputMonitorFrame*>(
+            m_base + m_header->framesOffset
+            + (n % CPPFMU_MONITOR_FRAMES) * m_header->frameSize);
+        frame->sequence.store(2*n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        frame->time = time;
+        getReal(
+            m_references.data(),
+            m_references.size(),
+            reinterpret_cast<fmiReal*>(frame + 1));
+        frame->sequence.store(2*n + 2, std::memory_order_release);
+        m_header->published.store(n + 1, std::memory_order_release);
+        m_published = n + 1;
+    }
+
+private:
+    static_assert((CPPFMU_MONITOR_FRAMES & (CPPFMU_MONITOR_FRAMES - 1)) == 0,
+        "CPPFMU_MONITOR_FRAMES must be a power of two");
+
+    static std::size_t RoundUp(std::size_t size, std::size_t alignment) CPPFMU_NOEXCEPT
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    void ParseVariables(const char* variables)
+    {
+        auto p = variables;
+        for (;;) {
+            const auto first = ParseReference(p, variables);
+            auto last = first;
+            if (*p == '-') last = ParseReference(++p, variables);
+            if (last < first) {
+                throw std::invalid_argument(
+                    std::string("Invalid range of value references: ") + variables);
+            }
+            if (std::uint64_t{last} - first + 1
+                    > CPPFMU_MONITOR_MAX_VARIABLES - m_references.size()) {
+                throw std::invalid_argument(
+                    std::string("Too many value references to monitor: ") + variables);
+            }
+            for (auto vr = first; ; ++vr) {
+                m_references.push_back(vr);
+                if (vr == last) break;
+            }
+            if (*p == '\0') break;
+            if (*p++ != ',') {
+                throw std::invalid_argument(
+                    std::string("Invalid list of value references: ") + variables);
+            }
+        }
+    }
+
+    static fmiValueReference ParseReference(const char*& p, const char* variables)
+    {
+        while (*p == ' ') ++p;
+        if (!std::isdigit(static_cast<unsigned char>(*p))) {
+            throw std::invalid_argument(
+                std::string("Invalid list of value references: ") + variables);
+        }
+        char* end = nullptr;
+        errno = 0;
+        const auto value = std::strtoul(p, &end, 10);
+        if (errno == ERANGE || value > 0xFFFFFFFFul) {
+            throw std::invalid_argument(
+                std::string("Value reference out of range: ") + variables);
+        }
+        p = end;
+        while (*p == ' ') ++p;
+        return static_cast<fmiValueReference>(value);
+    }
+
+    std::vector<fmiValueReference, Allocator<fmiValueReference>> m_references;
+    char m_name[128] = {};
+    char* m_base = nullptr;
+    std::size_t m_size = 0;
+    OutputMonitorHeader* m_header = nullptr;
+    std::uint64_t m_published = 0;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
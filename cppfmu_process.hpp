@@ -0,0 +1,945 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_PROCESS_HPP
+#define CPPFMU_PROCESS_HPP
+
+/* Out-of-process execution of slave instances (Linux only).
+ *
+ * If fmi_functions.cpp is compiled with CPPFMU_OUT_OF_PROCESS defined, each
+ * instance's SlaveInstance runs in a child process, which is forked from the
+ * simulation environment in fmiInstantiateSlave().  The exported functions
+ * then act as a thin proxy: a RemoteSlave forwards every call, with its
+ * arguments, to the child, and waits for the result.  A model which crashes
+ * or aborts only takes down its own process, and the calls to the instance
+ * fail with fmiError instead.
+ *
+ * Calls and results are passed through two single-producer, single-consumer
+ * byte rings in an anonymous shared memory mapping, one in each direction.
+ * Messages which do not fit in a ring are streamed through it in pieces.  A
+ * process which waits for the other spins for a while, and then sleeps on a
+ * futex, waking up regularly to check that the other process is still alive.
+ *
+ * Messages logged by the model are passed back to the simulation
+ * environment, also when they are logged from threads of the model's own
+ * between calls; these are delivered with the result of the next call.  In
+ * the child process, the model allocates memory with std::calloc() and
+ * std::free() rather than the simulation environment's allocator.  Everything
+ * else in fmi_functions.cpp (statistics, recording, tracing, etc.) happens in
+ * the simulation environment's process, and so does not see the model's own
+ * work, only the calls to it.
+ *
+ * The child process is forked without exec, and goes on to run the model.
+ * This is only safe if the simulation environment has a single thread when
+ * it calls fmiInstantiateSlave(): a lock which another thread holds at the
+ * time of the fork, e.g. one in malloc or in the simulation environment's
+ * logger, is never released in the child, which may then deadlock.  A
+ * warning is logged if the simulation environment has several threads.
+ * Each child exits when it finds that its parent process has exited.
+ */
+
+#ifndef __linux__
+#   error "Out-of-process execution is only supported on Linux"
+#endif
+
+#include <atomic>       // std::atomic
+#include <cerrno>       // errno
+#include <chrono>       // std::chrono::steady_clock
+#include <climits>      // INT_MAX
+#include <cstdarg>      // va_list
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint8_t, std::uint32_t, std::int32_t
+#include <cstdio>       // std::fflush, std::fopen, std::fgets, std::fclose, std::snprintf, std::vsnprintf
+#include <cstdlib>      // std::calloc, std::free, std::strtol
+#include <cstring>      // std::memcpy, std::strerror, std::strlen, std::strncmp
+#include <mutex>        // std::mutex, std::lock_guard
+#include <new>          // placement new
+#include <stdexcept>    // std::runtime_error
+#include <string>       // std::string
+#include <type_traits>  // std::is_arithmetic
+#include <vector>       // std::vector
+
+#include <linux/futex.h>    // FUTEX_WAIT, FUTEX_WAKE
+#include <signal.h>         // kill, SIGKILL
+#include <sys/mman.h>       // mmap, munmap
+#include <sys/syscall.h>    // SYS_futex
+#include <sys/wait.h>       // waitpid
+#include <unistd.h>         // fork, getpid, getppid, sysconf, syscall, _exit
+
+#include "cppfmu_cs.hpp"
+#include "cppfmu_instrumentation.hpp"
+
+
+/* The size of each of the two rings through which an instance and its
+ * process communicate, in bytes.  Must be a power of two.
+ */
+#ifndef CPPFMU_PROCESS_RING_SIZE
+#   define CPPFMU_PROCESS_RING_SIZE (64 * 1024)
+#endif
+
+/* The number of times a process checks the ring before it goes to sleep
+ * while waiting for the other process, on machines with more than one CPU.
+ */
+#ifndef CPPFMU_PROCESS_SPIN_COUNT
+#   define CPPFMU_PROCESS_SPIN_COUNT 1000
+#endif
+
+/* How long the simulation environment waits for the process to finish
+ * fmiFreeSlaveInstance(), in milliseconds, before it is killed.
+ */
+#ifndef CPPFMU_PROCESS_EXIT_TIMEOUT_MS
+#   define CPPFMU_PROCESS_EXIT_TIMEOUT_MS 5000
+#endif
+
+
+namespace cppfmu
+{
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+    "Shared memory rings require lock-free 32-bit atomics");
+
+// The length by which a null string is sent through a ProcessChannel.
+const std::uint32_t processNullString = 0xFFFFFFFFu;
+
+
+/* A single-producer, single-consumer byte ring in shared memory.  'head'
+ * and 'tail' count the bytes written and read so far, modulo 2^32, and the
+ * "waiting" flags tell the other side that it must wake the futex on the
+ * corresponding counter when it changes.
+ */
+struct SharedRing
+{
+    static const std::uint32_t size = CPPFMU_PROCESS_RING_SIZE;
+    static_assert((size & (size - 1)) == 0, "Ring size must be a power of two");
+
+    alignas(64) std::atomic<std::uint32_t> head;
+    std::atomic<std::uint32_t> readerWaiting;
+    alignas(64) std::atomic<std::uint32_t> tail;
+    std::atomic<std::uint32_t> writerWaiting;
+    alignas(64) char data[size];
+};
+
+
+// The shared memory of one instance.
+struct SharedChannel
+{
+    SharedRing requests;    // simulation environment -> process
+    SharedRing responses;   // process -> simulation environment
+};
+
+
+/* One process's end of a SharedChannel: it writes to one ring and reads from
+ * the other.
+ *
+ * Written data is published to the reader by Flush(), and read data is
+ * released to the writer by Release(), or when either side has to wait.  If
+ * the other process stops while this one is waiting for it, a child process
+ * exits, while the parent throws std::runtime_error.
+ */
+class ProcessChannel
+{
+public:
+    ProcessChannel(SharedRing& out, SharedRing& in, pid_t peer, bool peerIsParent)
+        CPPFMU_NOEXCEPT
+        : m_out(out)
+        , m_in(in)
+        , m_head{out.head.load(std::memory_order_relaxed)}
+        , m_tail{in.tail.load(std::memory_order_relaxed)}
+        , m_peer{peer}
+        , m_peerIsParent{peerIsParent}
+    {
+    }
+
+    ProcessChannel(const ProcessChannel&) = delete;
+    ProcessChannel& operator=(const ProcessChannel&) = delete;
+
+    void Write(const void* data, std::size_t size)
+    {
+        auto p = static_cast<const char*>(data);
+        while (size > 0) {
+            const auto tail = m_out.tail.load(std::memory_order_acquire);
+            const auto space = SharedRing::size - (m_head - tail);
+            if (space == 0) {
+                Flush();
+                Wait(m_out.tail, tail, m_out.writerWaiting);
+                continue;
+            }
+            const auto offset = m_head & (SharedRing::size - 1);
+            const auto n = Min(size, space, SharedRing::size - offset);
+            std::memcpy(m_out.data + offset, p, n);
+            m_head += static_cast<std::uint32_t>(n);
+            p += n;
+            size -= n;
+        }
+    }
+
+    void Read(void* data, std::size_t size)
+    {
+        auto p = static_cast<char*>(data);
+        while (size > 0) {
+            const auto head = m_in.head.load(std::memory_order_acquire);
+            const auto available = head - m_tail;
+            if (available == 0) {
+                Release();
+                Wait(m_in.head, head, m_in.readerWaiting);
+                continue;
+            }
+            const auto offset = m_tail & (SharedRing::size - 1);
+            const auto n = Min(size, available, SharedRing::size - offset);
+            std::memcpy(p, m_in.data + offset, n);
+            m_tail += static_cast<std::uint32_t>(n);
+            p += n;
+            size -= n;
+        }
+    }
+
+    // Makes everything written so far available to the reader.
+    void Flush() CPPFMU_NOEXCEPT
+    {
+        if (m_out.head.load(std::memory_order_relaxed) == m_head) return;
+        m_out.head.store(m_head, std::memory_order_seq_cst);
+        if (m_out.readerWaiting.load(std::memory_order_seq_cst)) Wake(m_out.head);
+    }
+
+    // Gives the space of everything read so far back to the writer.
+    void Release() CPPFMU_NOEXCEPT
+    {
+        if (m_in.tail.load(std::memory_order_relaxed) == m_tail) return;
+        m_in.tail.store(m_tail, std::memory_order_seq_cst);
+        if (m_in.writerWaiting.load(std::memory_order_seq_cst)) Wake(m_in.tail);
+    }
+
+    template<typename T>
+    void Put(T value)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Not a number");
+        Write(&value, sizeof value);
+    }
+
+    template<typename T>
+    void PutArray(const T* values, std::size_t count)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Not a number array");
+        Write(values, count * sizeof(T));
+    }
+
+    // Writes a string as its length followed by its characters.  A null
+    // string has the length 0xFFFFFFFF.
+    void PutString(const char* s)
+    {
+        const auto length = s ? static_cast<std::uint32_t>(std::strlen(s)) : processNullString;
+        Put(length);
+        if (s) Write(s, length);
+    }
+
+    template<typename T>
+    T Get()
+    {
+        static_assert(std::is_arithmetic<T>::value, "Not a number");
+        T value;
+        Read(&value, sizeof value);
+        return value;
+    }
+
+    template<typename T>
+    void GetArray(T* values, std::size_t count)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Not a number array");
+        Read(values, count * sizeof(T));
+    }
+
+    // Reads a string written by PutString().  Returns false if it was null.
+    bool GetString(std::string& s)
+    {
+        const auto length = Get<std::uint32_t>();
+        if (length == processNullString) return false;
+        s.resize(length);
+        if (length > 0) Read(&s[0], length);
+        return true;
+    }
+
+    /* Sets a point in time after which a parent gives up waiting for its
+     * child, and throws std::runtime_error.
+     */
+    void SetDeadline(std::chrono::steady_clock::time_point deadline) CPPFMU_NOEXCEPT
+    {
+        m_deadline = deadline;
+        m_hasDeadline = true;
+    }
+
+    // Returns whether the parent has found the child to have exited.
+    bool PeerExited() const CPPFMU_NOEXCEPT
+    {
+        return m_peerExited;
+    }
+
+private:
+    static std::size_t Min(std::size_t a, std::size_t b, std::size_t c) CPPFMU_NOEXCEPT
+    {
+        return a < b ? (a < c ? a : c) : (b < c ? b : c);
+    }
+
+    static void CpuRelax() CPPFMU_NOEXCEPT
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    static void Wake(std::atomic<std::uint32_t>& word) CPPFMU_NOEXCEPT
+    {
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE,
+            INT_MAX, nullptr, nullptr, 0);
+    }
+
+    /* Waits until 'word' no longer has the value 'value', or for up to a
+     * tenth of a second, after which the other process is checked.
+     */
+    void Wait(
+        std::atomic<std::uint32_t>& word,
+        std::uint32_t value,
+        std::atomic<std::uint32_t>& waiting)
+    {
+        // Spinning only delays the other process if they share a CPU.
+        static const int spinCount =
+            sysconf(_SC_NPROCESSORS_ONLN) > 1 ? CPPFMU_PROCESS_SPIN_COUNT : 0;
+        for (int i = 0; i < spinCount; ++i) {
+            if (word.load(std::memory_order_acquire) != value) return;
+            CpuRelax();
+        }
+        waiting.store(1, std::memory_order_seq_cst);
+        if (word.load(std::memory_order_seq_cst) == value) {
+            timespec timeout{0, 100 * 1000 * 1000};
+            syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+                FUTEX_WAIT, value, &timeout, nullptr, 0);
+        }
+        waiting.store(0, std::memory_order_relaxed);
+        if (word.load(std::memory_order_acquire) == value) CheckPeer();
+    }
+
+    void CheckPeer()
+    {
+        if (m_peerIsParent) {
+            if (getppid() != m_peer) _exit(1);
+            return;
+        }
+        if (!m_peerExited) {
+            int status = 0;
+            if (waitpid(m_peer, &status, WNOHANG) == 0) {
+                if (m_hasDeadline && std::chrono::steady_clock::now() > m_deadline) {
+                    throw std::runtime_error("Timed out waiting for the slave process");
+                }
+                return;
+            }
+            m_peerExited = true;
+            m_exitStatus = status;
+        }
+        char message[128];
+        if (WIFSIGNALED(m_exitStatus)) {
+            std::snprintf(message, sizeof message,
+                "The slave process was terminated by signal %d (%s)",
+                WTERMSIG(m_exitStatus), strsignal(WTERMSIG(m_exitStatus)));
+        } else {
+            std::snprintf(message, sizeof message,
+                "The slave process exited with status %d",
+                WEXITSTATUS(m_exitStatus));
+        }
+        throw std::runtime_error(message);
+    }
+
+    SharedRing& m_out;
+    SharedRing& m_in;
+    std::uint32_t m_head;
+    std::uint32_t m_tail;
+    pid_t m_peer;
+    bool m_peerIsParent;
+    bool m_peerExited = false;
+    int m_exitStatus = 0;
+    bool m_hasDeadline = false;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+
+/* A SlaveInstance which forwards all calls to a slave in a child process.
+ *
+ * Each call is a request, which consists of a header (the FmiFunction, the
+ * number of variables and the current debug log mask) and the arguments.
+ * The child answers with any number of log items, tagged 'L', followed by a
+ * result item, tagged 'R', which holds an outcome (0 for success, 1 for an
+ * error and 2 for a fatal error), the debug log mask (which the model may
+ * have changed) and either the error message or the values returned by the
+ * call.
+ */
+class RemoteSlave : public SlaveInstance
+{
+public:
+    /* Forks a child process in which 'factory' is called with a Memory and a
+     * Logger to create the actual slave, and returns a proxy for it.
+     * Throws if the process could not be created, or if the slave could not
+     * be created in it.
+     */
+    template<typename Factory>
+    static UniquePtr<RemoteSlave> Create(
+        const Memory& memory,
+        const Logger& logger,
+        std::atomic<std::uint32_t>& debugLogMask,
+        Factory factory)
+    {
+        const auto address = mmap(nullptr, sizeof(SharedChannel),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error(std::strerror(errno));
+        }
+        if (ThreadCount() > 1) {
+            Logger{logger}.Log(fmiWarning, "cppfmu",
+                "The slave process is forked from a multithreaded process, "
+                "and may deadlock");
+        }
+        const auto shared = ::new(address) SharedChannel();
+        const auto parent = getpid();
+        const auto mask = debugLogMask.load();
+        // Buffered output would otherwise be written by both processes.
+        std::fflush(nullptr);
+        const auto pid = fork();
+        if (pid < 0) {
+            const auto error = errno;
+            munmap(address, sizeof(SharedChannel));
+            throw std::runtime_error(std::strerror(error));
+        }
+        if (pid == 0) {
+            // The child checks regularly whether the parent is still alive.
+            if (getppid() != parent) _exit(1);
+            Serve(*shared, parent, logger.InstanceName(), mask, factory);
+        }
+
+        UniquePtr<RemoteSlave> slave;
+        try {
+            slave = AllocateUnique<RemoteSlave>(
+                memory, memory, logger, debugLogMask, shared, pid);
+        } catch (...) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            munmap(address, sizeof(SharedChannel));
+            throw;
+        }
+        slave->AwaitResult();
+        slave->m_channel.Release();
+        slave->m_connected = true;
+        return slave;
+    }
+
+    // Use Create() instead.
+    RemoteSlave(
+        const Memory& memory,
+        const Logger& logger,
+        std::atomic<std::uint32_t>& debugLogMask,
+        SharedChannel* shared,
+        pid_t pid)
+        : m_logger(logger)
+        , m_debugLogMask{&debugLogMask}
+        , m_shared{shared}
+        , m_pid{pid}
+        , m_channel{shared->requests, shared->responses, pid, false}
+        , m_stringData(Allocator<char>{memory})
+        , m_stringOffsets(Allocator<std::size_t>{memory})
+    {
+    }
+
+    ~RemoteSlave() CPPFMU_NOEXCEPT
+    {
+        const auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(CPPFMU_PROCESS_EXIT_TIMEOUT_MS);
+        m_channel.SetDeadline(deadline);
+        auto exiting = false;
+        if (m_connected) {
+            try {
+                Call(FmiFunction::freeSlaveInstance, 0);
+                AwaitResult();
+                exiting = true;
+            } catch (...) {
+            }
+        }
+        if (exiting) {
+            // The process exits right after it has answered.
+            waitpid(m_pid, nullptr, 0);
+        } else {
+            while (!m_channel.PeerExited() && waitpid(m_pid, nullptr, WNOHANG) == 0) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    kill(m_pid, SIGKILL);
+                    waitpid(m_pid, nullptr, 0);
+                    break;
+                }
+                usleep(1000);
+            }
+        }
+        munmap(m_shared, sizeof(SharedChannel));
+    }
+
+    void Initialize(fmiReal tStart, fmiBoolean stopTimeDefined, fmiReal tStop)
+        override
+    {
+        Call(FmiFunction::initializeSlave, 0);
+        m_channel.Put(tStart);
+        m_channel.Put(tStop);
+        m_channel.Put(stopTimeDefined);
+        Finish();
+    }
+
+    void Terminate() override
+    {
+        Call(FmiFunction::terminateSlave, 0);
+        Finish();
+    }
+
+    void Reset() override
+    {
+        Call(FmiFunction::resetSlave, 0);
+        Finish();
+    }
+
+    void SetReal(const fmiValueReference vr[], std::size_t nvr, const fmiReal value[])
+        override
+    {
+        Set(FmiFunction::setReal, vr, nvr, value);
+    }
+
+    void SetInteger(const fmiValueReference vr[], std::size_t nvr, const fmiInteger value[])
+        override
+    {
+        Set(FmiFunction::setInteger, vr, nvr, value);
+    }
+
+    void SetBoolean(const fmiValueReference vr[], std::size_t nvr, const fmiBoolean value[])
+        override
+    {
+        Set(FmiFunction::setBoolean, vr, nvr, value);
+    }
+
+    void SetString(const fmiValueReference vr[], std::size_t nvr, const fmiString value[])
+        override
+    {
+        Call(FmiFunction::setString, nvr);
+        m_channel.PutArray(vr, nvr);
+        for (std::size_t i = 0; i < nvr; ++i) m_channel.PutString(value[i]);
+        Finish();
+    }
+
+    void GetReal(const fmiValueReference vr[], std::size_t nvr, fmiReal value[])
+        const override
+    {
+        Get(FmiFunction::getReal, vr, nvr, value);
+    }
+
+    void GetInteger(const fmiValueReference vr[], std::size_t nvr, fmiInteger value[])
+        const override
+    {
+        Get(FmiFunction::getInteger, vr, nvr, value);
+    }
+
+    void GetBoolean(const fmiValueReference vr[], std::size_t nvr, fmiBoolean value[])
+        const override
+    {
+        Get(FmiFunction::getBoolean, vr, nvr, value);
+    }
+
+    /* The strings are kept in the proxy until the next call to GetString(),
+     * which is at least as long as FMI requires.
+     */
+    void GetString(const fmiValueReference vr[], std::size_t nvr, fmiString value[])
+        const override
+    {
+        Call(FmiFunction::getString, nvr);
+        m_channel.PutArray(vr, nvr);
+        AwaitResult();
+        const auto nullOffset = static_cast<std::size_t>(-1);
+        m_stringData.clear();
+        m_stringOffsets.clear();
+        for (std::size_t i = 0; i < nvr; ++i) {
+            const auto length = m_channel.Get<std::uint32_t>();
+            if (length == processNullString) {
+                m_stringOffsets.push_back(nullOffset);
+                continue;
+            }
+            const auto offset = m_stringData.size();
+            m_stringData.resize(offset + length + 1);
+            m_channel.Read(&m_stringData[offset], length);
+            m_stringOffsets.push_back(offset);
+        }
+        m_channel.Release();
+        for (std::size_t i = 0; i < nvr; ++i) {
+            value[i] = m_stringOffsets[i] == nullOffset
+                ? nullptr
+                : m_stringData.c_str() + m_stringOffsets[i];
+        }
+    }
+
+    bool DoStep(
+        fmiReal currentCommunicationPoint,
+        fmiReal communicationStepSize,
+        fmiBoolean newStep,
+        fmiReal& endOfStep) override
+    {
+        Call(FmiFunction::doStep, 0);
+        m_channel.Put(currentCommunicationPoint);
+        m_channel.Put(communicationStepSize);
+        m_channel.Put(newStep);
+        m_channel.Flush();
+        AwaitResult();
+        const auto completed = m_channel.Get<std::uint8_t>() != 0;
+        endOfStep = m_channel.Get<fmiReal>();
+        m_channel.Release();
+        return completed;
+    }
+
+private:
+    template<typename T>
+    void Set(FmiFunction function, const fmiValueReference vr[], std::size_t nvr, const T value[])
+    {
+        Call(function, nvr);
+        m_channel.PutArray(vr, nvr);
+        m_channel.PutArray(value, nvr);
+        Finish();
+    }
+
+    template<typename T>
+    void Get(FmiFunction function, const fmiValueReference vr[], std::size_t nvr, T value[])
+        const
+    {
+        Call(function, nvr);
+        m_channel.PutArray(vr, nvr);
+        AwaitResult();
+        m_channel.GetArray(value, nvr);
+        m_channel.Release();
+    }
+
+    // Starts a request.
+    void Call(FmiFunction function, std::size_t count) const
+    {
+        if (m_channel.PeerExited()) {
+            throw std::runtime_error("The slave process has terminated");
+        }
+        m_channel.Put(static_cast<std::uint32_t>(function));
+        m_channel.Put(static_cast<std::uint32_t>(count));
+        m_channel.Put(m_debugLogMask->load(std::memory_order_relaxed));
+    }
+
+    // Completes a request whose result has no payload.
+    void Finish()
+    {
+        AwaitResult();
+        m_channel.Release();
+    }
+
+    /* Sends the request, forwards log messages until the result arrives,
+     * and throws if it is an error.  Otherwise, the payload is left to be
+     * read by the caller.
+     */
+    void AwaitResult() const
+    {
+        m_channel.Flush();
+        std::string category;
+        std::string text;
+        for (;;) {
+            const auto tag = m_channel.Get<std::uint8_t>();
+            if (tag == 'L') {
+                const auto status = static_cast<fmiStatus>(m_channel.Get<std::int32_t>());
+                m_channel.GetString(category);
+                m_channel.GetString(text);
+                m_logger.LogFormatted(status, category.c_str(), "{}", text.c_str());
+                continue;
+            }
+            const auto outcome = m_channel.Get<std::uint8_t>();
+            m_debugLogMask->store(
+                m_channel.Get<std::uint32_t>(), std::memory_order_relaxed);
+            if (outcome == 0) return;
+            m_channel.GetString(text);
+            m_channel.Release();
+            if (outcome == 2) throw FatalError{text.c_str()};
+            throw std::runtime_error(text);
+        }
+    }
+
+    // The child process' side of the channel.
+    struct Server
+    {
+        Server(SharedChannel& shared, pid_t parent)
+            : channel{shared.responses, shared.requests, parent, true}
+        {
+        }
+
+        ProcessChannel channel;
+        std::mutex mutex; // protects writes to 'channel'
+    };
+
+    static Server*& CurrentServer() CPPFMU_NOEXCEPT
+    {
+        static Server* server = nullptr;
+        return server;
+    }
+
+    static void ForwardLog(
+        fmiComponent,
+        fmiString,
+        fmiStatus status,
+        fmiString category,
+        fmiString message,
+        ...)
+    {
+        char buffer[CPPFMU_LOG_MESSAGE_SIZE];
+        std::va_list args;
+        va_start(args, message);
+        std::vsnprintf(buffer, sizeof buffer, message, args);
+        va_end(args);
+
+        auto& server = *CurrentServer();
+        std::lock_guard<std::mutex> lock{server.mutex};
+        server.channel.Put(static_cast<std::uint8_t>('L'));
+        server.channel.Put(static_cast<std::int32_t>(status));
+        server.channel.PutString(category);
+        server.channel.PutString(buffer);
+        server.channel.Flush();
+    }
+
+    // Runs in the child process, and never returns.
+    template<typename Factory>
+    [[noreturn]] static void Serve(
+        SharedChannel& shared,
+        pid_t parent,
+        const char* instanceName,
+        std::uint32_t initialMask,
+        Factory& factory)
+    {
+        Server server{shared, parent};
+        CurrentServer() = &server;
+        auto& channel = server.channel;
+        std::atomic<std::uint32_t> mask{initialMask};
+
+        fmiCallbackFunctions functions;
+        functions.logger = &ForwardLog;
+        functions.allocateMemory = &std::calloc;
+        functions.freeMemory = &std::free;
+        functions.stepFinished = nullptr;
+        const auto memory = Memory{functions};
+
+        // The rate limiter works as in the simulation environment's process,
+        // but only messages which get past it are passed on.
+        LogRateLimiter rateLimiter;
+        Logger logger{nullptr, instanceName, functions, &mask,
+            nullptr, nullptr, &rateLimiter};
+
+        UniquePtr<SlaveInstance> slave;
+        int outcome = 0;
+        std::string error;
+        try {
+            slave = factory(memory, logger);
+        } catch (const FatalError& e) {
+            outcome = 2;
+            error = e.what();
+        } catch (const std::exception& e) {
+            outcome = 1;
+            error = e.what();
+        }
+        {
+            std::lock_guard<std::mutex> lock{server.mutex};
+            PutOutcome(channel, outcome, mask, error);
+            channel.Flush();
+        }
+        if (outcome != 0) {
+            std::fflush(nullptr);
+            _exit(1);
+        }
+
+        std::vector<fmiValueReference> vr;
+        std::vector<fmiReal> reals;
+        std::vector<fmiInteger> integers;
+        std::vector<fmiBoolean> booleans;
+        std::vector<std::string> strings;
+        std::vector<fmiString> stringPointers;
+        bool completed = false;
+        fmiReal endOfStep = 0.0;
+
+        for (;;) {
+            const auto function = static_cast<FmiFunction>(channel.Get<std::uint32_t>());
+            const auto count = channel.Get<std::uint32_t>();
+            mask.store(channel.Get<std::uint32_t>(), std::memory_order_relaxed);
+            if (function == FmiFunction::freeSlaveInstance) {
+                channel.Release();
+                slave.reset();
+                logger.FlushSuppressed();
+                std::lock_guard<std::mutex> lock{server.mutex};
+                PutOutcome(channel, 0, mask, error);
+                channel.Flush();
+                std::fflush(nullptr);
+                _exit(0);
+            }
+            vr.resize(count);
+            channel.GetArray(vr.data(), count);
+
+            outcome = 0;
+            try {
+                switch (function) {
+                    case FmiFunction::initializeSlave: {
+                        const auto tStart = channel.Get<fmiReal>();
+                        const auto tStop = channel.Get<fmiReal>();
+                        const auto stopTimeDefined = channel.Get<fmiBoolean>();
+                        channel.Release();
+                        slave->Initialize(tStart, stopTimeDefined, tStop);
+                        break;
+                    }
+                    case FmiFunction::terminateSlave:
+                        channel.Release();
+                        slave->Terminate();
+                        logger.FlushSuppressed();
+                        break;
+                    case FmiFunction::resetSlave:
+                        channel.Release();
+                        slave->Reset();
+                        break;
+                    case FmiFunction::setReal:
+                        ReceiveValues(channel, reals, count);
+                        slave->SetReal(vr.data(), count, reals.data());
+                        break;
+                    case FmiFunction::setInteger:
+                        ReceiveValues(channel, integers, count);
+                        slave->SetInteger(vr.data(), count, integers.data());
+                        break;
+                    case FmiFunction::setBoolean:
+                        ReceiveValues(channel, booleans, count);
+                        slave->SetBoolean(vr.data(), count, booleans.data());
+                        break;
+                    case FmiFunction::setString:
+                        strings.resize(count);
+                        stringPointers.resize(count);
+                        for (std::size_t i = 0; i < count; ++i) {
+                            stringPointers[i] = channel.GetString(strings[i])
+                                ? strings[i].c_str()
+                                : nullptr;
+                        }
+                        channel.Release();
+                        slave->SetString(vr.data(), count, stringPointers.data());
+                        break;
+                    case FmiFunction::getReal:
+                        channel.Release();
+                        reals.resize(count);
+                        slave->GetReal(vr.data(), count, reals.data());
+                        break;
+                    case FmiFunction::getInteger:
+                        channel.Release();
+                        integers.resize(count);
+                        slave->GetInteger(vr.data(), count, integers.data());
+                        break;
+                    case FmiFunction::getBoolean:
+                        channel.Release();
+                        booleans.resize(count);
+                        slave->GetBoolean(vr.data(), count, booleans.data());
+                        break;
+                    case FmiFunction::getString:
+                        channel.Release();
+                        stringPointers.resize(count);
+                        slave->GetString(vr.data(), count, stringPointers.data());
+                        break;
+                    case FmiFunction::doStep: {
+                        const auto t = channel.Get<fmiReal>();
+                        const auto h = channel.Get<fmiReal>();
+                        const auto newStep = channel.Get<fmiBoolean>();
+                        channel.Release();
+                        endOfStep = t + h;
+                        completed = slave->DoStep(t, h, newStep, endOfStep);
+                        break;
+                    }
+                    default:
+                        channel.Release();
+                        throw std::logic_error("Unsupported function");
+                }
+            } catch (const FatalError& e) {
+                outcome = 2;
+                error = e.what();
+            } catch (const std::exception& e) {
+                outcome = 1;
+                error = e.what();
+            }
+
+            std::lock_guard<std::mutex> lock{server.mutex};
+            PutOutcome(channel, outcome, mask, error);
+            if (outcome == 0) {
+                switch (function) {
+                    case FmiFunction::getReal:
+                        channel.PutArray(reals.data(), count);
+                        break;
+                    case FmiFunction::getInteger:
+                        channel.PutArray(integers.data(), count);
+                        break;
+                    case FmiFunction::getBoolean:
+                        channel.PutArray(booleans.data(), count);
+                        break;
+                    case FmiFunction::getString:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            channel.PutString(stringPointers[i]);
+                        }
+                        break;
+                    case FmiFunction::doStep:
+                        channel.Put(static_cast<std::uint8_t>(completed));
+                        channel.Put(endOfStep);
+                        break;
+                    default:
+                        break;
+                }
+            }
+            channel.Flush();
+        }
+    }
+
+    template<typename T>
+    static void ReceiveValues(ProcessChannel& channel, std::vector<T>& values, std::size_t count)
+    {
+        values.resize(count);
+        channel.GetArray(values.data(), count);
+        channel.Release();
+    }
+
+    static void PutOutcome(
+        ProcessChannel& channel,
+        int outcome,
+        const std::atomic<std::uint32_t>& debugLogMask,
+        const std::string& error)
+    {
+        channel.Put(static_cast<std::uint8_t>('R'));
+        channel.Put(static_cast<std::uint8_t>(outcome));
+        channel.Put(debugLogMask.load(std::memory_order_relaxed));
+        if (outcome != 0) channel.PutString(error.c_str());
+    }
+
+    // Returns the number of threads in this process, or 0 if unknown.
+    static long ThreadCount() CPPFMU_NOEXCEPT
+    {
+        const auto file = std::fopen("/proc/self/status", "r");
+        if (!file) return 0;
+        long count = 0;
+        char line[256];
+        while (std::fgets(line, sizeof line, file)) {
+            if (std::strncmp(line, "Threads:", 8) == 0) {
+                count = std::strtol(line + 8, nullptr, 10);
+                break;
+            }
+        }
+        std::fclose(file);
+        return count;
+    }
+
+    mutable Logger m_logger;
+    std::atomic<std::uint32_t>* m_debugLogMask;
+    SharedChannel* m_shared;
+    pid_t m_pid;
+    mutable ProcessChannel m_channel;
+    bool m_connected = false;
+    mutable String m_stringData;
+    mutable std::vector<std::size_t, Allocator<std::size_t>> m_stringOffsets;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
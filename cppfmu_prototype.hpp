@@ -0,0 +1,186 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_PROTOTYPE_HPP
+#define CPPFMU_PROTOTYPE_HPP
+
+#include <atomic>       // std::atomic
+#include <cstdint>      // std::uint32_t
+#include <cstdlib>      // std::calloc, std::free
+#include <cstring>      // std::memcpy
+#include <map>          // std::map
+#include <memory>       // std::shared_ptr, std::make_shared
+#include <mutex>        // std::mutex, std::lock_guard
+#include <string>       // std::string
+
+#include "cppfmu_cs.hpp"
+
+
+/* The maximum number of prototypes which are kept.  When it is reached, the
+ * least recently used prototype is dropped to make room for a new one.
+ */
+#ifndef CPPFMU_PROTOTYPE_CACHE_SIZE
+#   define CPPFMU_PROTOTYPE_CACHE_SIZE 8
+#endif
+
+
+namespace cppfmu
+{
+
+/* A process-wide cache of slave instances which new instances are cloned
+ * from (see SlaveInstance::Clone()), keyed by all the arguments to
+ * fmiInstantiateSlave() except the instance name and the callbacks.  It is
+ * only used if fmi_functions.cpp is compiled with CPPFMU_ENABLE_PROTOTYPES.
+ *
+ * The prototypes are owned by CPPFMU, not by any simulation environment, so
+ * they use the C library's memory functions, and their loggers discard all
+ * messages.  At most CPPFMU_PROTOTYPE_CACHE_SIZE prototypes are kept.  The
+ * cache itself is never destroyed, so that no slave destructors run during
+ * static destruction, and the prototypes it holds at exit are not freed.
+ */
+class PrototypeCache
+{
+public:
+    static PrototypeCache& Instance()
+    {
+        static auto instance = new PrototypeCache;
+        return *instance;
+    }
+
+    /* Returns a clone of the prototype for the given fmiInstantiateSlave()
+     * arguments, which uses 'memory' and 'logger', or null if there is no
+     * such prototype.
+     */
+    UniquePtr<SlaveInstance> Clone(
+        fmiString guid,
+        fmiString location,
+        fmiString mimeType,
+        fmiReal timeout,
+        fmiBoolean visible,
+        fmiBoolean interactive,
+        const Memory& memory,
+        const Logger& logger)
+    {
+        std::shared_ptr<const Prototype> prototype;
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            const auto it = m_prototypes.find(
+                Key(guid, location, mimeType, timeout, visible, interactive));
+            if (it == m_prototypes.end()) return nullptr;
+            it->second.lastUse = ++m_uses;
+            prototype = it->second.prototype;
+        }
+        if (!prototype->slave) return nullptr;
+        return prototype->slave->Clone(memory, logger);
+    }
+
+    /* Makes a prototype for the given fmiInstantiateSlave() arguments by
+     * cloning 'slave', which should have just been created by
+     * CppfmuInstantiateSlave(), unless there already is one.  If 'slave'
+     * cannot be cloned, this is remembered, so that it is not tried again.
+     * Errors are ignored, since the slave itself is fine.
+     */
+    void Add(
+        fmiString guid,
+        fmiString location,
+        fmiString mimeType,
+        fmiReal timeout,
+        fmiBoolean visible,
+        fmiBoolean interactive,
+        const SlaveInstance& slave) CPPFMU_NOEXCEPT
+    {
+        try {
+            auto key = Key(guid, location, mimeType, timeout, visible, interactive);
+            {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                if (m_prototypes.count(key)) return;
+            }
+            const Memory memory{Callbacks()};
+            auto prototype = std::make_shared<Prototype>();
+            prototype->slave = slave.Clone(
+                memory,
+                Logger{nullptr, "prototype", Callbacks(), &DebugLogMask()});
+
+            std::shared_ptr<const Prototype> evicted; // destroyed unlocked
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (m_prototypes.count(key)) return;
+            if (m_prototypes.size() >= CPPFMU_PROTOTYPE_CACHE_SIZE) {
+                auto oldest = m_prototypes.begin();
+                for (auto it = m_prototypes.begin(); it != m_prototypes.end(); ++it) {
+                    if (it->second.lastUse < oldest->second.lastUse) oldest = it;
+                }
+                evicted = std::move(oldest->second.prototype);
+                m_prototypes.erase(oldest);
+            }
+            auto& entry = m_prototypes[std::move(key)];
+            entry.prototype = std::move(prototype);
+            entry.lastUse = ++m_uses;
+        } catch (...) {
+        }
+    }
+
+private:
+    struct Prototype
+    {
+        UniquePtr<SlaveInstance> slave;
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const Prototype> prototype;
+        unsigned long long lastUse = 0;
+    };
+
+    PrototypeCache() = default;
+
+    static std::string Key(
+        fmiString guid,
+        fmiString location,
+        fmiString mimeType,
+        fmiReal timeout,
+        fmiBoolean visible,
+        fmiBoolean interactive)
+    {
+        // The strings cannot contain null characters.
+        std::string key = guid ? guid : "";
+        key += '\0';
+        key += location ? location : "";
+        key += '\0';
+        key += mimeType ? mimeType : "";
+        key += '\0';
+        char bytes[sizeof timeout];
+        std::memcpy(bytes, &timeout, sizeof timeout);
+        key.append(bytes, sizeof bytes);
+        key += static_cast<char>(visible);
+        key += static_cast<char>(interactive);
+        return key;
+    }
+
+    static void DiscardLog(fmiComponent, fmiString, fmiStatus, fmiString, fmiString, ...)
+    {
+    }
+
+    static std::atomic<std::uint32_t>& DebugLogMask() CPPFMU_NOEXCEPT
+    {
+        static std::atomic<std::uint32_t> mask{0u};
+        return mask;
+    }
+
+    static const fmiCallbackFunctions& Callbacks() CPPFMU_NOEXCEPT
+    {
+        static const fmiCallbackFunctions callbacks = {
+            DiscardLog, std::calloc, std::free, nullptr
+        };
+        return callbacks;
+    }
+
+    std::mutex m_mutex;
+    std::map<std::string, Entry> m_prototypes;
+    unsigned long long m_uses = 0;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
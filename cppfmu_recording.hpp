@@ -0,0 +1,331 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_RECORDING_HPP
+#define CPPFMU_RECORDING_HPP
+
+#include <atomic>       // std::atomic
+#include <cctype>       // std::isalnum
+#include <chrono>       // std::chrono::system_clock
+#include <cstddef>      // offsetof, std::size_t
+#include <cstdint>      // std::uint8_t, std::uint32_t, std::uint64_t
+#include <cstdio>       // std::FILE, std::fflush, std::fopen, std::snprintf
+#include <cstring>      // std::memcpy, std::memset, std::strlen
+#include <type_traits>  // std::enable_if, std::is_arithmetic
+
+#ifdef _WIN32
+#   include <process.h>    // _getpid
+#else
+#   include <unistd.h>     // getpid
+#endif
+
+#include "cppfmu_common.hpp"
+#include "cppfmu_instrumentation.hpp"
+
+
+/* The size of the buffer in which call records are collected before they
+ * are written to the file.
+ */
+#ifndef CPPFMU_RECORDING_BUFFER_SIZE
+#   define CPPFMU_RECORDING_BUFFER_SIZE (64 * 1024)
+#endif
+
+
+namespace cppfmu
+{
+
+/* The call recording file format.
+ *
+ * A recording contains the FMI calls made to one instance, with their
+ * arguments, so that they can be replayed against the model in isolation
+ * (see tools/cppfmu_replay.cpp).  All fields are in the native byte order of
+ * the machine that wrote the file, and nothing is aligned.
+ *
+ * The file starts with a CallRecordingHeader, followed by the string
+ * arguments of fmiInstantiateSlave(): instanceName, fmuGUID, fmuLocation and
+ * mimeType.  A string is stored as a std::uint32_t length, followed by the
+ * characters, or as the length 0xFFFFFFFF alone if it is null.
+ *
+ * Then follows a record for each call, except fmiInstantiateSlave() and
+ * fmiFreeSlaveInstance(), which consists of a CallRecordHeader and a
+ * payload which depends on the function:
+ *
+ *     fmiInitializeSlave          fmiReal tStart, fmiReal tStop,
+ *                                 fmiBoolean stopTimeDefined
+ *     fmiSetDebugLogging          fmiBoolean loggingOn
+ *     fmiGetXxx                   'count' value references
+ *     fmiSetXxx                   'count' value references and 'count'
+ *                                 values (fmiReal, fmiInteger, fmiBoolean
+ *                                 or strings)
+ *     fmiSetRealInputDerivatives  'count' value references, 'count' orders
+ *                                 (fmiInteger) and 'count' fmiReal values
+ *     fmiGetRealOutputDerivatives 'count' value references and 'count'
+ *                                 orders
+ *     fmiDoStep                   fmiReal currentCommunicationPoint,
+ *                                 fmiReal communicationStepSize,
+ *                                 fmiBoolean newStep
+ *     fmiGetXxxStatus             std::int32_t fmiStatusKind
+ *     Others                      nothing
+ *
+ * fmiValueReference is 4 bytes, fmiReal 8, fmiInteger 4 and fmiBoolean 1.
+ *
+ * Records are buffered, and only written to the file when the buffer is
+ * full and when the recording is closed, so if the process crashes, the
+ * file lacks up to CPPFMU_RECORDING_BUFFER_SIZE bytes of the last calls.
+ * With the 'sync' argument of CallRecording::Create() each record is
+ * instead written to the file before the call is made.  Since calls are
+ * recorded on entry, the call which was in progress when the process
+ * crashed is then included.
+ *
+ * 'complete' in the header is 1 if the file was closed properly, and 0
+ * otherwise, in which case 'recordCount' is 0 and the last record may be
+ * incomplete.
+ */
+const char callRecordingMagic[8] = { 'C', 'P', 'P', 'F', 'M', 'U', 'R', 'C' };
+const std::uint32_t callRecordingVersion = 2;
+const std::uint32_t callRecordingNullString = 0xFFFFFFFFu;
+
+struct CallRecordingHeader
+{
+    char magic[8];              // callRecordingMagic
+    std::uint32_t version;      // callRecordingVersion
+    std::uint32_t headerSize;   // sizeof(CallRecordingHeader)
+    std::uint64_t recordCount;  // number of records, 0 if not complete
+    std::int64_t startTime;     // wall clock time in ns since the Unix epoch
+    double timeout;             // fmiInstantiateSlave() arguments
+    std::uint8_t visible;
+    std::uint8_t interactive;
+    std::uint8_t loggingOn;
+    std::uint8_t complete;      // 1 if the file was closed properly
+    std::uint8_t reserved[4];
+};
+
+struct CallRecordHeader
+{
+    std::uint8_t function;      // cppfmu::FmiFunction
+    std::uint8_t reserved[3];
+    std::uint32_t count;        // number of variables, 0 if not applicable
+    std::uint64_t timestamp;    // steady clock, ns since the start of recording
+};
+
+
+/* Records the FMI calls made to one instance in a file.
+ *
+ * Records are collected in a buffer, which is written to the file when it
+ * is full and when the object is destroyed, or after each record if the
+ * recording was created with 'sync'.  Record() is not thread safe,
+ * but FMI does not allow concurrent calls to the same instance anyway.  If
+ * writing fails, recording stops, and Good() returns false.
+ */
+class CallRecording
+{
+public:
+    // An array argument of Record().
+    template<typename T>
+    struct ArrayArg
+    {
+        const T* data;
+        std::size_t size;
+    };
+
+    template<typename T>
+    static ArrayArg<T> Array(const T* data, std::size_t size) CPPFMU_NOEXCEPT
+    {
+        return ArrayArg<T>{data, size};
+    }
+
+    /* Creates a recording of the instance which is created with the given
+     * fmiInstantiateSlave() arguments, in 'directory'.  The file name is
+     * made unique by the addition of the process ID and a serial number.
+     * If 'sync' is true, each record is written to the file as soon as it
+     * is made, which is slower, but keeps the last calls if the process
+     * crashes.  Returns null if 'directory' is null or empty, or if the file
+     * could not be created.
+     */
+    static UniquePtr<CallRecording> Create(
+        const Memory& memory,
+        const char* directory,
+        fmiString instanceName,
+        fmiString fmuGUID,
+        fmiString fmuLocation,
+        fmiString mimeType,
+        fmiReal timeout,
+        fmiBoolean visible,
+        fmiBoolean interactive,
+        fmiBoolean loggingOn,
+        bool sync = false)
+    {
+        if (!directory || *directory == '\0') return nullptr;
+        static std::atomic<unsigned> serial{0};
+
+        char name[96];
+        std::snprintf(name, sizeof name, "%s", instanceName ? instanceName : "");
+        for (auto p = name; *p != '\0'; ++p) {
+            if (!std::isalnum(static_cast<unsigned char>(*p)) && *p != '-') *p = '_';
+        }
+        char path[1024];
+        std::snprintf(path, sizeof path, "%s/%s-%d-%u.cpprec",
+            directory, name, static_cast<int>(ProcessId()), serial++);
+
+        auto recording = AllocateUnique<CallRecording>(memory, memory, path, sync);
+        if (!recording->Good()) return nullptr;
+
+        CallRecordingHeader header;
+        std::memset(&header, 0, sizeof header);
+        std::memcpy(header.magic, callRecordingMagic, sizeof header.magic);
+        header.version = callRecordingVersion;
+        header.headerSize = sizeof header;
+        header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        header.timeout = timeout;
+        header.visible = static_cast<std::uint8_t>(visible);
+        header.interactive = static_cast<std::uint8_t>(interactive);
+        header.loggingOn = static_cast<std::uint8_t>(loggingOn);
+        recording->Put(&header, sizeof header);
+        recording->PutString(instanceName);
+        recording->PutString(fmuGUID);
+        recording->PutString(fmuLocation);
+        recording->PutString(mimeType);
+        if (sync) recording->Sync();
+        if (!recording->Good()) return nullptr;
+        return recording;
+    }
+
+    // Use Create() instead.
+    CallRecording(const Memory& memory, const char* path, bool sync = false)
+        : m_memory{memory}
+        , m_startTime{MonotonicNanoseconds()}
+        , m_sync{sync}
+    {
+        m_buffer = static_cast<char*>(m_memory.Alloc(CPPFMU_RECORDING_BUFFER_SIZE, 1));
+        if (m_buffer) m_file = std::fopen(path, "wb");
+        m_good = m_file != nullptr;
+    }
+
+    ~CallRecording() CPPFMU_NOEXCEPT
+    {
+        if (m_file) {
+            Flush();
+            if (m_good) {
+                const std::uint8_t complete = 1;
+                std::fseek(m_file, offsetof(CallRecordingHeader, recordCount), SEEK_SET);
+                std::fwrite(&m_records, sizeof m_records, 1, m_file);
+                std::fseek(m_file, offsetof(CallRecordingHeader, complete), SEEK_SET);
+                std::fwrite(&complete, sizeof complete, 1, m_file);
+            }
+            std::fclose(m_file);
+        }
+        if (m_buffer) m_memory.Free(m_buffer);
+    }
+
+    CallRecording(const CallRecording&) = delete;
+    CallRecording& operator=(const CallRecording&) = delete;
+
+    /* Records a call to 'function', which transferred 'count' variables,
+     * with the payload 'args' (see the file format above).  The arguments
+     * may be numbers, or arrays of numbers or strings made with Array().
+     */
+    template<typename... Args>
+    void Record(FmiFunction function, std::size_t count, const Args&... args)
+        CPPFMU_NOEXCEPT
+    {
+        CallRecordHeader header;
+        std::memset(&header, 0, sizeof header);
+        header.function = static_cast<std::uint8_t>(function);
+        header.count = static_cast<std::uint32_t>(count);
+        header.timestamp = MonotonicNanoseconds() - m_startTime;
+        Put(&header, sizeof header);
+        const int expand[] = { 0, (PutValue(args), 0)... };
+        (void) expand;
+        ++m_records;
+        if (m_sync) Sync();
+    }
+
+    // Returns false if the file could not be created or written.
+    bool Good() const CPPFMU_NOEXCEPT
+    {
+        return m_good;
+    }
+
+private:
+    static long ProcessId() CPPFMU_NOEXCEPT
+    {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return static_cast<long>(getpid());
+#endif
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type
+        PutValue(const T& value) CPPFMU_NOEXCEPT
+    {
+        Put(&value, sizeof value);
+    }
+
+    template<typename T>
+    void PutValue(const ArrayArg<T>& array) CPPFMU_NOEXCEPT
+    {
+        static_assert(std::is_arithmetic<T>::value, "Not a number array");
+        Put(array.data, array.size * sizeof(T));
+    }
+
+    void PutValue(const ArrayArg<fmiString>& array) CPPFMU_NOEXCEPT
+    {
+        for (std::size_t i = 0; i < array.size; ++i) PutString(array.data[i]);
+    }
+
+    void PutString(const char* s) CPPFMU_NOEXCEPT
+    {
+        const auto length = s
+            ? static_cast<std::uint32_t>(std::strlen(s))
+            : callRecordingNullString;
+        Put(&length, sizeof length);
+        if (s) Put(s, length);
+    }
+
+    void Put(const void* data, std::size_t size) CPPFMU_NOEXCEPT
+    {
+        if (!m_good || size == 0) return;
+        if (size > CPPFMU_RECORDING_BUFFER_SIZE - m_used) {
+            Flush();
+            if (size > CPPFMU_RECORDING_BUFFER_SIZE) {
+                m_good = m_good && std::fwrite(data, size, 1, m_file) == 1;
+                return;
+            }
+        }
+        std::memcpy(m_buffer + m_used, data, size);
+        m_used += size;
+    }
+
+    void Flush() CPPFMU_NOEXCEPT
+    {
+        if (m_good && m_used > 0) {
+            m_good = std::fwrite(m_buffer, m_used, 1, m_file) == 1;
+        }
+        m_used = 0;
+    }
+
+    // Writes the buffer, and hands the data over to the operating system.
+    void Sync() CPPFMU_NOEXCEPT
+    {
+        Flush();
+        m_good = m_good && std::fflush(m_file) == 0;
+    }
+
+    Memory m_memory;
+    std::FILE* m_file = nullptr;
+    char* m_buffer = nullptr;
+    std::size_t m_used = 0;
+    std::uint64_t m_records = 0;
+    std::uint64_t m_startTime;
+    bool m_sync;
+    bool m_good = false;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,439 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_RESOURCES_HPP
+#define CPPFMU_RESOURCES_HPP
+
+#include <cctype>       // std::isalpha, std::isxdigit
+#include <cerrno>       // errno
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <cstdlib>      // std::strtoul
+#include <cstdio>       // std::fopen, std::fread, std::snprintf
+#include <cstring>      // std::memcpy, std::strerror, std::strncmp
+#include <map>          // std::map
+#include <memory>       // std::shared_ptr, std::weak_ptr
+#include <mutex>        // std::mutex, std::lock_guard
+#include <stdexcept>    // std::invalid_argument, std::runtime_error
+#include <string>       // std::string, std::to_string
+#include <utility>      // std::move
+#include <vector>       // std::vector
+
+#ifndef _WIN32
+#   include <fcntl.h>      // open, O_RDONLY
+#   include <sys/mman.h>   // madvise, mmap, munmap
+#   include <sys/stat.h>   // fstat, stat
+#   include <unistd.h>     // close
+#endif
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+/* Hints about how a resource will be accessed, which may be combined with
+ * '|'.  On POSIX systems, they are passed on to madvise() for memory-mapped
+ * resources.  They are only hints, and are ignored where not supported.
+ */
+enum ResourceAdvice : unsigned
+{
+    adviseNormal        = 0,
+    adviseSequential    = 1,    // read from start to end
+    adviseRandom        = 2,    // read in no particular order
+    adviseWillNeed      = 4,    // read soon; start reading ahead now
+    adviseHugePages     = 8     // back with huge pages, to save TLB misses
+};
+
+
+/* The contents of a file, which are memory-mapped read-only where possible,
+ * and read into memory otherwise.
+ */
+class MappedResource
+{
+public:
+    explicit MappedResource(const std::string& fileName)
+    {
+#ifndef _WIN32
+        const auto fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error(fileName + ": " + std::strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            const auto error = errno;
+            close(fd);
+            throw std::runtime_error(fileName + ": " + std::strerror(error));
+        }
+        m_size = static_cast<std::size_t>(info.st_size);
+        if (m_size > 0) {
+            const auto address = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                m_data = static_cast<const char*>(address);
+                m_mapped = true;
+            }
+        }
+        close(fd);
+        if (m_mapped || m_size == 0) return;
+#endif
+        ReadFile(fileName);
+    }
+
+    ~MappedResource() CPPFMU_NOEXCEPT
+    {
+#ifndef _WIN32
+        if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
+
+    MappedResource(const MappedResource&) = delete;
+    MappedResource& operator=(const MappedResource&) = delete;
+
+    const char* Data() const CPPFMU_NOEXCEPT { return m_data; }
+
+    std::size_t Size() const CPPFMU_NOEXCEPT { return m_size; }
+
+    // Whether the contents are memory-mapped, rather than read into memory.
+    bool Mapped() const CPPFMU_NOEXCEPT { return m_mapped; }
+
+    // Passes on 'advice' (a combination of ResourceAdvice flags).
+    void Advise(unsigned advice) const CPPFMU_NOEXCEPT
+    {
+#ifndef _WIN32
+        if (!m_mapped) return;
+        const auto address = const_cast<char*>(m_data);
+        if (advice & adviseSequential) madvise(address, m_size, MADV_SEQUENTIAL);
+        if (advice & adviseRandom) madvise(address, m_size, MADV_RANDOM);
+        if (advice & adviseWillNeed) madvise(address, m_size, MADV_WILLNEED);
+#   ifdef MADV_HUGEPAGE
+        if (advice & adviseHugePages) madvise(address, m_size, MADV_HUGEPAGE);
+#   endif
+#else
+        (void) advice;
+#endif
+    }
+
+private:
+    void ReadFile(const std::string& fileName)
+    {
+        const auto file = std::fopen(fileName.c_str(), "rb");
+        if (!file) throw std::runtime_error(fileName + ": " + std::strerror(errno));
+        char buffer[65536];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, file)) > 0) {
+            m_buffer.insert(m_buffer.end(), buffer, buffer + n);
+        }
+        const auto failed = std::ferror(file) != 0;
+        std::fclose(file);
+        if (failed) throw std::runtime_error(fileName + ": Read error");
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<char> m_buffer;
+};
+
+
+/* A read-only view of a resource from OpenResource() or SharedResources.
+ * The resource stays in memory for as long as any view of it exists.
+ */
+class ResourceView
+{
+public:
+    ResourceView() = default;
+
+    explicit ResourceView(std::shared_ptr<const MappedResource> resource) CPPFMU_NOEXCEPT
+        : m_resource{std::move(resource)}
+    {
+    }
+
+    const char* Data() const CPPFMU_NOEXCEPT
+    {
+        return m_resource ? m_resource->Data() : nullptr;
+    }
+
+    std::size_t Size() const CPPFMU_NOEXCEPT
+    {
+        return m_resource ? m_resource->Size() : 0;
+    }
+
+    bool Empty() const CPPFMU_NOEXCEPT
+    {
+        return Size() == 0;
+    }
+
+    // Passes on 'advice' (a combination of ResourceAdvice flags).
+    void Advise(unsigned advice) const CPPFMU_NOEXCEPT
+    {
+        if (m_resource) m_resource->Advise(advice);
+    }
+
+private:
+    std::shared_ptr<const MappedResource> m_resource;
+};
+
+
+/* Returns the path of the resources directory of the FMU whose location is
+ * 'fmuLocation', as passed to CppfmuInstantiateSlave().  This must be a
+ * "file" URI (e.g. "file:///tmp/fmu" or "file://localhost/C:/fmu"), and the
+ * result is its path, percent-decoded, followed by "/resources".  Throws
+ * std::invalid_argument if 'fmuLocation' is not such a URI.
+ */
+inline std::string ResourcesDirectory(fmiString fmuLocation)
+{
+    const std::string location = fmuLocation ? fmuLocation : "";
+    const auto invalid = [&] () {
+        return std::invalid_argument("Unsupported FMU location: " + location);
+    };
+    if (location.compare(0, 5, "file:") != 0) throw invalid();
+    auto p = location.c_str() + 5;
+    if (p[0] == '/' && p[1] == '/') {
+        // An authority, which must be empty or "localhost"
+        p += 2;
+        if (std::strncmp(p, "localhost", 9) == 0) p += 9;
+        if (*p != '/') throw invalid();
+    }
+
+    std::string path;
+    for (; *p != '\0' && *p != '?' && *p != '#'; ++p) {
+        if (*p == '%') {
+            if (!std::isxdigit(static_cast<unsigned char>(p[1]))
+                    || !std::isxdigit(static_cast<unsigned char>(p[2]))) {
+                throw invalid();
+            }
+            const char hex[3] = { p[1], p[2], '\0' };
+            path += static_cast<char>(std::strtoul(hex, nullptr, 16));
+            p += 2;
+        } else {
+            path += *p;
+        }
+    }
+#ifdef _WIN32
+    // "/C:/fmu" -> "C:/fmu"
+    if (path.size() >= 3 && path[0] == '/'
+            && std::isalpha(static_cast<unsigned char>(path[1])) && path[2] == ':') {
+        path.erase(0, 1);
+    }
+#endif
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    if (path.empty() || path == "/") throw invalid();
+    return path + "/resources";
+}
+
+
+/* Opens the file 'path', relative to the resources directory of the FMU at
+ * 'fmuLocation' (see ResourcesDirectory()), and returns a read-only view of
+ * it.  The file is memory-mapped where possible, so that only the pages
+ * which are actually used are read, and 'advice' is passed on.
+ *
+ * Each call maps the file anew.  To share a resource between instances, use
+ * SharedResources instead.
+ */
+inline ResourceView OpenResource(
+    fmiString fmuLocation,
+    const char* path,
+    unsigned advice = adviseNormal)
+{
+    ResourceView view{std::make_shared<const MappedResource>(
+        ResourcesDirectory(fmuLocation) + '/' + path)};
+    view.Advise(advice);
+    return view;
+}
+
+
+// A fast, non-cryptographic 64-bit hash of 'size' bytes at 'data'.
+inline std::uint64_t HashContents(const char* data, std::size_t size) CPPFMU_NOEXCEPT
+{
+    const std::uint64_t k = 0x9E3779B97F4A7C15ull;
+    auto hash = static_cast<std::uint64_t>(size) * k;
+    const auto mix = [&] (std::uint64_t word) {
+        hash ^= word * k;
+        hash = ((hash << 31) | (hash >> 33)) * 0xC2B2AE3D27D4EB4Full;
+    };
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        mix(word);
+    }
+    if (i < size) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, data + i, size - i);
+        mix(word);
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+/* A process-wide cache of read-only resources (typically large tables), so
+ * that instances which use the same file share one copy of it.
+ *
+ * A resource is identified by its path relative to the directory it is
+ * opened from, plus its contents.  Thus, the instances of FMUs which are
+ * unpacked in different places still share their resources, as long as
+ * they are identical.  Files which have already been opened are recognised
+ * by their device, inode, size and modification time.  A new file is only
+ * compared with those which have the same path and size, by a hash of its
+ * contents, and only if there are any.  Otherwise it is not read at all,
+ * so that only the pages which are used get read, as with OpenResource().
+ *
+ * The cache only holds weak references, so a resource is released when the
+ * last ResourceView of it is destroyed, normally when the last instance
+ * which uses it is freed.  The resources are shared between instances, so
+ * they do not use the simulation environment's memory functions.
+ */
+class SharedResources
+{
+public:
+    static SharedResources& Instance()
+    {
+        static SharedResources instance;
+        return instance;
+    }
+
+    /* Returns a view of the file 'path', relative to the resources directory
+     * of the FMU at 'fmuLocation' (see ResourcesDirectory()).  'advice' is
+     * passed on, and applies to all views of the resource.
+     */
+    ResourceView OpenResource(
+        fmiString fmuLocation,
+        const char* path,
+        unsigned advice = adviseNormal)
+    {
+        auto view = Open(ResourcesDirectory(fmuLocation).c_str(), path);
+        view.Advise(advice);
+        return view;
+    }
+
+    /* Returns a view of the file 'path', relative to 'directory'.  Throws
+     * std::runtime_error if it cannot be read.
+     */
+    ResourceView Open(const char* directory, const char* path)
+    {
+        const auto fileName = std::string(directory) + '/' + path;
+        const auto fileKey = FileKey(fileName);
+        if (!fileKey.empty()) {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            const auto it = m_byFile.find(fileKey);
+            if (it != m_byFile.end()) {
+                if (auto resource = it->second.lock()) return ResourceView{std::move(resource)};
+            }
+        }
+
+        // Load it outside the lock, since this may take a while.
+        auto resource = std::make_shared<const MappedResource>(fileName);
+        const auto sizeKey = std::string(path) + '\0' + std::to_string(resource->Size());
+
+        // The live resources with the same path and size, and their hashes.
+        std::vector<std::shared_ptr<const MappedResource>> others;
+        std::vector<Candidate> hashes;
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            Prune();
+            auto& candidates = m_bySize[sizeKey];
+            for (const auto& c : candidates) {
+                if (auto r = c.resource.lock()) {
+                    others.push_back(std::move(r));
+                    hashes.push_back(c);
+                }
+            }
+            if (others.empty()) {
+                candidates.push_back(Candidate{resource, 0, false});
+                if (!fileKey.empty()) m_byFile[fileKey] = resource;
+                return ResourceView{std::move(resource)};
+            }
+        }
+
+        // Only now is there a reason to hash the files, which reads all of
+        // them, so it is done outside the lock too.
+        const auto hash = HashContents(resource->Data(), resource->Size());
+        std::shared_ptr<const MappedResource> match;
+        for (std::size_t i = 0; i < others.size(); ++i) {
+            if (!hashes[i].hashed) {
+                hashes[i].hash = HashContents(others[i]->Data(), others[i]->Size());
+                hashes[i].hashed = true;
+            }
+            if (hashes[i].hash == hash && !match) match = others[i];
+        }
+
+        std::lock_guard<std::mutex> lock{m_mutex};
+        auto& candidates = m_bySize[sizeKey];
+        for (auto& c : candidates) {
+            if (c.hashed) continue;
+            const auto r = c.resource.lock();
+            for (std::size_t i = 0; i < others.size(); ++i) {
+                if (r == others[i]) c = hashes[i];
+            }
+        }
+        if (match) {
+            resource = std::move(match);
+        } else {
+            candidates.push_back(Candidate{resource, hash, true});
+        }
+        if (!fileKey.empty()) m_byFile[fileKey] = resource;
+        return ResourceView{std::move(resource)};
+    }
+
+private:
+    // A resource with a given path and size, and its hash, if computed.
+    struct Candidate
+    {
+        std::weak_ptr<const MappedResource> resource;
+        std::uint64_t hash;
+        bool hashed;
+    };
+
+    SharedResources() = default;
+
+    // Identifies the current version of a file, or returns "" if it can't.
+    static std::string FileKey(const std::string& fileName)
+    {
+#ifdef _WIN32
+        (void) fileName;
+        return std::string();
+#else
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0) return std::string();
+        char key[128];
+        std::snprintf(key, sizeof key, "%llx:%llx:%llx:%lld.%09ld",
+            static_cast<unsigned long long>(info.st_dev),
+            static_cast<unsigned long long>(info.st_ino),
+            static_cast<unsigned long long>(info.st_size),
+            static_cast<long long>(info.st_mtim.tv_sec),
+            static_cast<long>(info.st_mtim.tv_nsec));
+        return key;
+#endif
+    }
+
+    // Removes the entries of resources which have been released.
+    void Prune()
+    {
+        for (auto it = m_byFile.begin(); it != m_byFile.end(); ) {
+            if (it->second.expired()) it = m_byFile.erase(it);
+            else ++it;
+        }
+        for (auto it = m_bySize.begin(); it != m_bySize.end(); ) {
+            auto& candidates = it->second;
+            for (auto c = candidates.begin(); c != candidates.end(); ) {
+                if (c->resource.expired()) c = candidates.erase(c);
+                else ++c;
+            }
+            if (candidates.empty()) it = m_bySize.erase(it);
+            else ++it;
+        }
+    }
+
+    std::mutex m_mutex;
+    std::map<std::string, std::weak_ptr<const MappedResource>> m_byFile;
+    std::map<std::string, std::vector<Candidate>> m_bySize;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,450 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_SIGNAL_BUS_HPP
+#define CPPFMU_SIGNAL_BUS_HPP
+
+#include <atomic>       // std::atomic, std::atomic_thread_fence
+#include <cmath>        // std::fabs
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <cstring>      // std::memcpy
+#include <initializer_list> // std::initializer_list
+#include <map>          // std::map
+#include <memory>       // std::shared_ptr, std::unique_ptr, std::weak_ptr
+#include <mutex>        // std::mutex, std::lock_guard
+#include <stdexcept>    // std::logic_error
+#include <string>       // std::string
+#include <utility>      // std::move
+#include <vector>       // std::vector
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+/* A signal on the SignalBus: a named array of real values, written by one
+ * instance and read by any number of others.
+ *
+ * The values are kept in two frames, each tagged with the communication
+ * point from which it is valid and protected by a sequence lock.  A writer
+ * always overwrites the older frame, so that readers which are stepping
+ * from the same communication point, possibly in parallel, still find the
+ * values from the start of the step.  This gives the same results as a
+ * master which transfers the values between the steps (Jacobi iteration),
+ * in any order of execution, as long as the instances are stepped together.
+ *
+ * Two frames are not enough if the writer gets more than one step ahead of
+ * a reader, e.g. with a multirate master, or if the writer repeats a step
+ * with a smaller step size, which overwrites the frame from the start of
+ * the step.  Read() then finds no frame which is valid at the reader's
+ * time, and the reader keeps its old values.
+ */
+class Signal
+{
+public:
+    Signal(std::string name, std::size_t size)
+        : m_name(std::move(name))
+        , m_size{size}
+    {
+        for (auto& f : m_frames) {
+            f.sequence.store(0, std::memory_order_relaxed);
+            f.values.assign(size, 0.0);
+        }
+    }
+
+    Signal(const Signal&) = delete;
+    Signal& operator=(const Signal&) = delete;
+
+    const std::string& Name() const CPPFMU_NOEXCEPT { return m_name; }
+
+    std::size_t Size() const CPPFMU_NOEXCEPT { return m_size; }
+
+    // Publishes 'values' as valid from the communication point 'time'.
+    void Write(fmiReal time, const fmiReal values[]) CPPFMU_NOEXCEPT
+    {
+        const auto latest = m_latest.load(std::memory_order_relaxed);
+        auto& f = m_frames[1 - latest];
+        const auto sequence = f.sequence.load(std::memory_order_relaxed);
+        f.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        f.time = time;
+        std::memcpy(f.values.data(), values, m_size * sizeof(fmiReal));
+        f.sequence.store(sequence + 2, std::memory_order_release);
+        m_latest.store(1 - latest, std::memory_order_release);
+    }
+
+    /* Copies the values which are valid at the communication point 'time'
+     * to 'values', i.e., those of the latest frame whose time is not after
+     * 'time'.  Returns false, and leaves 'values' unchanged, if there is no
+     * such frame.
+     */
+    bool Read(fmiReal time, fmiReal values[]) const CPPFMU_NOEXCEPT
+    {
+        const auto tolerance = 1e-9 * (std::fabs(time) > 1.0 ? std::fabs(time) : 1.0);
+        for (;;) {
+            const auto latest = m_latest.load(std::memory_order_acquire);
+            bool retry = false;
+            for (const auto i : { latest, 1 - latest }) {
+                const auto& f = m_frames[i];
+                const auto sequence = f.sequence.load(std::memory_order_acquire);
+                if (sequence == 0) continue;
+                if (sequence % 2 != 0) { retry = true; break; }
+                const auto frameTime = f.time;
+                if (frameTime > time + tolerance) {
+                    if (f.sequence.load(std::memory_order_acquire) != sequence) {
+                        retry = true;
+                        break;
+                    }
+                    continue;
+                }
+                std::memcpy(values, f.values.data(), m_size * sizeof(fmiReal));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (f.sequence.load(std::memory_order_relaxed) != sequence) {
+                    retry = true;
+                    break;
+                }
+                return true;
+            }
+            if (!retry) return false;
+        }
+    }
+
+    // Returns whether the signal has been written at all.
+    bool HasValues() const CPPFMU_NOEXCEPT
+    {
+        return m_frames[0].sequence.load(std::memory_order_acquire) != 0
+            || m_frames[1].sequence.load(std::memory_order_acquire) != 0;
+    }
+
+private:
+    friend class SignalBus;
+
+    struct Frame
+    {
+        std::atomic<std::uint64_t> sequence;    // odd while written
+        fmiReal time = 0.0;
+        std::vector<fmiReal> values;
+    };
+
+    const std::string m_name;
+    const std::size_t m_size;
+    Frame m_frames[2];
+    std::atomic<int> m_latest{0};
+
+    // Protected by the SignalBus mutex
+    std::string m_writer;               // instance name, empty if none
+    std::vector<std::string> m_readers; // instance names
+};
+
+
+/* A writer's handle to a signal on the SignalBus.  Detaches the writer from
+ * the signal when destroyed.
+ */
+class SignalWriter
+{
+public:
+    SignalWriter() = default;
+
+    explicit SignalWriter(std::shared_ptr<Signal> signal) CPPFMU_NOEXCEPT
+        : m_signal(std::move(signal))
+    {
+    }
+
+    SignalWriter(SignalWriter&&) = default;
+    SignalWriter& operator=(SignalWriter&& other) CPPFMU_NOEXCEPT;
+    ~SignalWriter() CPPFMU_NOEXCEPT;
+
+    /* Publishes the values which the instance's outputs have at the end of a
+     * time step, i.e., at the communication point 'time'.
+     */
+    void Write(fmiReal time, const fmiReal values[]) CPPFMU_NOEXCEPT
+    {
+        m_signal->Write(time, values);
+    }
+
+    std::size_t Size() const CPPFMU_NOEXCEPT { return m_signal->Size(); }
+
+private:
+    void Detach() CPPFMU_NOEXCEPT;
+
+    std::shared_ptr<Signal> m_signal;
+};
+
+
+/* A reader's handle to a signal on the SignalBus.  Detaches the reader from
+ * the signal when destroyed.
+ */
+class SignalReader
+{
+public:
+    SignalReader() = default;
+
+    SignalReader(
+        std::shared_ptr<Signal> signal,
+        std::string instanceName,
+        std::unique_ptr<Logger> logger) CPPFMU_NOEXCEPT
+        : m_signal(std::move(signal))
+        , m_instanceName(std::move(instanceName))
+        , m_logger(std::move(logger))
+    {
+    }
+
+    SignalReader(SignalReader&&) = default;
+    SignalReader& operator=(SignalReader&& other) CPPFMU_NOEXCEPT;
+    ~SignalReader() CPPFMU_NOEXCEPT;
+
+    /* Copies the values which are valid at the communication point 'time',
+     * typically the start of a time step, to 'values'.  Returns false, and
+     * leaves 'values' unchanged, if nothing has been written yet, or if the
+     * writer has got more than one step ahead (see Signal).  The first time
+     * the latter happens, a warning is logged on behalf of the reader.
+     */
+    bool Read(fmiReal time, fmiReal values[]) const CPPFMU_NOEXCEPT
+    {
+        if (m_signal->Read(time, values)) return true;
+        if (!m_warned && m_signal->HasValues()) {
+            m_warned = true;
+            m_logger->LogFormatted(fmiWarning, "cppfmu",
+                "Signal '{}' has no values for t = {}, since its writer has "
+                "stepped ahead; the old values are used.  The instances must "
+                "be stepped together, at the same rate.",
+                m_signal->Name().c_str(), time);
+        }
+        return false;
+    }
+
+    std::size_t Size() const CPPFMU_NOEXCEPT { return m_signal->Size(); }
+
+private:
+    void Detach() CPPFMU_NOEXCEPT;
+
+    std::shared_ptr<Signal> m_signal;
+    std::string m_instanceName;
+    std::unique_ptr<Logger> m_logger;
+    mutable bool m_warned = false;
+};
+
+
+/* A process-wide bus on which instances exchange real values directly, at
+ * communication points, instead of through the simulation environment.
+ *
+ * An instance declares an output with Output() and an input with Input(),
+ * typically in its constructor, and the two are connected if they have the
+ * same signal name.  In DoStep(), the instance reads its inputs for the
+ * start of the step, and writes its outputs for the end of it:
+ *
+ *     m_force.Read(currentCommunicationPoint, force);
+ *     ...
+ *     m_position.Write(currentCommunicationPoint + communicationStepSize, x);
+ *
+ * Each signal can have one writer.  Connections are logged when they are
+ * made, and the simulation environment can list them with the
+ * cppfmuGetSignalConnections() extension function, so that it does not
+ * transfer the same values itself.
+ *
+ * The bus is shared by all instances of the models in a shared library, and
+ * its memory is allocated with the standard allocators, since it is not
+ * owned by any one instance.
+ */
+class SignalBus
+{
+public:
+    static SignalBus& Instance()
+    {
+        static SignalBus instance;
+        return instance;
+    }
+
+    /* Declares 'logger's instance as the writer of the signal 'name', which
+     * has 'size' values.  Throws std::logic_error if the signal already has
+     * a writer, or if it has been declared with another size.
+     *
+     * The writer must be stepped together with the readers, at the same rate,
+     * and must not repeat steps.  Otherwise readers may miss values, and use
+     * old ones instead (see Signal).
+     */
+    SignalWriter Output(const char* name, std::size_t size, Logger& logger)
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        auto signal = Find(name, size);
+        if (!signal->m_writer.empty()) {
+            throw std::logic_error(
+                "Signal '" + signal->m_name + "' is already written by " + signal->m_writer);
+        }
+        signal->m_writer = logger.InstanceName();
+        if (signal->m_writer.empty()) signal->m_writer = "?";
+        for (const auto& reader : signal->m_readers) {
+            LogConnection(logger, *signal, reader);
+        }
+        return SignalWriter{std::move(signal)};
+    }
+
+    /* Declares 'logger's instance as a reader of the signal 'name', which has
+     * 'size' values.  Throws std::logic_error if the signal has been declared
+     * with another size.
+     *
+     * The reader must be stepped together with the writer, at the same rate.
+     * If the writer gets more than one step ahead, the reader keeps its old
+     * values, and a warning is logged through a copy of 'logger'.
+     */
+    SignalReader Input(const char* name, std::size_t size, Logger& logger)
+    {
+        std::unique_ptr<Logger> readerLogger{new Logger(logger)};
+        std::lock_guard<std::mutex> lock{m_mutex};
+        auto signal = Find(name, size);
+        std::string instanceName = logger.InstanceName();
+        signal->m_readers.push_back(instanceName);
+        if (!signal->m_writer.empty()) {
+            LogConnection(logger, *signal, instanceName);
+        }
+        return SignalReader{
+            std::move(signal), std::move(instanceName), std::move(readerLogger)};
+    }
+
+    /* Calls 'f(signal, writer, reader, size)' for each connection between a
+     * writer and a reader, with the signal and instance names as C strings.
+     * The strings are only valid during the call.
+     */
+    template<typename F>
+    void ForEachConnection(F&& f) const
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        for (const auto& entry : m_signals) {
+            const auto signal = entry.second.lock();
+            if (!signal || signal->m_writer.empty()) continue;
+            for (const auto& reader : signal->m_readers) {
+                f(signal->m_name.c_str(), signal->m_writer.c_str(), reader.c_str(),
+                    signal->m_size);
+            }
+        }
+    }
+
+    // Returns whether the instance 'instanceName' writes or reads a signal.
+    bool IsAttached(const char* instanceName) const CPPFMU_NOEXCEPT
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        for (const auto& entry : m_signals) {
+            const auto signal = entry.second.lock();
+            if (!signal) continue;
+            if (signal->m_writer == instanceName) return true;
+            for (const auto& reader : signal->m_readers) {
+                if (reader == instanceName) return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    friend class SignalWriter;
+    friend class SignalReader;
+
+    SignalBus() = default;
+
+    // Returns the signal 'name', which is created if necessary.
+    std::shared_ptr<Signal> Find(const char* name, std::size_t size)
+    {
+        auto& entry = m_signals[name];
+        auto signal = entry.lock();
+        if (!signal) {
+            signal = std::make_shared<Signal>(name, size);
+            entry = signal;
+        } else if (signal->m_size != size) {
+            throw std::logic_error("Signal '" + signal->m_name + "' has another size");
+        }
+        return signal;
+    }
+
+    static void LogConnection(Logger& logger, const Signal& signal, const std::string& reader)
+        CPPFMU_NOEXCEPT
+    {
+        logger.LogFormatted(fmiOK, "cppfmu", "Signal '{}' connected: {} -> {}",
+            signal.m_name.c_str(), signal.m_writer.c_str(), reader.c_str());
+    }
+
+    void RemoveWriter(Signal& signal) CPPFMU_NOEXCEPT
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        signal.m_writer.clear();
+        Prune(signal);
+    }
+
+    void RemoveReader(Signal& signal, const std::string& instanceName) CPPFMU_NOEXCEPT
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        auto& readers = signal.m_readers;
+        for (auto it = readers.begin(); it != readers.end(); ++it) {
+            if (*it == instanceName) {
+                readers.erase(it);
+                break;
+            }
+        }
+        Prune(signal);
+    }
+
+    // Forgets a signal which has neither a writer nor readers.
+    void Prune(const Signal& signal) CPPFMU_NOEXCEPT
+    {
+        if (signal.m_writer.empty() && signal.m_readers.empty()) {
+            m_signals.erase(signal.m_name);
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::weak_ptr<Signal>> m_signals;
+};
+
+
+inline SignalWriter& SignalWriter::operator=(SignalWriter&& other) CPPFMU_NOEXCEPT
+{
+    if (this != &other) {
+        Detach();
+        m_signal = std::move(other.m_signal);
+    }
+    return *this;
+}
+
+inline SignalWriter::~SignalWriter() CPPFMU_NOEXCEPT
+{
+    Detach();
+}
+
+inline void SignalWriter::Detach() CPPFMU_NOEXCEPT
+{
+    if (m_signal) {
+        SignalBus::Instance().RemoveWriter(*m_signal);
+        m_signal.reset();
+    }
+}
+
+inline SignalReader& SignalReader::operator=(SignalReader&& other) CPPFMU_NOEXCEPT
+{
+    if (this != &other) {
+        Detach();
+        m_signal = std::move(other.m_signal);
+        m_instanceName = std::move(other.m_instanceName);
+        m_logger = std::move(other.m_logger);
+        m_warned = other.m_warned;
+    }
+    return *this;
+}
+
+inline SignalReader::~SignalReader() CPPFMU_NOEXCEPT
+{
+    Detach();
+}
+
+inline void SignalReader::Detach() CPPFMU_NOEXCEPT
+{
+    if (m_signal) {
+        SignalBus::Instance().RemoveReader(*m_signal, m_instanceName);
+        m_signal.reset();
+    }
+}
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,305 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_TIMELINE_HPP
+#define CPPFMU_TIMELINE_HPP
+
+#include <atomic>       // std::atomic
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <cstdio>       // std::FILE, std::fopen, std::fprintf, ...
+#include <mutex>        // std::mutex, std::lock_guard
+#include <new>          // placement new
+#include <type_traits>  // std::aligned_storage
+
+#ifdef _WIN32
+#   include <process.h> // _getpid
+#else
+#   include <unistd.h>  // getpid
+#endif
+
+#include "cppfmu_instrumentation.hpp"
+
+
+/* Timeline tracing.
+ *
+ * If CPPFMU_ENABLE_TIMELINE is defined, and the CPPFMU_TIMELINE_DIR
+ * environment variable names an existing directory when the first instance
+ * is created, the FMI function calls of all instances, and the scopes marked
+ * with CPPFMU_TIMELINE_SCOPE in model code, are recorded as "complete"
+ * events in the Chrome trace event format.  The events are written to a
+ * file named cppfmu-<process ID>-<n>.json in that directory, which can be
+ * opened in Perfetto (https://ui.perfetto.dev) or chrome://tracing, and
+ * shows which instance was doing what on which thread at any time.
+ *
+ * Events are collected in fixed-size, per-thread buffers without locking,
+ * and written to the file when a buffer is full, when a thread exits and
+ * when an instance is freed.  CPPFMU_TIMELINE_BUFFER_SIZE is the number of
+ * events each thread can buffer.
+ *
+ * The timestamps are taken from the same monotonic clock in all FMUs, so
+ * the files written by different FMUs during one run can be merged.
+ */
+#ifndef CPPFMU_TIMELINE_BUFFER_SIZE
+#   define CPPFMU_TIMELINE_BUFFER_SIZE 4096
+#endif
+
+
+namespace cppfmu
+{
+
+/* The process-wide timeline.  All functions are static and thread safe.
+ * Recording an event only involves the calling thread's own buffer, except
+ * when that buffer is full.
+ */
+class Timeline
+{
+public:
+    /* Starts writing the timeline to a new file in 'directory', if it is not
+     * null or empty and no file has been opened yet.  Otherwise, does
+     * nothing.
+     */
+    static void Open(const char* directory) CPPFMU_NOEXCEPT
+    {
+        if (!directory || *directory == '\0') return;
+        auto& s = GetState();
+        std::lock_guard<std::mutex> lock{s.mutex};
+        if (s.file) return;
+        for (unsigned n = 0; n < 1000 && !s.file; ++n) {
+            char path[1024];
+            std::snprintf(path, sizeof path, "%s/cppfmu-%ld-%u.json",
+                directory, ProcessId(), n);
+            // "x": Fail if the file exists, e.g. because another FMU in
+            // this process has already created it.
+            s.file = std::fopen(path, "wx");
+        }
+        if (!s.file) return;
+        // The closing bracket is optional in the JSON array format, so the
+        // file stays valid even if the process never gets to close it.
+        std::fputs("[\n", s.file);
+        std::fflush(s.file);
+        s.enabled.store(true, std::memory_order_release);
+    }
+
+    // Returns whether the timeline is being recorded.
+    static bool IsEnabled() CPPFMU_NOEXCEPT
+    {
+        return GetState().enabled.load(std::memory_order_relaxed);
+    }
+
+    /* Records an event named 'name' in 'category', which began at 'start' ns
+     * and ended at 'end' ns (see MonotonicNanoseconds()).  'instance' may be
+     * null.  All strings must stay valid until the next Flush().
+     */
+    static void Record(
+        const char* category,
+        const char* name,
+        const char* instance,
+        std::uint64_t start,
+        std::uint64_t end) CPPFMU_NOEXCEPT
+    {
+        auto& buffer = GetThreadBuffer();
+        auto n = buffer.written.load(std::memory_order_relaxed);
+        if (n == CPPFMU_TIMELINE_BUFFER_SIZE) {
+            std::lock_guard<std::mutex> lock{GetState().mutex};
+            Write(buffer);
+            buffer.flushed = 0;
+            buffer.written.store(0, std::memory_order_relaxed);
+            n = 0;
+        }
+        auto& e = buffer.events[n];
+        e.category = category;
+        e.name = name;
+        e.instance = instance;
+        e.start = start;
+        e.duration = end - start;
+        buffer.written.store(n + 1, std::memory_order_release);
+    }
+
+    // Writes the events buffered by all threads to the file.
+    static void Flush() CPPFMU_NOEXCEPT
+    {
+        auto& s = GetState();
+        std::lock_guard<std::mutex> lock{s.mutex};
+        for (auto b = s.threads; b; b = b->next) Write(*b);
+    }
+
+private:
+    struct Event
+    {
+        const char* category;
+        const char* name;
+        const char* instance;
+        std::uint64_t start;
+        std::uint64_t duration;
+    };
+
+    /* The events recorded by one thread.  Only the owning thread adds events
+     * and publishes them by incrementing 'written'.  'flushed' and the list
+     * links are protected by the State mutex, as is resetting 'written'.
+     */
+    struct ThreadBuffer
+    {
+        ThreadBuffer() CPPFMU_NOEXCEPT
+        {
+            auto& s = GetState();
+            std::lock_guard<std::mutex> lock{s.mutex};
+            id = ++s.threadCount;
+            next = s.threads;
+            if (next) next->prev = this;
+            s.threads = this;
+        }
+
+        ~ThreadBuffer() CPPFMU_NOEXCEPT
+        {
+            auto& s = GetState();
+            std::lock_guard<std::mutex> lock{s.mutex};
+            Write(*this);
+            if (prev) prev->next = next; else s.threads = next;
+            if (next) next->prev = prev;
+        }
+
+        ThreadBuffer(const ThreadBuffer&) = delete;
+        ThreadBuffer& operator=(const ThreadBuffer&) = delete;
+
+        Event events[CPPFMU_TIMELINE_BUFFER_SIZE];
+        std::atomic<std::size_t> written{0};
+        std::size_t flushed = 0;
+        unsigned id = 0;
+        ThreadBuffer* prev = nullptr;
+        ThreadBuffer* next = nullptr;
+    };
+
+    struct State
+    {
+        std::mutex mutex;
+        std::FILE* file = nullptr;
+        std::atomic<bool> enabled{false};
+        ThreadBuffer* threads = nullptr;
+        unsigned threadCount = 0;
+    };
+
+    static long ProcessId() CPPFMU_NOEXCEPT
+    {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return static_cast<long>(getpid());
+#endif
+    }
+
+    /* The state is never destroyed, since threads may exit and flush their
+     * buffers after static objects have been destroyed.
+     */
+    static State& GetState() CPPFMU_NOEXCEPT
+    {
+        static typename std::aligned_storage<sizeof(State), alignof(State)>::type
+            storage;
+        static State* const state = ::new(static_cast<void*>(&storage)) State;
+        return *state;
+    }
+
+    static ThreadBuffer& GetThreadBuffer() CPPFMU_NOEXCEPT
+    {
+        thread_local ThreadBuffer buffer;
+        return buffer;
+    }
+
+    // Writes the unwritten events in 'b'.  Requires the State mutex.
+    static void Write(ThreadBuffer& b) CPPFMU_NOEXCEPT
+    {
+        const auto file = GetState().file;
+        const auto written = b.written.load(std::memory_order_acquire);
+        if (file) {
+            const auto pid = ProcessId();
+            for (auto i = b.flushed; i < written; ++i) {
+                const auto& e = b.events[i];
+                std::fputs("{\"cat\":", file);
+                WriteString(file, e.category);
+                std::fputs(",\"name\":", file);
+                WriteString(file, e.name);
+                std::fprintf(file, ",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+                    "\"pid\":%ld,\"tid\":%u",
+                    static_cast<unsigned long long>(e.start / 1000),
+                    static_cast<unsigned>(e.start % 1000),
+                    static_cast<unsigned long long>(e.duration / 1000),
+                    static_cast<unsigned>(e.duration % 1000),
+                    pid,
+                    b.id);
+                if (e.instance) {
+                    std::fputs(",\"args\":{\"instance\":", file);
+                    WriteString(file, e.instance);
+                    std::fputc('}', file);
+                }
+                std::fputs("},\n", file);
+            }
+            std::fflush(file);
+        }
+        b.flushed = written;
+    }
+
+    static void WriteString(std::FILE* file, const char* s) CPPFMU_NOEXCEPT
+    {
+        std::fputc('"', file);
+        for (; *s != '\0'; ++s) {
+            const auto c = static_cast<unsigned char>(*s);
+            if (c == '"' || c == '\\') {
+                std::fputc('\\', file);
+                std::fputc(c, file);
+            } else if (c < 0x20) {
+                std::fprintf(file, "\\u%04x", c);
+            } else {
+                std::fputc(c, file);
+            }
+        }
+        std::fputc('"', file);
+    }
+};
+
+
+/* Records a timeline event which spans the lifetime of the object, if the
+ * timeline is being recorded.  Use CPPFMU_TIMELINE_SCOPE rather than
+ * creating these directly in model code.
+ */
+class TimelineScope
+{
+public:
+    explicit TimelineScope(
+        const char* name,
+        const char* instance = nullptr,
+        const char* category = "model") CPPFMU_NOEXCEPT
+        : m_category{category}
+        , m_name{Timeline::IsEnabled() ? name : nullptr}
+        , m_instance{instance}
+        , m_start{m_name ? MonotonicNanoseconds() : 0}
+    {
+    }
+
+    ~TimelineScope() CPPFMU_NOEXCEPT
+    {
+        if (m_name) {
+            Timeline::Record(
+                m_category, m_name, m_instance, m_start, MonotonicNanoseconds());
+        }
+    }
+
+    TimelineScope(const TimelineScope&) = delete;
+    TimelineScope& operator=(const TimelineScope&) = delete;
+
+private:
+    const char* m_category;
+    const char* m_name;
+    const char* m_instance;
+    std::uint64_t m_start;
+};
+
+
+} // namespace cppfmu
+
+
+// CPPFMU_TIMELINE_SCOPE
+#include "cppfmu_timeline_scope.hpp"
+
+#endif // header guard
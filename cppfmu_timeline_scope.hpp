@@ -0,0 +1,39 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_TIMELINE_SCOPE_HPP
+#define CPPFMU_TIMELINE_SCOPE_HPP
+
+/* CPPFMU_TIMELINE_SCOPE, without the rest of the timeline (and its system
+ * headers) unless CPPFMU_ENABLE_TIMELINE is defined.  This is what
+ * cppfmu_cs.hpp includes, so that model code pays nothing for the timeline
+ * when it is disabled.
+ */
+#ifdef CPPFMU_ENABLE_TIMELINE
+#   include "cppfmu_timeline.hpp"
+#endif
+
+
+/* Marks the rest of the enclosing block as a region named 'name' (a string
+ * literal) in the timeline, e.g.:
+ *
+ *     void DoStep(...) override
+ *     {
+ *         CPPFMU_TIMELINE_SCOPE("solve");
+ *         ...
+ *     }
+ *
+ * Expands to nothing unless CPPFMU_ENABLE_TIMELINE is defined.
+ */
+#ifdef CPPFMU_ENABLE_TIMELINE
+#   define CPPFMU_TIMELINE_SCOPE(name) \
+        ::cppfmu::TimelineScope CPPFMU_TIMELINE_SCOPE_NAME_(__LINE__){name}
+#   define CPPFMU_TIMELINE_SCOPE_NAME_(line) CPPFMU_TIMELINE_SCOPE_NAME2_(line)
+#   define CPPFMU_TIMELINE_SCOPE_NAME2_(line) cppfmuTimelineScope ## line
+#else
+#   define CPPFMU_TIMELINE_SCOPE(name) static_cast<void>(0)
+#endif
+
+#endif // header guard
@@ -0,0 +1,249 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_TRACE_HPP
+#define CPPFMU_TRACE_HPP
+
+#include <algorithm>    // std::max
+#include <atomic>       // std::atomic
+#include <cctype>       // std::isalnum
+#include <chrono>       // std::chrono::system_clock
+#include <cstddef>      // offsetof, std::size_t
+#include <cstdint>      // std::uint64_t
+#include <cstdio>       // std::snprintf
+#include <cstring>      // std::memcpy, std::memset
+
+#ifdef _WIN32
+#   include <process.h>    // _getpid
+#else
+#   include <fcntl.h>      // open
+#   include <sys/mman.h>   // mmap, munmap
+#   include <unistd.h>     // ftruncate, getpid, pwrite, sysconf, unlink
+#endif
+
+#include "cppfmu_common.hpp"
+
+
+/* The size of the chunks by which trace files are extended.  On POSIX
+ * systems, this is also the size of the memory-mapped window into the file.
+ */
+#ifndef CPPFMU_TRACE_CHUNK_SIZE
+#   define CPPFMU_TRACE_CHUNK_SIZE (1024 * 1024)
+#endif
+
+
+namespace cppfmu
+{
+
+/* A TraceChannel which writes to a file (see TraceFileHeader for the format).
+ *
+ * On POSIX systems, the file is memory mapped, one chunk at a time, so that
+ * writing a record is a plain memory copy, and records which have been
+ * written survive a crash of the process.  Elsewhere, records are collected
+ * in a buffer and written to the file with stdio one chunk at a time.
+ */
+class TraceFile : public TraceChannel
+{
+public:
+    /* Creates a trace file for the instance 'instanceName' in 'directory'.
+     * The file name is made unique by the addition of the process ID and a
+     * serial number.  Returns null if 'directory' is null or empty, or if the
+     * file could not be created.
+     */
+    static UniquePtr<TraceFile> Create(
+        const Memory& memory,
+        const char* directory,
+        const char* instanceName)
+    {
+        if (!directory || *directory == '\0') return nullptr;
+        static std::atomic<unsigned> serial{0};
+
+        char name[96];
+        std::snprintf(name, sizeof name, "%s", instanceName ? instanceName : "");
+        for (auto p = name; *p != '\0'; ++p) {
+            if (!std::isalnum(static_cast<unsigned char>(*p)) && *p != '-') *p = '_';
+        }
+        char path[1024];
+        std::snprintf(path, sizeof path, "%s/%s-%d-%u.cpptrace",
+            directory, name, static_cast<int>(ProcessId()), serial++);
+
+        auto file = AllocateUnique<TraceFile>(memory, memory, path, instanceName);
+        if (!file->IsOpen()) return nullptr;
+        return file;
+    }
+
+    // Use Create() instead.
+    TraceFile(const Memory& memory, const char* path, const char* instanceName)
+        : m_memory{memory}
+    {
+        TraceFileHeader header;
+        std::memset(&header, 0, sizeof header);
+        std::memcpy(header.magic, traceFileMagic, sizeof header.magic);
+        header.version = traceFileVersion;
+        header.headerSize = sizeof header;
+        header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::snprintf(header.instanceName, sizeof header.instanceName, "%s",
+            instanceName ? instanceName : "");
+        Open(path, header);
+    }
+
+    ~TraceFile() CPPFMU_NOEXCEPT
+    {
+        Close();
+    }
+
+protected:
+    bool NextWindow(std::size_t minSize) CPPFMU_NOEXCEPT override;
+
+private:
+    static long ProcessId() CPPFMU_NOEXCEPT
+    {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return static_cast<long>(getpid());
+#endif
+    }
+
+    bool IsOpen() const CPPFMU_NOEXCEPT;
+    void Open(const char* path, const TraceFileHeader& header) CPPFMU_NOEXCEPT;
+    void Close() CPPFMU_NOEXCEPT;
+
+    Memory m_memory;
+#ifdef _WIN32
+    std::FILE* m_file = nullptr;
+    char* m_buffer = nullptr;
+    std::size_t m_bufferSize = 0;
+#else
+    int m_fd = -1;
+    char* m_window = nullptr;
+    std::size_t m_windowSize = 0;
+#endif
+    std::uint64_t m_windowOffset = 0; // file offset of current window/buffer
+};
+
+
+#ifdef _WIN32
+
+inline bool TraceFile::IsOpen() const CPPFMU_NOEXCEPT
+{
+    return m_file != nullptr && m_buffer != nullptr;
+}
+
+
+inline void TraceFile::Open(const char* path, const TraceFileHeader& header)
+    CPPFMU_NOEXCEPT
+{
+    m_bufferSize = CPPFMU_TRACE_CHUNK_SIZE;
+    m_buffer = static_cast<char*>(m_memory.Alloc(m_bufferSize, 1));
+    if (!m_buffer) return;
+    m_file = std::fopen(path, "wb");
+    if (!m_file) return;
+    std::fwrite(&header, sizeof header, 1, m_file);
+    m_windowOffset = sizeof header;
+    SetWindow(m_buffer, m_buffer + m_bufferSize);
+}
+
+
+inline bool TraceFile::NextWindow(std::size_t minSize) CPPFMU_NOEXCEPT
+{
+    if (!IsOpen() || minSize > m_bufferSize) return false;
+    std::fwrite(m_buffer, m_bufferSize, 1, m_file);
+    m_windowOffset += m_bufferSize;
+    SetWindow(m_buffer, m_buffer + m_bufferSize);
+    return true;
+}
+
+
+inline void TraceFile::Close() CPPFMU_NOEXCEPT
+{
+    if (m_file) {
+        const auto used = m_bufferSize - WindowRemaining();
+        std::fwrite(m_buffer, used, 1, m_file);
+        const std::uint64_t dataSize = m_windowOffset + used - sizeof(TraceFileHeader);
+        std::fseek(m_file, offsetof(TraceFileHeader, dataSize), SEEK_SET);
+        std::fwrite(&dataSize, sizeof dataSize, 1, m_file);
+        std::fclose(m_file);
+    }
+    if (m_buffer) m_memory.Free(m_buffer);
+}
+
+#else // POSIX
+
+inline bool TraceFile::IsOpen() const CPPFMU_NOEXCEPT
+{
+    return m_window != nullptr;
+}
+
+
+inline void TraceFile::Open(const char* path, const TraceFileHeader& header)
+    CPPFMU_NOEXCEPT
+{
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) return;
+    if (!NextWindow(sizeof header)) {
+        // Don't leave an empty file behind.
+        ::close(m_fd);
+        m_fd = -1;
+        ::unlink(path);
+        return;
+    }
+    std::memcpy(m_window, &header, sizeof header);
+    SetWindow(m_window + sizeof header, m_window + m_windowSize);
+}
+
+
+inline bool TraceFile::NextWindow(std::size_t minSize) CPPFMU_NOEXCEPT
+{
+    if (m_fd < 0) return false;
+    if (m_window) {
+        munmap(m_window, m_windowSize);
+        m_window = nullptr;
+        m_windowOffset += m_windowSize;
+        SetWindow(nullptr, nullptr);
+    }
+    const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const auto size = (std::max<std::size_t>(CPPFMU_TRACE_CHUNK_SIZE, minSize)
+        + page - 1) / page * page;
+    if (ftruncate(m_fd, static_cast<off_t>(m_windowOffset + size)) != 0) {
+        return false;
+    }
+    const auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        m_fd, static_cast<off_t>(m_windowOffset));
+    if (p == MAP_FAILED) return false;
+    m_window = static_cast<char*>(p);
+    m_windowSize = size;
+    SetWindow(m_window, m_window + m_windowSize);
+    return true;
+}
+
+
+inline void TraceFile::Close() CPPFMU_NOEXCEPT
+{
+    if (m_fd < 0) return;
+    if (m_window) {
+        const auto end = m_windowOffset + m_windowSize - WindowRemaining();
+        const std::uint64_t dataSize = end - sizeof(TraceFileHeader);
+        if (m_windowOffset == 0) {
+            std::memcpy(m_window + offsetof(TraceFileHeader, dataSize),
+                &dataSize, sizeof dataSize);
+        } else {
+            const auto ok = pwrite(m_fd, &dataSize, sizeof dataSize,
+                offsetof(TraceFileHeader, dataSize));
+            (void) ok;
+        }
+        munmap(m_window, m_windowSize);
+        const auto ok = ftruncate(m_fd, static_cast<off_t>(end));
+        (void) ok;
+    }
+    ::close(m_fd);
+}
+
+#endif
+
+
+} // namespace cppfmu
+#endif // header guard
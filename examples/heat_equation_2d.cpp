@@ -0,0 +1,185 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* Heat conduction in a unit square plate, discretised on an N x N grid of
+ * interior points, whose edges are held at a given temperature.  Every grid
+ * point is an output, so the model has N^2 outputs, e.g. 10^6 for N = 1000.
+ *
+ * Value references:
+ *
+ *     Integer 0            N, the grid size (parameter, default 32).  Can
+ *                          only be set before fmiInitializeSlave().
+ *     Real 0               alpha, thermal diffusivity [m^2/s] (parameter,
+ *                          default 1e-4)
+ *     Real 1               Tb, edge temperature [K] (input, default 300)
+ *     Real 2 ... 2+N^2-1   T, temperatures at the grid points, row by row [K]
+ *                          (outputs, initially 273.15)
+ *
+ * The equation is integrated with the explicit FTCS scheme, with internal
+ * steps which are short enough for stability.  Note that this means that
+ * the cost of a step grows as N^4.
+ *
+ * Build it as a shared library with MODEL_IDENTIFIER=heat_equation_2d,
+ * together with fmi_functions.cpp and cppfmu_cs.cpp.
+ */
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "cppfmu_cs.hpp"
+
+
+namespace
+{
+    const fmiReal initialTemperature = 273.15;
+
+
+    class HeatEquation2D : public cppfmu::SlaveInstance
+    {
+    public:
+        explicit HeatEquation2D(const cppfmu::Memory& memory)
+            : m_t(cppfmu::Allocator<fmiReal>{memory})
+            , m_next(cppfmu::Allocator<fmiReal>{memory})
+        {
+            Resize();
+        }
+
+        void Initialize(fmiReal, fmiBoolean, fmiReal) override
+        {
+            m_initialized = true;
+        }
+
+        void Reset() override
+        {
+            m_initialized = false;
+            std::fill(m_t.begin(), m_t.end(), initialTemperature);
+        }
+
+        void SetInteger(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiInteger value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                if (vr[i] != 0) throw std::out_of_range("Invalid value reference");
+                if (m_initialized) {
+                    throw std::logic_error("N can only be set before initialization");
+                }
+                if (value[i] < 1) throw std::invalid_argument("N must be positive");
+                m_n = static_cast<std::size_t>(value[i]);
+                Resize();
+            }
+        }
+
+        void GetInteger(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiInteger value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                if (vr[i] != 0) throw std::out_of_range("Invalid value reference");
+                value[i] = static_cast<fmiInteger>(m_n);
+            }
+        }
+
+        void SetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiReal value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) Real(vr[i]) = value[i];
+        }
+
+        void GetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiReal value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                value[i] = Real(vr[i]);
+            }
+        }
+
+        bool DoStep(
+            fmiReal /*currentCommunicationPoint*/,
+            fmiReal communicationStepSize,
+            fmiBoolean /*newStep*/,
+            fmiReal& /*endOfStep*/) override
+        {
+            // FTCS is stable for alpha*h/dx^2 <= 1/4.
+            const auto dx = 1.0 / (m_n + 1);
+            const auto maxStep = 0.25 * dx * dx / m_alpha;
+            const auto steps = static_cast<std::size_t>(
+                std::ceil(communicationStepSize / maxStep));
+            const auto h = communicationStepSize / std::max<std::size_t>(steps, 1);
+            const auto r = m_alpha * h / (dx * dx);
+            for (std::size_t s = 0; s < steps; ++s) Step(r);
+            return true;
+        }
+
+    private:
+        void Resize()
+        {
+            m_t.assign(m_n * m_n, initialTemperature);
+            m_next.assign(m_n * m_n, 0.0);
+        }
+
+        void Step(fmiReal r)
+        {
+            const auto n = m_n;
+            for (std::size_t i = 0; i < n; ++i) {
+                for (std::size_t j = 0; j < n; ++j) {
+                    const auto t = m_t[i*n + j];
+                    const auto north = i == 0     ? m_tb : m_t[(i-1)*n + j];
+                    const auto south = i + 1 == n ? m_tb : m_t[(i+1)*n + j];
+                    const auto west  = j == 0     ? m_tb : m_t[i*n + j - 1];
+                    const auto east  = j + 1 == n ? m_tb : m_t[i*n + j + 1];
+                    m_next[i*n + j] = t + r * (north + south + west + east - 4*t);
+                }
+            }
+            m_t.swap(m_next);
+        }
+
+        const fmiReal& Real(fmiValueReference vr) const
+        {
+            switch (vr) {
+                case 0: return m_alpha;
+                case 1: return m_tb;
+            }
+            const auto i = static_cast<std::size_t>(vr) - 2;
+            if (i < m_t.size()) return m_t[i];
+            throw std::out_of_range("Invalid value reference");
+        }
+
+        fmiReal& Real(fmiValueReference vr)
+        {
+            return const_cast<fmiReal&>(static_cast<const HeatEquation2D&>(*this).Real(vr));
+        }
+
+        std::size_t m_n = 32;
+        fmiReal m_alpha = 1e-4;
+        fmiReal m_tb = 300.0;
+        bool m_initialized = false;
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_t;
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_next;
+    };
+}
+
+
+cppfmu::UniquePtr<cppfmu::SlaveInstance> CppfmuInstantiateSlave(
+    fmiString  /*instanceName*/,
+    fmiString  /*fmuGUID*/,
+    fmiString  /*fmuLocation*/,
+    fmiString  /*mimeType*/,
+    fmiReal    /*timeout*/,
+    fmiBoolean /*visible*/,
+    fmiBoolean /*interactive*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger /*logger*/)
+{
+    return cppfmu::AllocateUnique<HeatEquation2D>(memory, memory);
+}
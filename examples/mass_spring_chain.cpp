@@ -0,0 +1,219 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* A chain of N equal masses connected by springs and dampers, where the
+ * first mass is attached to a wall and an external force acts on the last.
+ * The number of states is 2N, so the model scales from a single oscillator
+ * to millions of variables.
+ *
+ * Value references:
+ *
+ *     Integer 0            N, the number of masses (parameter, default 100).
+ *                          Can only be set before fmiInitializeSlave().
+ *     Real 0               k, spring stiffness [N/m] (parameter, default 1e3)
+ *     Real 1               c, damping coefficient [N s/m] (parameter, default 1)
+ *     Real 2               m, mass [kg] (parameter, default 1)
+ *     Real 3               F, force on the last mass [N] (input, default 0)
+ *     Real 4 ... 4+N-1     x, displacements [m] (outputs)
+ *     Real 4+N ... 4+2N-1  v, velocities [m/s] (outputs)
+ *
+ * The equations are integrated with the semi-implicit Euler method, with
+ * internal steps which are short enough for stability.
+ *
+ * Build it as a shared library with MODEL_IDENTIFIER=mass_spring_chain,
+ * together with fmi_functions.cpp and cppfmu_cs.cpp.  Define
+ * CPPFMU_ENABLE_PROTOTYPES to have further instances cloned from the first.
+ */
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "cppfmu_cs.hpp"
+
+
+namespace
+{
+    class MassSpringChain : public cppfmu::SlaveInstance
+    {
+    public:
+        explicit MassSpringChain(const cppfmu::Memory& memory)
+            : m_x(cppfmu::Allocator<fmiReal>{memory})
+            , m_v(cppfmu::Allocator<fmiReal>{memory})
+            , m_a(cppfmu::Allocator<fmiReal>{memory})
+        {
+            Resize();
+        }
+
+        // Copies 'other', using 'memory' for the new instance's arrays.
+        MassSpringChain(const MassSpringChain& other, const cppfmu::Memory& memory)
+            : m_n{other.m_n}
+            , m_k{other.m_k}
+            , m_c{other.m_c}
+            , m_m{other.m_m}
+            , m_f{other.m_f}
+            , m_initialized{other.m_initialized}
+            , m_x(other.m_x.begin(), other.m_x.end(), cppfmu::Allocator<fmiReal>{memory})
+            , m_v(other.m_v.begin(), other.m_v.end(), cppfmu::Allocator<fmiReal>{memory})
+            , m_a(other.m_a.begin(), other.m_a.end(), cppfmu::Allocator<fmiReal>{memory})
+        {
+        }
+
+        cppfmu::UniquePtr<cppfmu::SlaveInstance> Clone(
+            cppfmu::Memory memory,
+            cppfmu::Logger /*logger*/) const override
+        {
+            return cppfmu::AllocateUnique<MassSpringChain>(memory, *this, memory);
+        }
+
+        void Initialize(fmiReal, fmiBoolean, fmiReal) override
+        {
+            m_initialized = true;
+        }
+
+        void Reset() override
+        {
+            m_initialized = false;
+            std::fill(m_x.begin(), m_x.end(), 0.0);
+            std::fill(m_v.begin(), m_v.end(), 0.0);
+        }
+
+        void SetInteger(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiInteger value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                if (vr[i] != 0) throw std::out_of_range("Invalid value reference");
+                if (m_initialized) {
+                    throw std::logic_error("N can only be set before initialization");
+                }
+                if (value[i] < 1) throw std::invalid_argument("N must be positive");
+                m_n = static_cast<std::size_t>(value[i]);
+                Resize();
+            }
+        }
+
+        void GetInteger(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiInteger value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                if (vr[i] != 0) throw std::out_of_range("Invalid value reference");
+                value[i] = static_cast<fmiInteger>(m_n);
+            }
+        }
+
+        void SetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiReal value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) Real(vr[i]) = value[i];
+        }
+
+        void GetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiReal value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                value[i] = Real(vr[i]);
+            }
+        }
+
+        bool DoStep(
+            fmiReal /*currentCommunicationPoint*/,
+            fmiReal communicationStepSize,
+            fmiBoolean /*newStep*/,
+            fmiReal& /*endOfStep*/) override
+        {
+            // The highest eigenfrequency of the chain is below 2*sqrt(k/m),
+            // and semi-implicit Euler is stable for h*omega < 2.
+            const auto maxStep = 0.5 * std::sqrt(m_m / m_k);
+            const auto steps = static_cast<std::size_t>(
+                std::ceil(communicationStepSize / maxStep));
+            const auto h = communicationStepSize / std::max<std::size_t>(steps, 1);
+            for (std::size_t s = 0; s < steps; ++s) Step(h);
+            return true;
+        }
+
+    private:
+        void Resize()
+        {
+            m_x.assign(m_n, 0.0);
+            m_v.assign(m_n, 0.0);
+            m_a.assign(m_n, 0.0);
+        }
+
+        void Step(fmiReal h)
+        {
+            const auto n = m_n;
+            const auto k = m_k / m_m;
+            const auto c = m_c / m_m;
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto xLeft = i == 0 ? 0.0 : m_x[i-1];
+                const auto vLeft = i == 0 ? 0.0 : m_v[i-1];
+                auto a = -k * (m_x[i] - xLeft) - c * (m_v[i] - vLeft);
+                if (i + 1 < n) {
+                    a += k * (m_x[i+1] - m_x[i]) + c * (m_v[i+1] - m_v[i]);
+                } else {
+                    a += m_f / m_m;
+                }
+                m_a[i] = a;
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                m_v[i] += h * m_a[i];
+                m_x[i] += h * m_v[i];
+            }
+        }
+
+        const fmiReal& Real(fmiValueReference vr) const
+        {
+            switch (vr) {
+                case 0: return m_k;
+                case 1: return m_c;
+                case 2: return m_m;
+                case 3: return m_f;
+            }
+            const auto i = static_cast<std::size_t>(vr) - 4;
+            if (i < m_n) return m_x[i];
+            if (i < 2 * m_n) return m_v[i - m_n];
+            throw std::out_of_range("Invalid value reference");
+        }
+
+        fmiReal& Real(fmiValueReference vr)
+        {
+            return const_cast<fmiReal&>(static_cast<const MassSpringChain&>(*this).Real(vr));
+        }
+
+        std::size_t m_n = 100;
+        fmiReal m_k = 1e3;
+        fmiReal m_c = 1.0;
+        fmiReal m_m = 1.0;
+        fmiReal m_f = 0.0;
+        bool m_initialized = false;
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_x;
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_v;
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_a;
+    };
+}
+
+
+cppfmu::UniquePtr<cppfmu::SlaveInstance> CppfmuInstantiateSlave(
+    fmiString  /*instanceName*/,
+    fmiString  /*fmuGUID*/,
+    fmiString  /*fmuLocation*/,
+    fmiString  /*mimeType*/,
+    fmiReal    /*timeout*/,
+    fmiBoolean /*visible*/,
+    fmiBoolean /*interactive*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger /*logger*/)
+{
+    return cppfmu::AllocateUnique<MassSpringChain>(memory, memory);
+}
@@ -0,0 +1,251 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* N independent, well-mixed reactors, each running Robertson's chemical
+ * kinetics problem, a classic stiff system:
+ *
+ *     A -> B            (k1)
+ *     B + B -> C + B    (k2)
+ *     B + C -> A + C    (k3)
+ *
+ * Each reactor has 3 states, so the model has 3N outputs.  To make the
+ * reactors differ, the rate constant k1 of reactor i is scaled by
+ * 1 + i/N.  The equations are integrated with the backward Euler method,
+ * solving for each reactor with Newton's method, so the model is dominated
+ * by small dense linear solves, unlike the other examples.  If Newton's
+ * method fails to converge, DoStep() returns false (fmiDiscard).
+ *
+ * Value references:
+ *
+ *     Integer 0            N, the number of reactors (parameter, default 1).
+ *                          Can only be set before fmiInitializeSlave().
+ *     Integer 1            Internal steps per communication step (parameter,
+ *                          default 10)
+ *     Real 0, 1, 2         k1, k2, k3, rate constants (parameters, default
+ *                          0.04, 3e7, 1e4)
+ *     Real 3 ... 3+3N-1    Concentrations of A, B and C in each reactor, in
+ *                          that order (outputs, initially 1, 0, 0)
+ *
+ * Build it as a shared library with MODEL_IDENTIFIER=stiff_kinetics,
+ * together with fmi_functions.cpp and cppfmu_cs.cpp.
+ */
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "cppfmu_cs.hpp"
+
+
+namespace
+{
+    class StiffKinetics : public cppfmu::SlaveInstance
+    {
+    public:
+        explicit StiffKinetics(const cppfmu::Memory& memory)
+            : m_y(cppfmu::Allocator<fmiReal>{memory})
+        {
+            Resize();
+        }
+
+        void Initialize(fmiReal, fmiBoolean, fmiReal) override
+        {
+            m_initialized = true;
+        }
+
+        void Reset() override
+        {
+            m_initialized = false;
+            Resize();
+        }
+
+        void SetInteger(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiInteger value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                if (value[i] < 1) throw std::invalid_argument("Value must be positive");
+                switch (vr[i]) {
+                    case 0:
+                        if (m_initialized) {
+                            throw std::logic_error(
+                                "N can only be set before initialization");
+                        }
+                        m_n = static_cast<std::size_t>(value[i]);
+                        Resize();
+                        break;
+                    case 1:
+                        m_substeps = static_cast<std::size_t>(value[i]);
+                        break;
+                    default:
+                        throw std::out_of_range("Invalid value reference");
+                }
+            }
+        }
+
+        void GetInteger(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiInteger value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                switch (vr[i]) {
+                    case 0: value[i] = static_cast<fmiInteger>(m_n); break;
+                    case 1: value[i] = static_cast<fmiInteger>(m_substeps); break;
+                    default: throw std::out_of_range("Invalid value reference");
+                }
+            }
+        }
+
+        void SetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiReal value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) Real(vr[i]) = value[i];
+        }
+
+        void GetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiReal value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                value[i] = Real(vr[i]);
+            }
+        }
+
+        bool DoStep(
+            fmiReal currentCommunicationPoint,
+            fmiReal communicationStepSize,
+            fmiBoolean /*newStep*/,
+            fmiReal& endOfStep) override
+        {
+            const auto h = communicationStepSize / m_substeps;
+            for (std::size_t s = 0; s < m_substeps; ++s) {
+                for (std::size_t r = 0; r < m_n; ++r) {
+                    const auto k1 = m_k1 * (1.0 + static_cast<fmiReal>(r) / m_n);
+                    if (!BackwardEuler(&m_y[3*r], k1, h)) {
+                        endOfStep = currentCommunicationPoint + s * h;
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+    private:
+        void Resize()
+        {
+            m_y.assign(3 * m_n, 0.0);
+            for (std::size_t r = 0; r < m_n; ++r) m_y[3*r] = 1.0;
+        }
+
+        /* Takes a backward Euler step of length 'h' for one reactor, whose
+         * concentrations are y[0], y[1] and y[2].  Returns false if Newton's
+         * method does not converge, in which case 'y' is left unchanged.
+         */
+        bool BackwardEuler(fmiReal* y, fmiReal k1, fmiReal h) const
+        {
+            const auto k2 = m_k2;
+            const auto k3 = m_k3;
+            fmiReal z[3] = { y[0], y[1], y[2] };
+            for (int iteration = 0; iteration < 20; ++iteration) {
+                // Residual F(z) = z - y - h f(z), and Jacobian J = I - h df/dz.
+                const fmiReal f[3] = {
+                    -k1*z[0] + k3*z[1]*z[2],
+                    k1*z[0] - k3*z[1]*z[2] - k2*z[1]*z[1],
+                    k2*z[1]*z[1]
+                };
+                fmiReal b[3];
+                for (int i = 0; i < 3; ++i) b[i] = -(z[i] - y[i] - h*f[i]);
+                fmiReal a[3][3] = {
+                    { 1 + h*k1, -h*k3*z[2],                  -h*k3*z[1]     },
+                    { -h*k1,    1 + h*(k3*z[2] + 2*k2*z[1]), h*k3*z[1]      },
+                    { 0,        -h*2*k2*z[1],                1              }
+                };
+                if (!Solve3(a, b)) return false;
+                fmiReal norm = 0;
+                for (int i = 0; i < 3; ++i) {
+                    z[i] += b[i];
+                    norm = std::fmax(norm, std::fabs(b[i]));
+                }
+                if (norm < 1e-12) {
+                    for (int i = 0; i < 3; ++i) y[i] = z[i];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Solves a x = b by Gaussian elimination with partial pivoting.
+        static bool Solve3(fmiReal (&a)[3][3], fmiReal (&b)[3])
+        {
+            for (int c = 0; c < 3; ++c) {
+                int p = c;
+                for (int r = c + 1; r < 3; ++r) {
+                    if (std::fabs(a[r][c]) > std::fabs(a[p][c])) p = r;
+                }
+                if (a[p][c] == 0) return false;
+                if (p != c) {
+                    for (int k = 0; k < 3; ++k) std::swap(a[p][k], a[c][k]);
+                    std::swap(b[p], b[c]);
+                }
+                for (int r = c + 1; r < 3; ++r) {
+                    const auto m = a[r][c] / a[c][c];
+                    for (int k = c; k < 3; ++k) a[r][k] -= m * a[c][k];
+                    b[r] -= m * b[c];
+                }
+            }
+            for (int r = 2; r >= 0; --r) {
+                for (int k = r + 1; k < 3; ++k) b[r] -= a[r][k] * b[k];
+                b[r] /= a[r][r];
+            }
+            return true;
+        }
+
+        const fmiReal& Real(fmiValueReference vr) const
+        {
+            switch (vr) {
+                case 0: return m_k1;
+                case 1: return m_k2;
+                case 2: return m_k3;
+            }
+            const auto i = static_cast<std::size_t>(vr) - 3;
+            if (i < m_y.size()) return m_y[i];
+            throw std::out_of_range("Invalid value reference");
+        }
+
+        fmiReal& Real(fmiValueReference vr)
+        {
+            return const_cast<fmiReal&>(static_cast<const StiffKinetics&>(*this).Real(vr));
+        }
+
+        std::size_t m_n = 1;
+        std::size_t m_substeps = 10;
+        fmiReal m_k1 = 0.04;
+        fmiReal m_k2 = 3e7;
+        fmiReal m_k3 = 1e4;
+        bool m_initialized = false;
+        std::vector<fmiReal, cppfmu::Allocator<fmiReal>> m_y;
+    };
+}
+
+
+cppfmu::UniquePtr<cppfmu::SlaveInstance> CppfmuInstantiateSlave(
+    fmiString  /*instanceName*/,
+    fmiString  /*fmuGUID*/,
+    fmiString  /*fmuLocation*/,
+    fmiString  /*mimeType*/,
+    fmiReal    /*timeout*/,
+    fmiBoolean /*visible*/,
+    fmiBoolean /*interactive*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger /*logger*/)
+{
+    return cppfmu::AllocateUnique<StiffKinetics>(memory, memory);
+}
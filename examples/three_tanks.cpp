@@ -0,0 +1,155 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* Three water tanks, simulated as a cppfmu::CompositeSlave with the
+ * Gauss-Seidel schedule.  Tanks 0 and 2 are independent of the others, and
+ * tank 1 is connected to both of them by pipes:
+ *
+ *     tank 0  --pipe-->  tank 1  <--pipe--  tank 2
+ *
+ * Tank 1 comes after tank 0 in the order, so it sees the level tank 0 has
+ * at the end of each step, and before tank 2, so it sees the level tank 2
+ * has at the start of it.  That is also what it sees when tanks 0 and 2
+ * are stepped at once, before tank 1, as neither depends on anything.
+ *
+ * Value references:
+ *
+ *     Real 0   Inflow to tank 0 [m^3/s] (input, default 0)
+ *     Real 1   Level of tank 0 [m] (output, and initial value)
+ *     Real 2   Level of tank 1 [m] (output, and initial value)
+ *     Real 3   Level of tank 2 [m] (output, and initial value)
+ *
+ * Build it as a shared library with MODEL_IDENTIFIER=three_tanks,
+ * together with fmi_functions.cpp and cppfmu_cs.cpp.
+ */
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "cppfmu_composite.hpp"
+
+
+namespace
+{
+    /* A tank with cross section A, an inflow q, a drain with outflow k*h,
+     * and pipes with conductance c to two neighbours, whose levels are hL
+     * and hR.
+     */
+    class Tank : public cppfmu::SlaveInstance
+    {
+    public:
+        enum : fmiValueReference
+        {
+            level,          // h [m]
+            inflow,         // q [m^3/s]
+            leftLevel,      // hL [m]
+            rightLevel,     // hR [m]
+        };
+
+        Tank(fmiReal area, fmiReal drain, fmiReal pipe)
+            : m_area{area}
+            , m_drain{drain}
+            , m_pipe{pipe}
+        {
+        }
+
+        void Reset() override
+        {
+            m_h = m_q = m_hL = m_hR = 0.0;
+        }
+
+        void SetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            const fmiReal value[]) override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) Real(vr[i]) = value[i];
+        }
+
+        void GetReal(
+            const fmiValueReference vr[],
+            std::size_t nvr,
+            fmiReal value[]) const override
+        {
+            for (std::size_t i = 0; i < nvr; ++i) {
+                value[i] = Real(vr[i]);
+            }
+        }
+
+        bool DoStep(
+            fmiReal /*currentCommunicationPoint*/,
+            fmiReal communicationStepSize,
+            fmiBoolean /*newStep*/,
+            fmiReal& /*endOfStep*/) override
+        {
+            // Explicit Euler is stable for h*(k + 2c)/A < 2.
+            const auto rate = (m_drain + 2.0 * m_pipe) / m_area;
+            const auto steps = std::max(1.0, std::ceil(communicationStepSize * rate));
+            const auto dt = communicationStepSize / steps;
+            for (int s = 0; s < static_cast<int>(steps); ++s) {
+                const auto flow = m_q - m_drain * m_h
+                    + m_pipe * (m_hL - m_h) + m_pipe * (m_hR - m_h);
+                m_h = std::max(0.0, m_h + dt * flow / m_area);
+            }
+            return true;
+        }
+
+    private:
+        const fmiReal& Real(fmiValueReference vr) const
+        {
+            switch (vr) {
+                case level:      return m_h;
+                case inflow:     return m_q;
+                case leftLevel:  return m_hL;
+                case rightLevel: return m_hR;
+            }
+            throw std::out_of_range("Invalid value reference");
+        }
+
+        fmiReal& Real(fmiValueReference vr)
+        {
+            return const_cast<fmiReal&>(static_cast<const Tank&>(*this).Real(vr));
+        }
+
+        fmiReal m_area;
+        fmiReal m_drain;
+        fmiReal m_pipe;
+        fmiReal m_h = 0.0;
+        fmiReal m_q = 0.0;
+        fmiReal m_hL = 0.0;
+        fmiReal m_hR = 0.0;
+    };
+}
+
+
+cppfmu::UniquePtr<cppfmu::SlaveInstance> CppfmuInstantiateSlave(
+    fmiString  /*instanceName*/,
+    fmiString  /*fmuGUID*/,
+    fmiString  /*fmuLocation*/,
+    fmiString  /*mimeType*/,
+    fmiReal    /*timeout*/,
+    fmiBoolean /*visible*/,
+    fmiBoolean /*interactive*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger /*logger*/)
+{
+    using cppfmu::CompositeSlave;
+    using cppfmu::VariableType;
+    cppfmu::UniquePtr<cppfmu::SlaveInstance> slave =
+        cppfmu::AllocateUnique<CompositeSlave>(
+            memory, memory, CompositeSlave::Schedule::gaussSeidel);
+    auto& tanks = static_cast<CompositeSlave&>(*slave);
+    tanks.AddChild(cppfmu::AllocateUnique<Tank>(memory, 1.0, 0.1, 0.0));
+    tanks.AddChild(cppfmu::AllocateUnique<Tank>(memory, 0.5, 0.1, 0.5));
+    tanks.AddChild(cppfmu::AllocateUnique<Tank>(memory, 1.0, 0.2, 0.0));
+    tanks.Connect(VariableType::real, 0, Tank::level, 1, Tank::leftLevel);
+    tanks.Connect(VariableType::real, 2, Tank::level, 1, Tank::rightLevel);
+    tanks.Expose(VariableType::real, 0, 0, Tank::inflow);
+    for (std::size_t i = 0; i < 3; ++i) {
+        tanks.Expose(VariableType::real, static_cast<fmiValueReference>(1 + i), i, Tank::level);
+    }
+    return slave;
+}
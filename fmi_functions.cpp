@@ -3,37 +3,986 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#if CPPFMU_LOG_DRAIN_INTERVAL_MS > 0
+#   include <chrono>
+#   include <condition_variable>
+#   include <thread>
+#endif
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+#   include <chrono>
+#endif
 
 #include "cppfmu_cs.hpp"
+#include "cppfmu_extensions.h"
+#include "cppfmu_instrumentation.hpp"
+#include "cppfmu_monitor.hpp"
+#include "cppfmu_recording.hpp"
+#ifdef CPPFMU_OUT_OF_PROCESS
+#   include "cppfmu_process.hpp"
+#endif
+#ifdef CPPFMU_ENABLE_PROTOTYPES
+#   include "cppfmu_prototype.hpp"
+#endif
+#include "cppfmu_signal_bus.hpp"
+#include "cppfmu_timeline.hpp"
+#include "cppfmu_trace.hpp"
+
+
+/* If CPPFMU_INSTANCE_POOL_SIZE is nonzero, fmiFreeSlaveInstance() resets
+ * the slave and keeps the instance for reuse, rather than destroying it, and
+ * fmiInstantiateSlave() reuses a kept instance if it was created with the
+ * same arguments (except 'loggingOn').  Up to CPPFMU_INSTANCE_POOL_SIZE
+ * instances are kept, and ones which have not been reused within
+ * CPPFMU_INSTANCE_POOL_MAX_IDLE_MS milliseconds are destroyed.  See
+ * InstancePool below.
+ */
+#ifndef CPPFMU_INSTANCE_POOL_SIZE
+#   define CPPFMU_INSTANCE_POOL_SIZE 0
+#endif
+#ifndef CPPFMU_INSTANCE_POOL_MAX_IDLE_MS
+#   define CPPFMU_INSTANCE_POOL_MAX_IDLE_MS 10000
+#endif
+
+
+// Extension functions (see cppfmu_extensions.h)
+#define cppfmuGetCallStatistics fmiFullName(_cppfmuGetCallStatistics)
+#define cppfmuGetStepCounters fmiFullName(_cppfmuGetStepCounters)
+#define cppfmuGetSignalConnections fmiFullName(_cppfmuGetSignalConnections)
+#define cppfmuDrainInstancePool fmiFullName(_cppfmuDrainInstancePool)
 
 
 namespace
 {
-    // A struct that holds all the data for one model instance.
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+    /* The arguments to fmiInstantiateSlave() which an instance in the
+     * InstancePool must have been created with to be reused, apart from the
+     * instance name, which is kept by the Logger.
+     */
+    struct InstantiationArgs
+    {
+        explicit InstantiationArgs(const cppfmu::Memory& memory)
+            : fmuGUID(cppfmu::Allocator<char>{memory})
+            , fmuLocation(cppfmu::Allocator<char>{memory})
+            , mimeType(cppfmu::Allocator<char>{memory})
+        {
+        }
+
+        void Assign(
+            fmiString guid,
+            fmiString location,
+            fmiString type,
+            fmiReal timeout_,
+            fmiBoolean visible_,
+            fmiBoolean interactive_,
+            const fmiCallbackFunctions& functions_)
+        {
+            fmuGUID = NonNull(guid);
+            fmuLocation = NonNull(location);
+            mimeType = NonNull(type);
+            timeout = timeout_;
+            visible = visible_;
+            interactive = interactive_;
+            functions = functions_;
+        }
+
+        bool Matches(
+            fmiString guid,
+            fmiString location,
+            fmiString type,
+            fmiReal timeout_,
+            fmiBoolean visible_,
+            fmiBoolean interactive_,
+            const fmiCallbackFunctions& functions_) const CPPFMU_NOEXCEPT
+        {
+            return fmuGUID == NonNull(guid)
+                && fmuLocation == NonNull(location)
+                && mimeType == NonNull(type)
+                && timeout == timeout_
+                && visible == visible_
+                && interactive == interactive_
+                && functions.logger == functions_.logger
+                && functions.allocateMemory == functions_.allocateMemory
+                && functions.freeMemory == functions_.freeMemory
+                && functions.stepFinished == functions_.stepFinished;
+        }
+
+        static fmiString NonNull(fmiString s) CPPFMU_NOEXCEPT
+        {
+            return s ? s : "";
+        }
+
+        cppfmu::String fmuGUID;
+        cppfmu::String fmuLocation;
+        cppfmu::String mimeType;
+        fmiReal timeout = 0.0;
+        fmiBoolean visible = fmiFalse;
+        fmiBoolean interactive = fmiFalse;
+        fmiCallbackFunctions functions = {};
+    };
+#endif
+
+
+    /* A struct that holds all the data for one model instance.
+     *
+     * A component is created with Create(), which makes a single allocation
+     * for the struct, suitably aligned, and a copy of the instance name that
+     * follows it, and destroyed with Destroy().  The logger refers to both the name and the
+     * debug log mask, so neither needs to be allocated separately.
+     */
     struct Component
     {
-        Component(
+        static Component* Create(
             fmiString instanceName,
-            fmiCallbackFunctions callbackFunctions,
+            const fmiCallbackFunctions& callbackFunctions,
             fmiBoolean loggingOn)
-            : memory{callbackFunctions}
-            , debugLoggingEnabled{std::make_shared<bool>(loggingOn == fmiTrue)}
-            , logger{this, cppfmu::CopyString(memory, instanceName), callbackFunctions, debugLoggingEnabled}
-            , lastSuccessfulTime{std::numeric_limits<fmiReal>::quiet_NaN()}
         {
+            if (!instanceName) instanceName = "";
+            cppfmu::Memory memory{callbackFunctions};
+            const auto nameSize = std::strlen(instanceName) + 1;
+            // The simulation environment's allocator need not respect the
+            // alignment of Component, which may be that of a cache line.
+            const auto padding = alignof(Component) - 1;
+            const auto block = memory.Alloc(1, padding + sizeof(Component) + nameSize);
+            if (!block) throw std::bad_alloc();
+            const auto address = (reinterpret_cast<std::uintptr_t>(block) + padding)
+                & ~static_cast<std::uintptr_t>(padding);
+            const auto storage = reinterpret_cast<char*>(address);
+            const auto name = storage + sizeof(Component);
+            std::memcpy(name, instanceName, nameSize);
+            try {
+                const auto component =
+                    ::new(storage) Component{name, callbackFunctions, loggingOn};
+                component->m_block = block;
+                return component;
+            } catch (...) {
+                memory.Free(block);
+                throw;
+            }
+        }
+
+        static void Destroy(Component* component) CPPFMU_NOEXCEPT
+        {
+            auto memory = component->memory;
+            const auto block = component->m_block;
+            component->~Component();
+            memory.Free(block);
+        }
+
+        ~Component() CPPFMU_NOEXCEPT
+        {
+            // Destroy the slave first, so that anything it logs on its way
+            // out is delivered too.
+            slave.reset();
+            logger.FlushSuppressed();
+            logger.Flush();
         }
 
         // General
         cppfmu::Memory memory;
-        std::shared_ptr<bool> debugLoggingEnabled;
+        std::atomic<std::uint32_t> debugLogMask;
+#ifdef CPPFMU_ASYNC_LOGGING
+        cppfmu::LogQueue logQueue;
+#endif
+#if CPPFMU_FLIGHT_RECORDER_SIZE > 0
+        cppfmu::FlightRecorder flightRecorder;
+#endif
+        cppfmu::LogRateLimiter rateLimiter;
+        cppfmu::UniquePtr<cppfmu::TraceFile> trace;
         cppfmu::Logger logger;
+        cppfmu::UniquePtr<cppfmu::CallRecording> recording;
+        cppfmu::UniquePtr<cppfmu::OutputMonitor> monitor;
 
         // Co-simulation
         cppfmu::UniquePtr<cppfmu::SlaveInstance> slave;
         fmiReal lastSuccessfulTime;
+
+#ifdef CPPFMU_ENABLE_STATISTICS
+        cppfmu::CallStatistics statistics;
+#endif
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+        cppfmu::StepCounters stepCounters;
+#endif
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+        cppfmu::VariableProfile variableProfile;
+#endif
+
+#if CPPFMU_LOG_DRAIN_INTERVAL_MS > 0
+        // Links in the LogDrainThread's list of components
+        Component* prevDrained = nullptr;
+        Component* nextDrained = nullptr;
+#endif
+
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+        InstantiationArgs instantiationArgs;
+        bool failed = false; // whether an FMI function has failed
+        std::chrono::steady_clock::time_point parkedSince;
+#endif
+
+    private:
+        // 'instanceName' must outlive the component.  Use Create() instead.
+        Component(
+            fmiString instanceName,
+            const fmiCallbackFunctions& callbackFunctions,
+            fmiBoolean loggingOn)
+            : memory{callbackFunctions}
+            , debugLogMask{loggingOn == fmiTrue ? cppfmu::allLogCategories : 0u}
+#ifdef CPPFMU_ASYNC_LOGGING
+            , logQueue{memory, CPPFMU_LOG_QUEUE_CAPACITY}
+#endif
+#if CPPFMU_FLIGHT_RECORDER_SIZE > 0
+            , flightRecorder{memory, CPPFMU_FLIGHT_RECORDER_SIZE}
+#endif
+            , trace{cppfmu::TraceFile::Create(memory, std::getenv("CPPFMU_TRACE_DIR"), instanceName)}
+            , logger{this, instanceName, callbackFunctions, &debugLogMask, LogQueueIfAny(), FlightRecorderIfAny(), &rateLimiter, trace.get()}
+            , lastSuccessfulTime{std::numeric_limits<fmiReal>::quiet_NaN()}
+#ifdef CPPFMU_ENABLE_STATISTICS
+            , statistics{memory}
+#endif
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+            , stepCounters{memory}
+#endif
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+            , variableProfile{memory}
+#endif
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+            , instantiationArgs{memory}
+#endif
+        {
+        }
+
+        cppfmu::LogQueue* LogQueueIfAny() CPPFMU_NOEXCEPT
+        {
+#ifdef CPPFMU_ASYNC_LOGGING
+            return &logQueue;
+#else
+            return nullptr;
+#endif
+        }
+
+        cppfmu::FlightRecorder* FlightRecorderIfAny() CPPFMU_NOEXCEPT
+        {
+#if CPPFMU_FLIGHT_RECORDER_SIZE > 0
+            return &flightRecorder;
+#else
+            return nullptr;
+#endif
+        }
+
+        void* m_block = nullptr; // the allocation which holds the component
     };
+
+    struct ComponentDeleter
+    {
+        void operator()(Component* component) const CPPFMU_NOEXCEPT
+        {
+            Component::Destroy(component);
+        }
+    };
+
+    using ComponentPtr = std::unique_ptr<Component, ComponentDeleter>;
+
+
+#if CPPFMU_LOG_DRAIN_INTERVAL_MS > 0
+    /* A background thread which periodically flushes the loggers of all
+     * registered components.  The thread runs for as long as there are
+     * components registered, and the list is intrusive, so that no memory
+     * needs to be allocated for it.
+     */
+    class LogDrainThread
+    {
+    public:
+        static void Register(Component* component)
+        {
+            auto& self = Instance();
+            std::lock_guard<std::mutex> lock{self.m_mutex};
+            component->prevDrained = nullptr;
+            component->nextDrained = self.m_head;
+            if (self.m_head) self.m_head->prevDrained = component;
+            self.m_head = component;
+            if (!self.m_thread.joinable()) {
+                self.m_thread =
+                    std::thread{&LogDrainThread::Run, &self, self.m_generation};
+            }
+        }
+
+        static void Unregister(Component* component) CPPFMU_NOEXCEPT
+        {
+            auto& self = Instance();
+            std::unique_lock<std::mutex> lock{self.m_mutex};
+            if (component->prevDrained) {
+                component->prevDrained->nextDrained = component->nextDrained;
+            } else {
+                self.m_head = component->nextDrained;
+            }
+            if (component->nextDrained) {
+                component->nextDrained->prevDrained = component->prevDrained;
+            }
+            // A pooled component may be registered again later.
+            component->prevDrained = nullptr;
+            component->nextDrained = nullptr;
+            if (!self.m_head && self.m_thread.joinable()) {
+                // A new thread may be started before this one has finished,
+                // so each thread is told to stop by a change of generation.
+                ++self.m_generation;
+                self.m_wakeUp.notify_all();
+                auto thread = std::move(self.m_thread);
+                lock.unlock();
+                thread.join();
+            }
+        }
+
+    private:
+        static LogDrainThread& Instance()
+        {
+            // Never destroyed, since the thread is still running if the host
+            // exits with instances allocated, and destroying a joinable
+            // std::thread calls std::terminate().
+            static auto instance = new LogDrainThread;
+            return *instance;
+        }
+
+        void Run(unsigned generation)
+        {
+            const auto interval =
+                std::chrono::milliseconds(CPPFMU_LOG_DRAIN_INTERVAL_MS);
+            const auto stop = [&] { return m_generation != generation; };
+            std::unique_lock<std::mutex> lock{m_mutex};
+            while (!m_wakeUp.wait_for(lock, interval, stop)) {
+                for (auto c = m_head; c; c = c->nextDrained) c->logger.Flush();
+            }
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_wakeUp;
+        std::thread m_thread;
+        Component* m_head = nullptr;
+        unsigned m_generation = 0;
+    };
+#endif
+
+
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+    /* Instances which the simulation environment has freed, and which are
+     * kept for reuse by fmiInstantiateSlave().  When the pool is full, the
+     * instance which was parked first is destroyed to make room.  Instances
+     * which have been parked for longer than CPPFMU_INSTANCE_POOL_MAX_IDLE_MS
+     * are destroyed whenever an instance is parked or taken.
+     *
+     * A parked instance keeps everything its slave holds, like memory and
+     * files.  Instances which are attached to the SignalBus are not parked,
+     * as their signals would stay taken.
+     *
+     * The pool does not destroy the instances it holds when the library is
+     * unloaded, since the simulation environment's callbacks may no longer
+     * be valid then.  They are leaked instead, unless the simulation
+     * environment calls cppfmuDrainInstancePool() first.
+     */
+    class InstancePool
+    {
+    public:
+        static InstancePool& Instance()
+        {
+            // Never destroyed; see above.
+            static auto instance = new InstancePool;
+            return *instance;
+        }
+
+        // Destroys all the parked instances, and returns their number.
+        std::size_t Drain() CPPFMU_NOEXCEPT
+        {
+            Component* drained[CPPFMU_INSTANCE_POOL_SIZE];
+            std::size_t count = 0;
+            {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                count = m_count;
+                for (std::size_t i = 0; i < count; ++i) drained[i] = m_parked[i];
+                m_count = 0;
+            }
+            for (std::size_t i = 0; i < count; ++i) Component::Destroy(drained[i]);
+            return count;
+        }
+
+        // Adds 'component', whose slave has been reset, to the pool.
+        void Park(Component* component) CPPFMU_NOEXCEPT
+        {
+            const auto now = std::chrono::steady_clock::now();
+            component->parkedSince = now;
+            Component* expired[CPPFMU_INSTANCE_POOL_SIZE];
+            std::size_t expiredCount = 0;
+            {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                expiredCount = Trim(now, expired);
+                if (m_count == CPPFMU_INSTANCE_POOL_SIZE) {
+                    expired[expiredCount++] = Remove(0);
+                }
+                m_parked[m_count++] = component;
+            }
+            for (std::size_t i = 0; i < expiredCount; ++i) {
+                Component::Destroy(expired[i]);
+            }
+        }
+
+        /* Removes and returns an instance which was created with the given
+         * arguments, preferring the one parked last, or returns null if
+         * there is none.
+         */
+        ComponentPtr Take(
+            fmiString instanceName,
+            fmiString fmuGUID,
+            fmiString fmuLocation,
+            fmiString mimeType,
+            fmiReal timeout,
+            fmiBoolean visible,
+            fmiBoolean interactive,
+            const fmiCallbackFunctions& functions)
+        {
+            const auto name = InstantiationArgs::NonNull(instanceName);
+            Component* expired[CPPFMU_INSTANCE_POOL_SIZE];
+            std::size_t expiredCount = 0;
+            Component* found = nullptr;
+            {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                expiredCount = Trim(std::chrono::steady_clock::now(), expired);
+                for (auto i = m_count; i-- > 0; ) {
+                    const auto c = m_parked[i];
+                    if (std::strcmp(c->logger.InstanceName(), name) == 0
+                            && c->instantiationArgs.Matches(fmuGUID, fmuLocation,
+                                mimeType, timeout, visible, interactive, functions)) {
+                        found = Remove(i);
+                        break;
+                    }
+                }
+            }
+            for (std::size_t i = 0; i < expiredCount; ++i) {
+                Component::Destroy(expired[i]);
+            }
+            if (!found) return nullptr;
+            return ComponentPtr{found};
+        }
+
+    private:
+        InstancePool() = default;
+
+        /* Removes the components which have been idle for too long, which
+         * are the first ones, and stores them in 'expired'.  Returns their
+         * number.
+         */
+        std::size_t Trim(
+            std::chrono::steady_clock::time_point now,
+            Component** expired) CPPFMU_NOEXCEPT
+        {
+            const auto maxIdle =
+                std::chrono::milliseconds(CPPFMU_INSTANCE_POOL_MAX_IDLE_MS);
+            std::size_t n = 0;
+            while (n < m_count && now - m_parked[n]->parkedSince > maxIdle) {
+                expired[n] = m_parked[n];
+                ++n;
+            }
+            for (std::size_t i = n; i < m_count; ++i) m_parked[i - n] = m_parked[i];
+            m_count -= n;
+            return n;
+        }
+
+        Component* Remove(std::size_t index) CPPFMU_NOEXCEPT
+        {
+            const auto c = m_parked[index];
+            for (auto i = index + 1; i < m_count; ++i) m_parked[i - 1] = m_parked[i];
+            --m_count;
+            return c;
+        }
+
+        std::mutex m_mutex;
+        Component* m_parked[CPPFMU_INSTANCE_POOL_SIZE] = {}; // oldest first
+        std::size_t m_count = 0;
+    };
+
+
+    /* Resets the slave of a component which the simulation environment is
+     * freeing, and parks the component in the InstancePool.  Returns false,
+     * and leaves the component alone, if it is not fit for reuse.
+     */
+    bool Park(Component* component) CPPFMU_NOEXCEPT
+    {
+        if (component->failed) return false;
+        // Its signals would otherwise stay taken while it is parked.
+        auto& bus = cppfmu::SignalBus::Instance();
+        if (bus.IsAttached(component->logger.InstanceName())) return false;
+        try {
+            component->slave->Reset();
+        } catch (const std::exception& e) {
+            component->logger.LogFormatted(fmiWarning, "cppfmu",
+                "Instance not kept for reuse, as it could not be reset: {}", e.what());
+            return false;
+        }
+        component->recording.reset();
+        component->monitor.reset();
+        component->logger.FlushSuppressed();
+        component->logger.Flush();
+        InstancePool::Instance().Park(component);
+        return true;
+    }
+
+
+    // Prepares a component from the InstancePool for reuse.
+    void Unpark(Component* component, fmiBoolean loggingOn) CPPFMU_NOEXCEPT
+    {
+        component->logger.SetDebugLogMask(
+            loggingOn == fmiTrue ? cppfmu::allLogCategories : 0u);
+        component->lastSuccessfulTime = std::numeric_limits<fmiReal>::quiet_NaN();
+        component->failed = false;
+#ifdef CPPFMU_ENABLE_STATISTICS
+        component->statistics.Reset();
+#endif
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+        component->stepCounters.Reset();
+#endif
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+        component->variableProfile.Reset();
+#endif
+#if CPPFMU_FLIGHT_RECORDER_SIZE > 0
+        // Messages from the instance's previous life would only confuse.
+        component->flightRecorder.Clear();
+#endif
+    }
+#endif
+
+
+    /* An object of this type is created on entry to each FMI function which
+     * operates on an existing component, and takes care of the things that
+     * need to be done whenever the function returns.  'elements' is the
+     * number of variables transferred by the call, if any, and 'time' and
+     * 'stepSize' are the communication point and step size of calls which
+     * have them.  Otherwise, 'time' is the last successful time.
+     * 'startTime' is the MonotonicNanoseconds() at which the call started, if
+     * that was before the scope was created, or 0.
+     */
+    class CallScope
+    {
+    public:
+        CallScope(
+            Component* component,
+            cppfmu::FmiFunction function,
+            std::size_t elements = 0,
+            fmiReal time = std::numeric_limits<fmiReal>::quiet_NaN(),
+            fmiReal stepSize = 0.0,
+            std::uint64_t startTime = 0) CPPFMU_NOEXCEPT
+            : m_component{component}
+#ifdef CPPFMU_ENABLE_TIMELINE
+            , m_timelineScope{
+                cppfmu::FmiFunctionName(function),
+                component->logger.InstanceName(),
+                "fmi"}
+#endif
+#if defined(CPPFMU_ENABLE_STATISTICS) || defined(CPPFMU_ENABLE_USDT)
+            , m_function{function}
+            , m_elements{elements}
+#endif
+#ifdef CPPFMU_ENABLE_USDT
+            , m_time{std::isnan(time) ? component->lastSuccessfulTime : time}
+            , m_stepSize{stepSize}
+#endif
+#ifdef CPPFMU_ENABLE_STATISTICS
+            , m_startTime{startTime != 0 ? startTime : cppfmu::MonotonicNanoseconds()}
+#endif
+        {
+#if !defined(CPPFMU_ENABLE_STATISTICS) && !defined(CPPFMU_ENABLE_USDT)
+            (void) function;
+            (void) elements;
+#endif
+#ifndef CPPFMU_ENABLE_USDT
+            (void) time;
+            (void) stepSize;
+#endif
+#ifndef CPPFMU_ENABLE_STATISTICS
+            (void) startTime;
+#endif
+            CPPFMU_PROBE(fmi_entry,
+                cppfmu::FmiFunctionName(m_function),
+                m_component->logger.InstanceName(),
+                m_time,
+                m_stepSize,
+                m_elements);
+        }
+
+        ~CallScope() CPPFMU_NOEXCEPT
+        {
+            // The time spent by the host on logging is not part of the call.
+#ifdef CPPFMU_ENABLE_STATISTICS
+            m_component->statistics.Record(
+                m_function,
+                cppfmu::MonotonicNanoseconds() - m_startTime,
+                m_elements);
+#endif
+            m_component->logger.Flush();
+            CPPFMU_PROBE(fmi_return,
+                cppfmu::FmiFunctionName(m_function),
+                m_component->logger.InstanceName(),
+                m_time,
+                m_stepSize,
+                m_elements);
+        }
+
+        CallScope(const CallScope&) = delete;
+        CallScope& operator=(const CallScope&) = delete;
+
+    private:
+        Component* m_component;
+#ifdef CPPFMU_ENABLE_TIMELINE
+        cppfmu::TimelineScope m_timelineScope;
+#endif
+#if defined(CPPFMU_ENABLE_STATISTICS) || defined(CPPFMU_ENABLE_USDT)
+        cppfmu::FmiFunction m_function;
+        std::size_t m_elements;
+#endif
+#ifdef CPPFMU_ENABLE_USDT
+        fmiReal m_time;
+        fmiReal m_stepSize;
+#endif
+#ifdef CPPFMU_ENABLE_STATISTICS
+        std::uint64_t m_startTime;
+#endif
+    };
+
+
+#if defined(CPPFMU_ENABLE_STATISTICS) || defined(CPPFMU_ENABLE_PERF_COUNTERS)
+    /* Writes one line of statistics to 'file', or logs it if 'file' is null.
+     * 'unit' is "ns" for durations, or the name of a hardware event.
+     */
+    void ReportStatisticsLine(
+        cppfmu::Logger& logger,
+        std::FILE* file,
+        const char* function,
+        const char* unit,
+        std::uint64_t calls,
+        std::uint64_t elements,
+        std::uint64_t total,
+        const cppfmu::LatencyHistogram& histogram) CPPFMU_NOEXCEPT
+    {
+        const auto mean = total / calls;
+        if (file) {
+            std::fprintf(file, "\"%s\",%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                logger.InstanceName(),
+                function,
+                unit,
+                static_cast<unsigned long long>(calls),
+                static_cast<unsigned long long>(elements),
+                static_cast<unsigned long long>(total),
+                static_cast<unsigned long long>(histogram.Min()),
+                static_cast<unsigned long long>(mean),
+                static_cast<unsigned long long>(histogram.Quantile(0.5)),
+                static_cast<unsigned long long>(histogram.Quantile(0.9)),
+                static_cast<unsigned long long>(histogram.Quantile(0.99)),
+                static_cast<unsigned long long>(histogram.Quantile(0.999)),
+                static_cast<unsigned long long>(histogram.Max()));
+        } else {
+            logger.LogFormatted(fmiOK, "cppfmu",
+                "{} [{}]: {} calls, {} elements, mean {}, p50 {}, p90 {}, p99 {}, max {}",
+                function,
+                unit,
+                calls,
+                elements,
+                mean,
+                histogram.Quantile(0.5),
+                histogram.Quantile(0.9),
+                histogram.Quantile(0.99),
+                histogram.Max());
+        }
+    }
+
+
+    /* Reports the statistics of a component which is about to be freed,
+     * either by appending them to the file named by the CPPFMU_STATISTICS_FILE
+     * environment variable, or by logging them.
+     */
+    void ReportStatistics(Component* component) CPPFMU_NOEXCEPT
+    {
+        auto& logger = component->logger;
+        const auto path = std::getenv("CPPFMU_STATISTICS_FILE");
+        std::FILE* file = nullptr;
+        if (path && *path != '\0') {
+            file = std::fopen(path, "a");
+            if (!file) {
+                logger.LogFormatted(fmiWarning, "cppfmu",
+                    "Cannot open statistics file {}", path);
+            } else if (std::fseek(file, 0, SEEK_END) == 0 && std::ftell(file) == 0) {
+                std::fprintf(file, "instance,function,unit,calls,elements,total,"
+                    "min,mean,p50,p90,p99,p999,max\n");
+            }
+        }
+#ifdef CPPFMU_ENABLE_STATISTICS
+        for (std::size_t i = 0; i < static_cast<std::size_t>(cppfmu::FmiFunction::count); ++i) {
+            const auto function = static_cast<cppfmu::FmiFunction>(i);
+            const auto& s = component->statistics[function];
+            if (s.calls == 0) continue;
+            ReportStatisticsLine(logger, file,
+                cppfmu::FmiFunctionName(function), "ns",
+                s.calls, s.elements, s.totalTime, s.latency);
+        }
+#endif
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+        const auto& counters = component->stepCounters;
+        for (std::size_t i = 0; i < static_cast<std::size_t>(cppfmu::PerfEvent::count); ++i) {
+            const auto event = static_cast<cppfmu::PerfEvent>(i);
+            if (!counters.IsCounted(event)) continue;
+            ReportStatisticsLine(logger, file,
+                cppfmu::FmiFunctionName(cppfmu::FmiFunction::doStep),
+                cppfmu::PerfEventName(event),
+                counters.Steps(), 0, counters.Total(event), counters.Histogram(event));
+        }
+#endif
+        if (file) std::fclose(file);
+    }
+#endif
+
+
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+    /* Reports the variable profile of a component which is about to be
+     * freed, either by appending it to the file named by the
+     * CPPFMU_VARIABLE_PROFILE_FILE environment variable, or by logging a
+     * summary per variable type and the variables with the most redundant
+     * transfers.
+     */
+    void ReportVariableProfile(Component* component) CPPFMU_NOEXCEPT
+    {
+        auto& logger = component->logger;
+        const auto& profile = component->variableProfile;
+        if (profile.Incomplete()) {
+            logger.Log(fmiWarning, "cppfmu",
+                "The variable profile is incomplete due to lack of memory");
+        }
+
+        const auto path = std::getenv("CPPFMU_VARIABLE_PROFILE_FILE");
+        if (path && *path != '\0') {
+            const auto file = std::fopen(path, "a");
+            if (file) {
+                if (std::fseek(file, 0, SEEK_END) == 0 && std::ftell(file) == 0) {
+                    std::fprintf(file, "instance,type,vr,writes,unchanged_writes,"
+                        "reads,unchanged_reads\n");
+                }
+                profile.ForEach([&] (
+                    cppfmu::VariableType type,
+                    fmiValueReference vr,
+                    const cppfmu::VariableProfile::Counters& c)
+                {
+                    std::fprintf(file, "\"%s\",%s,%lu,%llu,%llu,%llu,%llu\n",
+                        logger.InstanceName(),
+                        cppfmu::VariableTypeName(type),
+                        static_cast<unsigned long>(vr),
+                        static_cast<unsigned long long>(c.writes),
+                        static_cast<unsigned long long>(c.unchangedWrites),
+                        static_cast<unsigned long long>(c.reads),
+                        static_cast<unsigned long long>(c.unchangedReads));
+                });
+                std::fclose(file);
+                return;
+            }
+            logger.LogFormatted(fmiWarning, "cppfmu",
+                "Cannot open variable profile file {}", path);
+        }
+
+        const std::size_t typeCount = static_cast<std::size_t>(cppfmu::VariableType::count);
+        struct Total { std::uint64_t variables, writes, unchangedWrites, reads, unchangedReads; };
+        Total totals[typeCount] = {};
+
+        struct Hot { cppfmu::VariableType type; fmiValueReference vr; std::uint64_t redundant, total; };
+        const std::size_t hotCount = 10;
+        Hot hot[hotCount] = {};
+        std::size_t hotSize = 0;
+
+        profile.ForEach([&] (
+            cppfmu::VariableType type,
+            fmiValueReference vr,
+            const cppfmu::VariableProfile::Counters& c)
+        {
+            auto& t = totals[static_cast<std::size_t>(type)];
+            ++t.variables;
+            t.writes += c.writes;
+            t.unchangedWrites += c.unchangedWrites;
+            t.reads += c.reads;
+            t.unchangedReads += c.unchangedReads;
+
+            // Keep the 'hotCount' variables with the most redundant transfers,
+            // sorted in descending order.
+            const auto redundant = c.unchangedWrites + c.unchangedReads;
+            if (redundant == 0) return;
+            if (hotSize == hotCount && redundant <= hot[hotCount - 1].redundant) return;
+            auto i = hotSize < hotCount ? hotSize++ : hotCount - 1;
+            for (; i > 0 && hot[i - 1].redundant < redundant; --i) hot[i] = hot[i - 1];
+            hot[i] = Hot{type, vr, redundant, c.writes + c.reads};
+        });
+
+        for (std::size_t i = 0; i < typeCount; ++i) {
+            const auto& t = totals[i];
+            if (t.variables == 0) continue;
+            logger.LogFormatted(fmiOK, "cppfmu",
+                "{} variables: {} transferred, {} writes ({} unchanged), {} reads ({} unchanged)",
+                cppfmu::VariableTypeName(static_cast<cppfmu::VariableType>(i)),
+                t.variables, t.writes, t.unchangedWrites, t.reads, t.unchangedReads);
+        }
+        for (std::size_t i = 0; i < hotSize; ++i) {
+            logger.LogFormatted(fmiOK, "cppfmu",
+                "{} variable {}: {} of {} transfers were redundant",
+                cppfmu::VariableTypeName(hot[i].type),
+                hot[i].vr,
+                hot[i].redundant,
+                hot[i].total);
+        }
+    }
+#endif
+
+
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+    // Counts hardware events for the duration of a SlaveInstance::DoStep() call.
+    class StepCounterScope
+    {
+    public:
+        explicit StepCounterScope(Component* component) CPPFMU_NOEXCEPT
+            : m_counters(component->stepCounters)
+        {
+            const auto error = m_counters.Start();
+            if (error != 0) {
+                component->logger.LogFormatted(fmiWarning, "cppfmu",
+                    "Hardware performance counters are not (all) available: {}",
+                    std::strerror(error));
+            }
+        }
+
+        ~StepCounterScope() CPPFMU_NOEXCEPT
+        {
+            m_counters.Stop();
+        }
+
+        StepCounterScope(const StepCounterScope&) = delete;
+        StepCounterScope& operator=(const StepCounterScope&) = delete;
+
+    private:
+        cppfmu::StepCounters& m_counters;
+    };
+#endif
+
+
+    /* Logs the message of an exception which caused an FMI function to fail
+     * with 'status', preceded by the debug messages which led up to it.
+     */
+    void LogError(Component* component, fmiStatus status, fmiString message)
+        CPPFMU_NOEXCEPT
+    {
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+        component->failed = true;
+#endif
+        component->logger.DumpFlightRecorder();
+        component->logger.LogFormatted(status, "", "{}", message);
+    }
+
+
+    /* Creates the output monitor of an instance, if the
+     * CPPFMU_MONITOR_VARIABLES environment variable is set (see
+     * cppfmu_monitor.hpp).  Monitoring is not essential to the simulation,
+     * so failures are logged as warnings.
+     */
+    void StartMonitoring(Component* component) CPPFMU_NOEXCEPT
+    {
+        try {
+            component->monitor = cppfmu::OutputMonitor::Create(
+                component->memory,
+                std::getenv("CPPFMU_MONITOR_VARIABLES"),
+                component->logger.InstanceName());
+            if (component->monitor) {
+                component->logger.LogFormatted(fmiOK, "cppfmu",
+                    "Publishing {} outputs in shared memory object {}",
+                    component->monitor->VariableCount(),
+                    component->monitor->Name());
+            }
+        } catch (const std::exception& e) {
+            component->logger.LogFormatted(fmiWarning, "cppfmu",
+                "Output monitoring disabled: {}", e.what());
+        }
+    }
+
+
+    // Publishes the monitored outputs, if any, after a successful time step.
+    void PublishOutputs(Component* component, fmiReal time) CPPFMU_NOEXCEPT
+    {
+        if (!component->monitor) return;
+        try {
+            component->monitor->Publish(time,
+                [component] (const fmiValueReference vr[], std::size_t nvr, fmiReal value[]) {
+                    component->slave->GetReal(vr, nvr, value);
+                });
+        } catch (const std::exception& e) {
+            component->logger.LogFormatted(fmiWarning, "cppfmu",
+                "Output monitoring stopped: {}", e.what());
+            component->monitor.reset();
+        }
+    }
+
+
+    // Records a call, if recording is enabled (see cppfmu_recording.hpp).
+    template<typename... Args>
+    void Record(
+        Component* component,
+        cppfmu::FmiFunction function,
+        std::size_t count,
+        const Args&... args) CPPFMU_NOEXCEPT
+    {
+        if (component->recording) {
+            component->recording->Record(function, count, args...);
+        }
+    }
+
+
+    template<typename T>
+    cppfmu::CallRecording::ArrayArg<T> Array(const T* data, std::size_t size)
+        CPPFMU_NOEXCEPT
+    {
+        return cppfmu::CallRecording::Array(data, size);
+    }
+
+
+    /* Counts the variables transferred by a successful fmiGetXxx() or
+     * fmiSetXxx() call, if CPPFMU_ENABLE_VARIABLE_PROFILE is defined.
+     */
+    template<typename T>
+    void ProfileReads(
+        Component* component,
+        cppfmu::VariableType type,
+        const fmiValueReference vr[],
+        std::size_t nvr,
+        const T value[]) CPPFMU_NOEXCEPT
+    {
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+        component->variableProfile.RecordReads(type, vr, nvr, value);
+#else
+        (void) component; (void) type; (void) vr; (void) nvr; (void) value;
+#endif
+    }
+
+    template<typename T>
+    void ProfileWrites(
+        Component* component,
+        cppfmu::VariableType type,
+        const fmiValueReference vr[],
+        std::size_t nvr,
+        const T value[]) CPPFMU_NOEXCEPT
+    {
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+        component->variableProfile.RecordWrites(type, vr, nvr, value);
+#else
+        (void) component; (void) type; (void) vr; (void) nvr; (void) value;
+#endif
+    }
 }
 
 
@@ -59,12 +1008,19 @@ DllExport fmiComponent fmiInstantiateSlave(
     fmiCallbackFunctions functions,
     fmiBoolean loggingOn)
 {
+#ifdef CPPFMU_ENABLE_TIMELINE
+    cppfmu::Timeline::Open(std::getenv("CPPFMU_TIMELINE_DIR"));
+#endif
+#ifdef CPPFMU_ENABLE_STATISTICS
+    // The creation of the component is part of the call, too.
+    const auto startTime = cppfmu::MonotonicNanoseconds();
+#else
+    const std::uint64_t startTime = 0;
+#endif
     try {
-        auto component = cppfmu::AllocateUnique<Component>(cppfmu::Memory{functions},
-            instanceName,
-            functions,
-            loggingOn);
-        component->slave = CppfmuInstantiateSlave(
+        ComponentPtr component;
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+        component = InstancePool::Instance().Take(
             instanceName,
             fmuGUID,
             fmuLocation,
@@ -72,8 +1028,108 @@ DllExport fmiComponent fmiInstantiateSlave(
             timeout,
             visible,
             interactive,
+            functions);
+        if (component) Unpark(component.get(), loggingOn);
+#endif
+        if (!component) {
+            component.reset(Component::Create(instanceName, functions, loggingOn));
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+            component->instantiationArgs.Assign(
+                fmuGUID,
+                fmuLocation,
+                mimeType,
+                timeout,
+                visible,
+                interactive,
+                functions);
+#endif
+        }
+        CallScope scope{
+            component.get(),
+            cppfmu::FmiFunction::instantiateSlave,
+            0,
+            std::numeric_limits<fmiReal>::quiet_NaN(),
+            0.0,
+            startTime};
+        component->recording = cppfmu::CallRecording::Create(
             component->memory,
-            component->logger);
+            std::getenv("CPPFMU_RECORD_DIR"),
+            instanceName,
+            fmuGUID,
+            fmuLocation,
+            mimeType,
+            timeout,
+            visible,
+            interactive,
+            loggingOn,
+            std::getenv("CPPFMU_RECORD_SYNC") != nullptr);
+        // A recycled instance already has a slave.
+        if (!component->slave) {
+#ifdef CPPFMU_OUT_OF_PROCESS
+            component->slave = cppfmu::RemoteSlave::Create(
+                component->memory,
+                component->logger,
+                component->debugLogMask,
+                [&] (cppfmu::Memory memory, cppfmu::Logger logger) {
+                    return CppfmuInstantiateSlave(
+                        instanceName,
+                        fmuGUID,
+                        fmuLocation,
+                        mimeType,
+                        timeout,
+                        visible,
+                        interactive,
+                        memory,
+                        logger);
+                });
+#elif defined(CPPFMU_ENABLE_PROTOTYPES)
+            auto& prototypes = cppfmu::PrototypeCache::Instance();
+            component->slave = prototypes.Clone(
+                fmuGUID,
+                fmuLocation,
+                mimeType,
+                timeout,
+                visible,
+                interactive,
+                component->memory,
+                component->logger);
+            if (!component->slave) {
+                component->slave = CppfmuInstantiateSlave(
+                    instanceName,
+                    fmuGUID,
+                    fmuLocation,
+                    mimeType,
+                    timeout,
+                    visible,
+                    interactive,
+                    component->memory,
+                    component->logger);
+                prototypes.Add(
+                    fmuGUID,
+                    fmuLocation,
+                    mimeType,
+                    timeout,
+                    visible,
+                    interactive,
+                    *component->slave);
+            }
+#else
+            component->slave = CppfmuInstantiateSlave(
+                instanceName,
+                fmuGUID,
+                fmuLocation,
+                mimeType,
+                timeout,
+                visible,
+                interactive,
+                component->memory,
+                component->logger);
+#endif
+        }
+        StartMonitoring(component.get());
+#if CPPFMU_LOG_DRAIN_INTERVAL_MS > 0
+        LogDrainThread::Register(component.get());
+#endif
         return component.release();
     } catch (const cppfmu::FatalError& e) {
         functions.logger(nullptr, instanceName, fmiFatal, "", e.what());
@@ -88,10 +1144,42 @@ DllExport fmiComponent fmiInstantiateSlave(
 DllExport void fmiFreeSlaveInstance(fmiComponent c)
 {
     const auto component = reinterpret_cast<Component*>(c);
-    // The Component object was allocated using cppfmu::AllocateUnique(),
-    // which uses cppfmu::New() internally, so we use cppfmu::Delete() to
-    // release it again.
-    cppfmu::Delete(component->memory, component);
+    CPPFMU_PROBE(fmi_entry,
+        cppfmu::FmiFunctionName(cppfmu::FmiFunction::freeSlaveInstance),
+        component->logger.InstanceName(),
+        component->lastSuccessfulTime,
+        0.0,
+        std::size_t{0});
+#if CPPFMU_LOG_DRAIN_INTERVAL_MS > 0
+    LogDrainThread::Unregister(component);
+#endif
+#if defined(CPPFMU_ENABLE_STATISTICS) || defined(CPPFMU_ENABLE_PERF_COUNTERS)
+    ReportStatistics(component);
+#endif
+#ifdef CPPFMU_ENABLE_VARIABLE_PROFILE
+    ReportVariableProfile(component);
+#endif
+    if (component->recording && !component->recording->Good()) {
+        component->logger.Log(fmiWarning, "cppfmu",
+            "The call recording is incomplete due to a write error");
+    }
+#ifdef CPPFMU_ENABLE_TIMELINE
+    // The buffered events may refer to the instance name.
+    cppfmu::Timeline::Flush();
+#endif
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+    if (!Park(component))
+#endif
+    {
+        Component::Destroy(component);
+    }
+    // The instance name is gone by now.
+    CPPFMU_PROBE(fmi_return,
+        cppfmu::FmiFunctionName(cppfmu::FmiFunction::freeSlaveInstance),
+        "",
+        std::numeric_limits<fmiReal>::quiet_NaN(),
+        0.0,
+        std::size_t{0});
 }
 
 
@@ -102,14 +1190,17 @@ DllExport fmiStatus fmiInitializeSlave(
     fmiReal      tStop)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::initializeSlave, 0, tStart};
+    Record(component, cppfmu::FmiFunction::initializeSlave, 0, tStart, tStop, stopTimeDefined);
     try {
+        if (component->trace) component->trace->SetSimulationTime(tStart);
         component->slave->Initialize(tStart, stopTimeDefined, tStop);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -118,14 +1209,16 @@ DllExport fmiStatus fmiInitializeSlave(
 DllExport fmiStatus fmiResetSlave(fmiComponent c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::resetSlave};
+    Record(component, cppfmu::FmiFunction::resetSlave, 0);
     try {
         component->slave->Reset();
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -134,14 +1227,17 @@ DllExport fmiStatus fmiResetSlave(fmiComponent c)
 DllExport fmiStatus fmiTerminateSlave(fmiComponent c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::terminateSlave};
+    Record(component, cppfmu::FmiFunction::terminateSlave, 0);
     try {
         component->slave->Terminate();
+        component->logger.FlushSuppressed();
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -151,7 +1247,11 @@ DllExport fmiStatus fmiSetDebugLogging(
     fmiComponent c,
     fmiBoolean loggingOn)
 {
-    *(reinterpret_cast<Component*>(c)->debugLoggingEnabled) = (loggingOn == fmiTrue);
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::setDebugLogging};
+    Record(component, cppfmu::FmiFunction::setDebugLogging, 0, loggingOn);
+    component->logger.SetDebugLogMask(
+        loggingOn == fmiTrue ? cppfmu::allLogCategories : 0u);
     return fmiOK;
 }
 
@@ -163,14 +1263,17 @@ DllExport fmiStatus fmiGetReal(
     fmiReal value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getReal, nvr};
+    Record(component, cppfmu::FmiFunction::getReal, nvr, Array(vr, nvr));
     try {
         component->slave->GetReal(vr, nvr, value);
+        ProfileReads(component, cppfmu::VariableType::real, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -182,14 +1285,17 @@ DllExport fmiStatus fmiGetInteger(
     fmiInteger value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getInteger, nvr};
+    Record(component, cppfmu::FmiFunction::getInteger, nvr, Array(vr, nvr));
     try {
         component->slave->GetInteger(vr, nvr, value);
+        ProfileReads(component, cppfmu::VariableType::integer, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -201,14 +1307,17 @@ DllExport fmiStatus fmiGetBoolean(
     fmiBoolean value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getBoolean, nvr};
+    Record(component, cppfmu::FmiFunction::getBoolean, nvr, Array(vr, nvr));
     try {
         component->slave->GetBoolean(vr, nvr, value);
+        ProfileReads(component, cppfmu::VariableType::boolean, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -220,14 +1329,17 @@ DllExport fmiStatus fmiGetString(
     fmiString value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getString, nvr};
+    Record(component, cppfmu::FmiFunction::getString, nvr, Array(vr, nvr));
     try {
         component->slave->GetString(vr, nvr, value);
+        ProfileReads(component, cppfmu::VariableType::string, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -240,14 +1352,17 @@ DllExport fmiStatus fmiSetReal(
     const fmiReal value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::setReal, nvr};
+    Record(component, cppfmu::FmiFunction::setReal, nvr, Array(vr, nvr), Array(value, nvr));
     try {
         component->slave->SetReal(vr, nvr, value);
+        ProfileWrites(component, cppfmu::VariableType::real, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -259,14 +1374,17 @@ DllExport fmiStatus fmiSetInteger(
     const fmiInteger value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::setInteger, nvr};
+    Record(component, cppfmu::FmiFunction::setInteger, nvr, Array(vr, nvr), Array(value, nvr));
     try {
         component->slave->SetInteger(vr, nvr, value);
+        ProfileWrites(component, cppfmu::VariableType::integer, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -274,14 +1392,17 @@ DllExport fmiStatus fmiSetInteger(
 DllExport fmiStatus fmiSetBoolean (fmiComponent c, const fmiValueReference vr[], size_t nvr, const fmiBoolean value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::setBoolean, nvr};
+    Record(component, cppfmu::FmiFunction::setBoolean, nvr, Array(vr, nvr), Array(value, nvr));
     try {
         component->slave->SetBoolean(vr, nvr, value);
+        ProfileWrites(component, cppfmu::VariableType::boolean, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -289,14 +1410,17 @@ DllExport fmiStatus fmiSetBoolean (fmiComponent c, const fmiValueReference vr[],
 DllExport fmiStatus fmiSetString  (fmiComponent c, const fmiValueReference vr[], size_t nvr, const fmiString  value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::setString, nvr};
+    Record(component, cppfmu::FmiFunction::setString, nvr, Array(vr, nvr), Array(value, nvr));
     try {
         component->slave->SetString(vr, nvr, value);
+        ProfileWrites(component, cppfmu::VariableType::string, vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -304,12 +1428,16 @@ DllExport fmiStatus fmiSetString  (fmiComponent c, const fmiValueReference vr[],
 
 DllExport fmiStatus fmiSetRealInputDerivatives(
     fmiComponent c,
-    const  fmiValueReference /*vr*/[],
-    size_t /*nvr*/,
-    const  fmiInteger /*order*/[],
-    const  fmiReal /*value*/[])
+    const  fmiValueReference vr[],
+    size_t nvr,
+    const  fmiInteger order[],
+    const  fmiReal value[])
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::setRealInputDerivatives};
+    Record(component, cppfmu::FmiFunction::setRealInputDerivatives, nvr,
+        Array(vr, nvr), Array(order, nvr), Array(value, nvr));
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiSetRealInputDerivatives");
@@ -319,12 +1447,16 @@ DllExport fmiStatus fmiSetRealInputDerivatives(
 
 DllExport fmiStatus fmiGetRealOutputDerivatives(
     fmiComponent c,
-    const   fmiValueReference /*vr*/[],
-    size_t  /*nvr*/,
-    const   fmiInteger /*order*/[],
+    const   fmiValueReference vr[],
+    size_t  nvr,
+    const   fmiInteger order[],
     fmiReal /*value*/[])
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getRealOutputDerivatives};
+    Record(component, cppfmu::FmiFunction::getRealOutputDerivatives, nvr,
+        Array(vr, nvr), Array(order, nvr));
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiGetRealInputDerivatives");
@@ -335,7 +1467,10 @@ DllExport fmiStatus fmiGetRealOutputDerivatives(
 
 DllExport fmiStatus fmiCancelStep(fmiComponent c)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::cancelStep};
+    Record(component, cppfmu::FmiFunction::cancelStep, 0);
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiCancelStep");
@@ -350,8 +1485,22 @@ DllExport fmiStatus fmiDoStep(
     fmiBoolean   newStep)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{
+        component,
+        cppfmu::FmiFunction::doStep,
+        0,
+        currentCommunicationPoint,
+        communicationStepSize};
+    Record(component, cppfmu::FmiFunction::doStep, 0,
+        currentCommunicationPoint, communicationStepSize, newStep);
     try {
+        if (component->trace) {
+            component->trace->SetSimulationTime(currentCommunicationPoint);
+        }
         double endTime = currentCommunicationPoint;
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+        StepCounterScope counting{component};
+#endif
         const auto ok = component->slave->DoStep(
             currentCommunicationPoint,
             communicationStepSize,
@@ -360,16 +1509,17 @@ DllExport fmiStatus fmiDoStep(
         if (ok) {
             component->lastSuccessfulTime =
                 currentCommunicationPoint + communicationStepSize;
+            PublishOutputs(component, component->lastSuccessfulTime);
             return fmiOK;
         } else {
             component->lastSuccessfulTime = endTime;
             return fmiDiscard;
         }
     } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
+        LogError(component, fmiFatal, e.what());
         return fmiFatal;
     } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
+        LogError(component, fmiError, e.what());
         return fmiError;
     }
 }
@@ -377,10 +1527,13 @@ DllExport fmiStatus fmiDoStep(
 
 DllExport fmiStatus fmiGetStatus(
     fmiComponent c,
-    const fmiStatusKind /*s*/,
+    const fmiStatusKind s,
     fmiStatus* /*value*/)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getStatus};
+    Record(component, cppfmu::FmiFunction::getStatus, 0, static_cast<std::int32_t>(s));
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiGetStatus");
@@ -395,6 +1548,8 @@ DllExport fmiStatus fmiGetRealStatus(
     fmiReal* value)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getRealStatus};
+    Record(component, cppfmu::FmiFunction::getRealStatus, 0, static_cast<std::int32_t>(s));
     if (s == fmiLastSuccessfulTime) {
         *value = component->lastSuccessfulTime;
         return fmiOK;
@@ -410,10 +1565,13 @@ DllExport fmiStatus fmiGetRealStatus(
 
 DllExport fmiStatus fmiGetIntegerStatus(
     fmiComponent c,
-    const fmiStatusKind /*s*/,
+    const fmiStatusKind s,
     fmiInteger* /*value*/)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getIntegerStatus};
+    Record(component, cppfmu::FmiFunction::getIntegerStatus, 0, static_cast<std::int32_t>(s));
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiGetIntegerStatus");
@@ -424,10 +1582,13 @@ DllExport fmiStatus fmiGetIntegerStatus(
 
 DllExport fmiStatus fmiGetBooleanStatus(
     fmiComponent c,
-    const fmiStatusKind /*s*/,
+    const fmiStatusKind s,
     fmiBoolean* /*value*/)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getBooleanStatus};
+    Record(component, cppfmu::FmiFunction::getBooleanStatus, 0, static_cast<std::int32_t>(s));
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiGetBooleanStatus");
@@ -437,10 +1598,13 @@ DllExport fmiStatus fmiGetBooleanStatus(
 
 DllExport fmiStatus fmiGetStringStatus(
     fmiComponent c,
-    const fmiStatusKind /*s*/,
+    const fmiStatusKind s,
     fmiString*  /*value*/)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
+    const auto component = reinterpret_cast<Component*>(c);
+    CallScope scope{component, cppfmu::FmiFunction::getStringStatus};
+    Record(component, cppfmu::FmiFunction::getStringStatus, 0, static_cast<std::int32_t>(s));
+    component->logger.Log(
         fmiError,
         "cppfmu",
         "FMI function not supported: fmiGetStringStatus");
@@ -448,4 +1612,121 @@ DllExport fmiStatus fmiGetStringStatus(
 }
 
 
+DllExport size_t cppfmuGetCallStatistics(
+    fmiComponent c,
+    cppfmuCallStatistics stats[],
+    size_t maxCount)
+{
+#ifdef CPPFMU_ENABLE_STATISTICS
+    const auto component = reinterpret_cast<Component*>(c);
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(cppfmu::FmiFunction::count); ++i) {
+        const auto function = static_cast<cppfmu::FmiFunction>(i);
+        const auto& s = component->statistics[function];
+        if (s.calls == 0) continue;
+        if (n < maxCount) {
+            auto& out = stats[n];
+            out.function = cppfmu::FmiFunctionName(function);
+            out.calls = s.calls;
+            out.elements = s.elements;
+            out.totalTime = s.totalTime;
+            out.minTime = s.minTime;
+            out.maxTime = s.maxTime;
+            out.p50Time = s.latency.Quantile(0.5);
+            out.p90Time = s.latency.Quantile(0.9);
+            out.p99Time = s.latency.Quantile(0.99);
+            out.p999Time = s.latency.Quantile(0.999);
+        }
+        ++n;
+    }
+    return n;
+#else
+    (void) c;
+    (void) stats;
+    (void) maxCount;
+    return 0;
+#endif
+}
+
+
+DllExport size_t cppfmuGetStepCounters(
+    fmiComponent c,
+    cppfmuStepCounters counters[],
+    size_t maxCount)
+{
+#ifdef CPPFMU_ENABLE_PERF_COUNTERS
+    const auto& stepCounters = reinterpret_cast<Component*>(c)->stepCounters;
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(cppfmu::PerfEvent::count); ++i) {
+        const auto event = static_cast<cppfmu::PerfEvent>(i);
+        if (!stepCounters.IsCounted(event)) continue;
+        if (n < maxCount) {
+            const auto& h = stepCounters.Histogram(event);
+            auto& out = counters[n];
+            out.event = cppfmu::PerfEventName(event);
+            out.steps = stepCounters.Steps();
+            out.total = stepCounters.Total(event);
+            out.min = h.Min();
+            out.max = h.Max();
+            out.p50 = h.Quantile(0.5);
+            out.p90 = h.Quantile(0.9);
+            out.p99 = h.Quantile(0.99);
+        }
+        ++n;
+    }
+    return n;
+#else
+    (void) c;
+    (void) counters;
+    (void) maxCount;
+    return 0;
+#endif
+}
+
+
+DllExport size_t cppfmuGetSignalConnections(
+    cppfmuSignalConnection connections[],
+    size_t maxCount,
+    char buffer[],
+    size_t bufferSize)
+{
+    std::size_t used = 0;
+    // Copies 's' to the caller's buffer, or returns null if it does not fit.
+    const auto copy = [&] (const char* s) -> const char* {
+        const auto length = std::strlen(s) + 1;
+        if (!buffer || length > bufferSize - used) return nullptr;
+        const auto copied = buffer + used;
+        std::memcpy(copied, s, length);
+        used += length;
+        return copied;
+    };
+    try {
+        std::size_t n = 0;
+        cppfmu::SignalBus::Instance().ForEachConnection(
+            [&] (const char* signal, const char* writer, const char* reader, std::size_t size) {
+                if (n < maxCount) {
+                    connections[n].signal = copy(signal);
+                    connections[n].writer = copy(writer);
+                    connections[n].reader = copy(reader);
+                    connections[n].size = size;
+                }
+                ++n;
+            });
+        return n;
+    } catch (const std::exception&) {
+        return 0;
+    }
+}
+
+
+DllExport size_t cppfmuDrainInstancePool()
+{
+#if CPPFMU_INSTANCE_POOL_SIZE > 0
+    return InstancePool::Instance().Drain();
+#else
+    return 0;
+#endif
+}
+
+
 }
@@ -0,0 +1,238 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* cppfmu_monitor: Follows the outputs which an instance publishes in shared
+ * memory (see cppfmu_monitor.hpp), and prints them as CSV, one line per
+ * time step, until the instance is freed.
+ *
+ * Usage:
+ *
+ *     cppfmu_monitor [options] name
+ *
+ * Options:
+ *
+ *     --interval=N    Check for new frames every N milliseconds (default: 10)
+ *     --latest        Print only the latest frame at each check, for
+ *                     monitors which cannot keep up with the simulation
+ *
+ * 'name' is the name of the shared memory object, which the instance logs
+ * when it is created, e.g. "/cppfmu-inst-1234-0".  To publish outputs, run
+ * the simulation with the CPPFMU_MONITOR_VARIABLES environment variable set
+ * to the value references of the real variables to publish, e.g. "0,3,10-19".
+ *
+ * The monitor only reads the shared memory, so it never slows down the
+ * simulation.  If it falls more than a ring's worth of frames behind, the
+ * frames which were overwritten are skipped, and counted on stderr.
+ *
+ * Like the rest of CPPFMU, this comes without build scripts.  It is POSIX
+ * only, e.g.:
+ *
+ *     g++ -std=c++11 -O2 -I.. -I<fmi headers> cppfmu_monitor.cpp \
+ *         -o cppfmu_monitor -lrt
+ */
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "benchmarks/benchmark_util.hpp"
+#include "cppfmu_monitor.hpp"
+
+
+namespace
+{
+    struct Options
+    {
+        std::uint64_t intervalMs = 10;
+        bool latestOnly = false;
+        const char* name = nullptr;
+    };
+
+
+    // A read-only mapping of an output monitor's shared memory object.
+    class Mapping
+    {
+    public:
+        explicit Mapping(const char* name)
+        {
+            const auto fd = shm_open(name, O_RDONLY, 0);
+            if (fd < 0) {
+                throw std::runtime_error(std::string(name) + ": " + std::strerror(errno));
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                throw std::runtime_error(std::strerror(errno));
+            }
+            m_size = static_cast<std::size_t>(info.st_size);
+            const auto address = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (address == MAP_FAILED) throw std::runtime_error(std::strerror(errno));
+            m_base = static_cast<const char*>(address);
+
+            if (m_size < sizeof(cppfmu::OutputMonitorHeader)
+                || std::memcmp(Header().magic, cppfmu::outputMonitorMagic,
+                    sizeof cppfmu::outputMonitorMagic) != 0) {
+                throw std::runtime_error("Not an output monitor");
+            }
+            if (Header().version != cppfmu::outputMonitorVersion) {
+                throw std::runtime_error("Unsupported output monitor version");
+            }
+            const auto& h = Header();
+            const auto minFrameSize = sizeof(cppfmu::OutputMonitorFrame)
+                + static_cast<std::uint64_t>(h.variableCount) * sizeof(double);
+            if (h.frameCapacity == 0
+                || h.frameSize < minFrameSize
+                || h.frameSize % alignof(cppfmu::OutputMonitorFrame) != 0
+                || h.framesOffset % alignof(cppfmu::OutputMonitorFrame) != 0) {
+                throw std::runtime_error("Output monitor has an invalid frame layout");
+            }
+            if (static_cast<std::uint64_t>(h.framesOffset)
+                    + static_cast<std::uint64_t>(h.frameCapacity) * h.frameSize > m_size
+                || h.headerSize + h.variableCount * sizeof(fmiValueReference) > h.framesOffset) {
+                throw std::runtime_error("Output monitor is truncated");
+            }
+        }
+
+        ~Mapping()
+        {
+            munmap(const_cast<char*>(m_base), m_size);
+        }
+
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        const cppfmu::OutputMonitorHeader& Header() const
+        {
+            return *reinterpret_cast<const cppfmu::OutputMonitorHeader*>(m_base);
+        }
+
+        fmiValueReference Reference(std::size_t i) const
+        {
+            fmiValueReference vr;
+            std::memcpy(&vr, m_base + Header().headerSize + i * sizeof vr, sizeof vr);
+            return vr;
+        }
+
+        /* Copies frame 'n' into 'time' and 'values', and returns whether it
+         * was complete and was not overwritten while it was copied.
+         */
+        bool ReadFrame(std::uint64_t n, double& time, std::vector<double>& values) const
+        {
+            const auto& h = Header();
+            const auto frame = reinterpret_cast<const cppfmu::OutputMonitorFrame*>(
+                m_base + h.framesOffset + (n % h.frameCapacity) * h.frameSize);
+            const auto expected = 2*n + 2;
+            if (frame->sequence.load(std::memory_order_acquire) != expected) return false;
+            values.resize(h.variableCount);
+            std::memcpy(&time, &frame->time, sizeof time);
+            std::memcpy(values.data(), frame + 1, values.size() * sizeof(double));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return frame->sequence.load(std::memory_order_relaxed) == expected;
+        }
+
+    private:
+        const char* m_base = nullptr;
+        std::size_t m_size = 0;
+    };
+
+
+    void PrintFrame(std::uint64_t n, double time, const std::vector<double>& values)
+    {
+        std::printf("%llu,%.17g", static_cast<unsigned long long>(n), time);
+        for (const auto v : values) std::printf(",%.17g", v);
+        std::printf("\n");
+    }
+
+
+    void Run(const Options& options)
+    {
+        const Mapping mapping{options.name};
+        const auto& header = mapping.Header();
+        std::fprintf(stderr, "Monitoring %u outputs of %s\n",
+            header.variableCount, header.instanceName);
+
+        std::printf("step,time");
+        for (std::uint32_t i = 0; i < header.variableCount; ++i) {
+            std::printf(",vr%u", mapping.Reference(i));
+        }
+        std::printf("\n");
+
+        std::uint64_t next = 0;
+        std::uint64_t lost = 0;
+        double time = 0.0;
+        std::vector<double> values;
+        for (;;) {
+            // Check 'closed' first, so that no frames are missed at the end.
+            const auto closed = header.closed.load(std::memory_order_acquire) != 0;
+            const auto published = header.published.load(std::memory_order_acquire);
+            auto first = next;
+            if (published > first + header.frameCapacity) {
+                first = published - header.frameCapacity;
+            }
+            if (options.latestOnly && published > first) first = published - 1;
+            for (auto n = first; n < published; ++n) {
+                if (mapping.ReadFrame(n, time, values)) {
+                    PrintFrame(n, time, values);
+                } else {
+                    ++lost;
+                }
+            }
+            if (!options.latestOnly) lost += first - next;
+            next = published;
+            std::fflush(stdout);
+            if (closed) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.intervalMs));
+        }
+        if (lost > 0) {
+            std::fprintf(stderr, "%llu frames were overwritten before they could be read\n",
+                static_cast<unsigned long long>(lost));
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<const char*> positional;
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = argv[i];
+        if (bench::ParseCount(arg, "interval", options.intervalMs)) continue;
+        if (std::strcmp(arg, "--latest") == 0) {
+            options.latestOnly = true;
+        } else if (std::strncmp(arg, "--", 2) == 0) {
+            positional.clear();
+            break;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 1) {
+        std::fprintf(stderr, "Usage: %s [--interval=N] [--latest] name\n", argv[0]);
+        return 2;
+    }
+    options.name = positional[0];
+    try {
+        Run(options);
+        return 0;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,500 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* cppfmu_replay: Replays a recording of the FMI calls made to one instance
+ * (see cppfmu_recording.hpp) against a model's shared library, without the
+ * simulation environment and the other models it was recorded with, and
+ * reports the time spent in each FMI function.
+ *
+ * Usage:
+ *
+ *     cppfmu_replay [options] library modelIdentifier recording
+ *
+ * Options:
+ *
+ *     --format=text|csv|json  Output format (default: text)
+ *     --repeat=N              Replay the recording N times, each time with
+ *                             a new instance (default: 1)
+ *     --location=URI          The fmuLocation to pass to
+ *                             fmiInstantiateSlave(), instead of the one
+ *                             that was recorded
+ *
+ * The instance is created with the recorded fmiInstantiateSlave()
+ * arguments, the recorded calls are made in order, as fast as possible, and
+ * the instance is freed at the end.  Only the FMI calls are timed, not the
+ * decoding of the recording.  The latency percentiles are reported as by
+ * the benchmarks in ../benchmarks, with one row per FMI function.  Calls
+ * which did not return fmiOK are counted and reported on stderr; replay
+ * stops if one returns fmiFatal.
+ *
+ * To record the calls, run the simulation with the CPPFMU_RECORD_DIR
+ * environment variable set to the directory in which the recordings should
+ * be written.  If the simulation crashes, set CPPFMU_RECORD_SYNC as well,
+ * or the recording lacks the last calls.
+ *
+ * Like the rest of CPPFMU, this comes without build scripts.  It is POSIX
+ * only, since it uses dlopen() to load the model, e.g.:
+ *
+ *     g++ -std=c++11 -O2 -I.. -I<fmi headers> cppfmu_replay.cpp \
+ *         -o cppfmu_replay -ldl
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "benchmarks/benchmark_util.hpp"
+#include "benchmarks/fmi_host.hpp"
+#include "cppfmu_recording.hpp"
+
+
+namespace
+{
+    using cppfmu::FmiFunction;
+
+
+    // Reads unaligned values from the contents of a recording.
+    class Reader
+    {
+    public:
+        Reader(const char* begin, const char* end) : m_pos{begin}, m_end{end} { }
+
+        template<typename T>
+        void Get(T& value)
+        {
+            Need(sizeof value);
+            std::memcpy(&value, m_pos, sizeof value);
+            m_pos += sizeof value;
+        }
+
+        template<typename T>
+        void GetArray(std::vector<T>& values, std::size_t n)
+        {
+            Need(n * sizeof(T));
+            values.resize(n);
+            if (n > 0) std::memcpy(values.data(), m_pos, n * sizeof(T));
+            m_pos += n * sizeof(T);
+        }
+
+        // Returns false if the string is null.
+        bool GetString(std::string& s)
+        {
+            std::uint32_t length;
+            Get(length);
+            if (length == cppfmu::callRecordingNullString) {
+                s.clear();
+                return false;
+            }
+            Need(length);
+            s.assign(m_pos, length);
+            m_pos += length;
+            return true;
+        }
+
+        bool AtEnd() const { return m_pos == m_end; }
+
+        const char* Position() const { return m_pos; }
+
+    private:
+        void Need(std::size_t size)
+        {
+            if (static_cast<std::size_t>(m_end - m_pos) < size) {
+                throw std::length_error("Recording ends in the middle of a record");
+            }
+        }
+
+        const char* m_pos;
+        const char* m_end;
+    };
+
+
+    struct Options
+    {
+        bench::Reporter::Format format = bench::Reporter::Format::text;
+        std::uint64_t repeat = 1;
+        const char* location = nullptr;
+        const char* library = nullptr;
+        const char* modelIdentifier = nullptr;
+        const char* recording = nullptr;
+    };
+
+
+    // The fmiInstantiateSlave() arguments of a recording.
+    struct Instantiation
+    {
+        std::string instanceName, fmuGUID, fmuLocation, mimeType;
+        bool hasInstanceName, hasGUID, hasLocation, hasMimeType;
+        cppfmu::CallRecordingHeader header;
+    };
+
+
+    class Replayer
+    {
+    public:
+        Replayer(const bench::FmuLibrary& fmu, const Options& options)
+            : m_fmu(fmu)
+            , m_options(options)
+            , m_samples(static_cast<std::size_t>(FmiFunction::count))
+            , m_failures(static_cast<std::size_t>(FmiFunction::count), 0)
+        {
+        }
+
+        /* Replays the records in 'reader' against a new instance.  Returns
+         * the number of records which were replayed.
+         */
+        std::uint64_t Replay(const Instantiation& inst, Reader reader)
+        {
+            const auto str = [] (const std::string& s, bool present) {
+                return present ? s.c_str() : nullptr;
+            };
+            auto t0 = bench::Now();
+            const auto c = m_fmu.instantiateSlave(
+                str(inst.instanceName, inst.hasInstanceName),
+                str(inst.fmuGUID, inst.hasGUID),
+                m_options.location ? m_options.location : str(inst.fmuLocation, inst.hasLocation),
+                str(inst.mimeType, inst.hasMimeType),
+                inst.header.timeout,
+                static_cast<fmiBoolean>(inst.header.visible),
+                static_cast<fmiBoolean>(inst.header.interactive),
+                bench::HostCallbacks(),
+                static_cast<fmiBoolean>(inst.header.loggingOn));
+            Finish(FmiFunction::instantiateSlave, t0, c ? fmiOK : fmiFatal);
+            if (!c) throw std::runtime_error("fmiInstantiateSlave failed");
+
+            std::uint64_t records = 0;
+            try {
+                while (!reader.AtEnd()) {
+                    if (!Call(c, reader)) break;
+                    ++records;
+                }
+            } catch (const std::length_error&) {
+                if (inst.header.complete) throw;
+                // The recording was not closed properly, so the last record
+                // is expected to be incomplete.
+            }
+
+            t0 = bench::Now();
+            m_fmu.freeSlaveInstance(c);
+            Finish(FmiFunction::freeSlaveInstance, t0, fmiOK);
+            return records;
+        }
+
+        // Reports the results and the calls which failed.
+        void Report()
+        {
+            bench::Reporter reporter{m_options.format};
+            for (std::size_t i = 0; i < m_samples.size(); ++i) {
+                auto& samples = m_samples[i];
+                if (samples.empty()) continue;
+                bench::Result result;
+                result.name = cppfmu::FmiFunctionName(static_cast<FmiFunction>(i));
+                result.operations = samples.size();
+                std::uint64_t total = 0;
+                for (const auto s : samples) total += s;
+                result.throughput = bench::Throughput(samples.size(), total);
+                result.samples = std::move(samples);
+                reporter.Add(std::move(result));
+            }
+            for (std::size_t i = 0; i < m_failures.size(); ++i) {
+                if (m_failures[i] == 0) continue;
+                std::fprintf(stderr, "%s: %llu calls did not return fmiOK\n",
+                    cppfmu::FmiFunctionName(static_cast<FmiFunction>(i)),
+                    static_cast<unsigned long long>(m_failures[i]));
+            }
+        }
+
+    private:
+        // Replays one record.  Returns false if replay should stop.
+        bool Call(fmiComponent c, Reader& reader)
+        {
+            cppfmu::CallRecordHeader record;
+            reader.Get(record);
+            const auto function = static_cast<FmiFunction>(record.function);
+            const auto n = static_cast<std::size_t>(record.count);
+            fmiStatus status = fmiOK;
+            std::uint64_t t0 = 0;
+
+            switch (function) {
+                case FmiFunction::initializeSlave: {
+                    fmiReal tStart, tStop;
+                    fmiBoolean stopTimeDefined;
+                    reader.Get(tStart);
+                    reader.Get(tStop);
+                    reader.Get(stopTimeDefined);
+                    t0 = bench::Now();
+                    status = m_fmu.initializeSlave(c, tStart, stopTimeDefined, tStop);
+                    break;
+                }
+                case FmiFunction::terminateSlave:
+                    t0 = bench::Now();
+                    status = m_fmu.terminateSlave(c);
+                    break;
+                case FmiFunction::resetSlave:
+                    t0 = bench::Now();
+                    status = m_fmu.resetSlave(c);
+                    break;
+                case FmiFunction::setDebugLogging: {
+                    fmiBoolean loggingOn;
+                    reader.Get(loggingOn);
+                    t0 = bench::Now();
+                    status = m_fmu.setDebugLogging(c, loggingOn);
+                    break;
+                }
+                case FmiFunction::getReal:
+                    reader.GetArray(m_vr, n);
+                    m_reals.resize(n);
+                    t0 = bench::Now();
+                    status = m_fmu.getReal(c, m_vr.data(), n, m_reals.data());
+                    break;
+                case FmiFunction::getInteger:
+                    reader.GetArray(m_vr, n);
+                    m_integers.resize(n);
+                    t0 = bench::Now();
+                    status = m_fmu.getInteger(c, m_vr.data(), n, m_integers.data());
+                    break;
+                case FmiFunction::getBoolean:
+                    reader.GetArray(m_vr, n);
+                    m_booleans.resize(n);
+                    t0 = bench::Now();
+                    status = m_fmu.getBoolean(c, m_vr.data(), n, m_booleans.data());
+                    break;
+                case FmiFunction::getString:
+                    reader.GetArray(m_vr, n);
+                    m_stringPointers.resize(n);
+                    t0 = bench::Now();
+                    status = m_fmu.getString(c, m_vr.data(), n, m_stringPointers.data());
+                    break;
+                case FmiFunction::setReal:
+                    reader.GetArray(m_vr, n);
+                    reader.GetArray(m_reals, n);
+                    t0 = bench::Now();
+                    status = m_fmu.setReal(c, m_vr.data(), n, m_reals.data());
+                    break;
+                case FmiFunction::setInteger:
+                    reader.GetArray(m_vr, n);
+                    reader.GetArray(m_integers, n);
+                    t0 = bench::Now();
+                    status = m_fmu.setInteger(c, m_vr.data(), n, m_integers.data());
+                    break;
+                case FmiFunction::setBoolean:
+                    reader.GetArray(m_vr, n);
+                    reader.GetArray(m_booleans, n);
+                    t0 = bench::Now();
+                    status = m_fmu.setBoolean(c, m_vr.data(), n, m_booleans.data());
+                    break;
+                case FmiFunction::setString:
+                    reader.GetArray(m_vr, n);
+                    m_strings.resize(n);
+                    m_stringPointers.resize(n);
+                    for (std::size_t i = 0; i < n; ++i) {
+                        const auto present = reader.GetString(m_strings[i]);
+                        m_stringPointers[i] = present ? m_strings[i].c_str() : nullptr;
+                    }
+                    t0 = bench::Now();
+                    status = m_fmu.setString(c, m_vr.data(), n, m_stringPointers.data());
+                    break;
+                case FmiFunction::setRealInputDerivatives:
+                    reader.GetArray(m_vr, n);
+                    reader.GetArray(m_integers, n);
+                    reader.GetArray(m_reals, n);
+                    t0 = bench::Now();
+                    status = m_fmu.setRealInputDerivatives(
+                        c, m_vr.data(), n, m_integers.data(), m_reals.data());
+                    break;
+                case FmiFunction::getRealOutputDerivatives:
+                    reader.GetArray(m_vr, n);
+                    reader.GetArray(m_integers, n);
+                    m_reals.resize(n);
+                    t0 = bench::Now();
+                    status = m_fmu.getRealOutputDerivatives(
+                        c, m_vr.data(), n, m_integers.data(), m_reals.data());
+                    break;
+                case FmiFunction::cancelStep:
+                    t0 = bench::Now();
+                    status = m_fmu.cancelStep(c);
+                    break;
+                case FmiFunction::doStep: {
+                    fmiReal time, stepSize;
+                    fmiBoolean newStep;
+                    reader.Get(time);
+                    reader.Get(stepSize);
+                    reader.Get(newStep);
+                    t0 = bench::Now();
+                    status = m_fmu.doStep(c, time, stepSize, newStep);
+                    break;
+                }
+                case FmiFunction::getStatus: {
+                    const auto kind = GetStatusKind(reader);
+                    fmiStatus value;
+                    t0 = bench::Now();
+                    status = m_fmu.getStatus(c, kind, &value);
+                    break;
+                }
+                case FmiFunction::getRealStatus: {
+                    const auto kind = GetStatusKind(reader);
+                    fmiReal value;
+                    t0 = bench::Now();
+                    status = m_fmu.getRealStatus(c, kind, &value);
+                    break;
+                }
+                case FmiFunction::getIntegerStatus: {
+                    const auto kind = GetStatusKind(reader);
+                    fmiInteger value;
+                    t0 = bench::Now();
+                    status = m_fmu.getIntegerStatus(c, kind, &value);
+                    break;
+                }
+                case FmiFunction::getBooleanStatus: {
+                    const auto kind = GetStatusKind(reader);
+                    fmiBoolean value;
+                    t0 = bench::Now();
+                    status = m_fmu.getBooleanStatus(c, kind, &value);
+                    break;
+                }
+                case FmiFunction::getStringStatus: {
+                    const auto kind = GetStatusKind(reader);
+                    fmiString value;
+                    t0 = bench::Now();
+                    status = m_fmu.getStringStatus(c, kind, &value);
+                    break;
+                }
+                default:
+                    throw std::runtime_error(
+                        "Unknown function in recording: " + std::to_string(record.function));
+            }
+            Finish(function, t0, status);
+            if (status == fmiFatal) {
+                std::fprintf(stderr, "%s returned fmiFatal; stopping\n",
+                    cppfmu::FmiFunctionName(function));
+                return false;
+            }
+            return true;
+        }
+
+        static fmiStatusKind GetStatusKind(Reader& reader)
+        {
+            std::int32_t kind;
+            reader.Get(kind);
+            return static_cast<fmiStatusKind>(kind);
+        }
+
+        void Finish(FmiFunction function, std::uint64_t t0, fmiStatus status)
+        {
+            const auto t1 = bench::Now();
+            const auto i = static_cast<std::size_t>(function);
+            m_samples[i].push_back(t1 - t0);
+            if (status != fmiOK) ++m_failures[i];
+        }
+
+        const bench::FmuLibrary& m_fmu;
+        const Options& m_options;
+        std::vector<std::vector<std::uint64_t>> m_samples;
+        std::vector<std::uint64_t> m_failures;
+
+        // Argument buffers, reused from call to call
+        std::vector<fmiValueReference> m_vr;
+        std::vector<fmiReal> m_reals;
+        std::vector<fmiInteger> m_integers;
+        std::vector<fmiBoolean> m_booleans;
+        std::vector<std::string> m_strings;
+        std::vector<fmiString> m_stringPointers;
+    };
+
+
+    std::vector<char> ReadFile(const char* path)
+    {
+        const auto file = std::fopen(path, "rb");
+        if (!file) throw std::runtime_error(std::string("Cannot open file: ") + path);
+        std::vector<char> contents;
+        char chunk[65536];
+        std::size_t n;
+        while ((n = std::fread(chunk, 1, sizeof chunk, file)) > 0) {
+            contents.insert(contents.end(), chunk, chunk + n);
+        }
+        std::fclose(file);
+        return contents;
+    }
+
+
+    void Run(const Options& options)
+    {
+        const auto contents = ReadFile(options.recording);
+        Reader reader{contents.data(), contents.data() + contents.size()};
+
+        Instantiation inst;
+        reader.Get(inst.header);
+        if (std::memcmp(inst.header.magic, cppfmu::callRecordingMagic,
+                    sizeof inst.header.magic) != 0
+                || inst.header.version != cppfmu::callRecordingVersion
+                || inst.header.headerSize != sizeof inst.header) {
+            throw std::runtime_error(
+                "Not a CPPFMU call recording, or unsupported version");
+        }
+        inst.hasInstanceName = reader.GetString(inst.instanceName);
+        inst.hasGUID = reader.GetString(inst.fmuGUID);
+        inst.hasLocation = reader.GetString(inst.fmuLocation);
+        inst.hasMimeType = reader.GetString(inst.mimeType);
+        if (!inst.header.complete) {
+            std::fprintf(stderr, "Warning: The recording was not closed properly, "
+                "and may be incomplete\n");
+        }
+
+        bench::FmuLibrary fmu{options.library, options.modelIdentifier};
+        Replayer replayer{fmu, options};
+        const Reader records{reader.Position(), contents.data() + contents.size()};
+        std::uint64_t replayed = 0;
+        for (std::uint64_t r = 0; r < options.repeat; ++r) {
+            replayed = replayer.Replay(inst, records);
+        }
+        std::fprintf(stderr, "Replayed %llu calls to instance '%s'%s\n",
+            static_cast<unsigned long long>(replayed),
+            inst.instanceName.c_str(),
+            options.repeat > 1
+                ? (" " + std::to_string(options.repeat) + " times").c_str()
+                : "");
+        replayer.Report();
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<const char*> positional;
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = argv[i];
+        if (bench::ParseFormat(arg, options.format)) continue;
+        if (bench::ParseCount(arg, "repeat", options.repeat)) continue;
+        if (std::strncmp(arg, "--location=", 11) == 0) {
+            options.location = arg + 11;
+        } else if (std::strncmp(arg, "--", 2) == 0) {
+            positional.clear();
+            break;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 3) {
+        std::fprintf(stderr,
+            "Usage: %s [--format=text|csv|json] [--repeat=N] [--location=URI] "
+            "library modelIdentifier recording\n",
+            argv[0]);
+        return 2;
+    }
+    options.library = positional[0];
+    options.modelIdentifier = positional[1];
+    options.recording = positional[2];
+    try {
+        Run(options);
+        return 0;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
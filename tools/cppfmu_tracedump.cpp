@@ -0,0 +1,238 @@
+/* Copyright 2016-2017, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* cppfmu_tracedump: Decodes binary trace files written by cppfmu::TraceFile
+ * (see cppfmu_common.hpp for the format) and prints them as text or CSV.
+ *
+ * Usage:
+ *
+ *     cppfmu_tracedump [--csv] file...
+ *
+ * Like the rest of CPPFMU, this comes without build scripts.  It only needs
+ * the CPPFMU and FMI headers, e.g.:
+ *
+ *     g++ -std=c++11 -I.. -I<fmi headers> cppfmu_tracedump.cpp -o cppfmu_tracedump
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cppfmu_common.hpp"
+
+
+namespace
+{
+    struct Value
+    {
+        char type;
+        std::int64_t i;
+        std::uint64_t u;
+        double f;
+        std::string s;
+    };
+
+
+    // Parses the payload of a record.  Returns false if it is malformed.
+    bool ParsePayload(
+        const char* payload,
+        const char* end,
+        std::uint32_t count,
+        std::vector<Value>& values)
+    {
+        const auto tagsSize = (static_cast<std::size_t>(count) + 7) & ~std::size_t{7};
+        if (static_cast<std::size_t>(end - payload) < tagsSize) return false;
+        const char* tags = payload;
+        const char* data = payload + tagsSize;
+        values.clear();
+        for (std::uint32_t k = 0; k < count; ++k) {
+            if (end - data < 8) return false;
+            Value v;
+            v.type = tags[k];
+            std::memcpy(&v.i, data, 8);
+            std::memcpy(&v.u, data, 8);
+            std::memcpy(&v.f, data, 8);
+            data += 8;
+            if (v.type == cppfmu::traceString) {
+                const auto padded = (v.u + 7) & ~std::uint64_t{7};
+                if (static_cast<std::uint64_t>(end - data) < padded) return false;
+                v.s.assign(data, static_cast<std::size_t>(v.u));
+                data += padded;
+            }
+            values.push_back(std::move(v));
+        }
+        return true;
+    }
+
+
+    void PrintValue(std::FILE* out, const Value& v, bool csv)
+    {
+        switch (v.type) {
+            case cppfmu::traceSigned:
+                std::fprintf(out, "%lld", static_cast<long long>(v.i));
+                break;
+            case cppfmu::traceUnsigned:
+                std::fprintf(out, "%llu", static_cast<unsigned long long>(v.u));
+                break;
+            case cppfmu::traceFloat:
+                std::fprintf(out, "%.17g", v.f);
+                break;
+            case cppfmu::traceBool:
+                std::fprintf(out, "%s", v.u ? "true" : "false");
+                break;
+            case cppfmu::traceString:
+                if (csv) {
+                    std::fputc('"', out);
+                    for (const auto c : v.s) {
+                        if (c == '"') std::fputc('"', out);
+                        std::fputc(c, out);
+                    }
+                    std::fputc('"', out);
+                } else {
+                    std::fprintf(out, "\"%s\"", v.s.c_str());
+                }
+                break;
+            default:
+                std::fprintf(out, "?");
+        }
+    }
+
+
+    bool Dump(const char* path, bool csv, std::FILE* out)
+    {
+        const auto file = std::fopen(path, "rb");
+        if (!file) {
+            std::fprintf(stderr, "%s: cannot open file\n", path);
+            return false;
+        }
+        std::vector<char> contents;
+        char chunk[65536];
+        std::size_t n;
+        while ((n = std::fread(chunk, 1, sizeof chunk, file)) > 0) {
+            contents.insert(contents.end(), chunk, chunk + n);
+        }
+        std::fclose(file);
+
+        cppfmu::TraceFileHeader header;
+        if (contents.size() < sizeof header) {
+            std::fprintf(stderr, "%s: file too short\n", path);
+            return false;
+        }
+        std::memcpy(&header, contents.data(), sizeof header);
+        if (std::memcmp(header.magic, cppfmu::traceFileMagic, sizeof header.magic) != 0
+                || header.version != cppfmu::traceFileVersion) {
+            std::fprintf(stderr, "%s: not a CPPFMU trace file, or unsupported version\n", path);
+            return false;
+        }
+        if (header.headerSize < sizeof header || header.headerSize > contents.size()) {
+            std::fprintf(stderr, "%s: invalid header size\n", path);
+            return false;
+        }
+        header.instanceName[sizeof header.instanceName - 1] = '\0';
+
+        const char* pos = contents.data() + header.headerSize;
+        const char* end = contents.data() + contents.size();
+        if (header.dataSize > 0 && header.dataSize <= static_cast<std::uint64_t>(end - pos)) {
+            end = pos + header.dataSize;
+        }
+
+        if (!csv) {
+            std::fprintf(out, "# %s: instance '%s', started at %lld ns since epoch\n",
+                path, header.instanceName, static_cast<long long>(header.startTime));
+        }
+
+        std::map<std::uint32_t, std::string> names;
+        std::vector<Value> values;
+        while (end - pos >= 4) {
+            std::uint32_t size;
+            std::memcpy(&size, pos, sizeof size);
+            if (size == 0) break;
+            if (size % 8 != 0 || size > static_cast<std::uint64_t>(end - pos)) {
+                std::fprintf(stderr, "%s: corrupt record at offset %ld\n",
+                    path, static_cast<long>(pos - contents.data()));
+                return false;
+            }
+            if (size < sizeof(cppfmu::TraceRecordHeader)) {
+                pos += size;
+                continue;
+            }
+            cppfmu::TraceRecordHeader rec;
+            std::memcpy(&rec, pos, sizeof rec);
+            const char* payload = pos + sizeof rec;
+            const char* next = pos + size;
+            pos = next;
+            if (rec.messageId == cppfmu::tracePaddingId) continue;
+            if (!ParsePayload(payload, next, rec.payloadCount, values)) {
+                std::fprintf(stderr, "%s: malformed payload\n", path);
+                return false;
+            }
+            if (rec.messageId == cppfmu::traceDefinitionId) {
+                if (values.size() == 2) {
+                    names[static_cast<std::uint32_t>(values[0].u)] = values[1].s;
+                }
+                continue;
+            }
+
+            const auto name = names.find(rec.messageId);
+            if (csv) {
+                std::fprintf(out, "\"%s\",%llu,%.17g,%lu,%s",
+                    header.instanceName,
+                    static_cast<unsigned long long>(rec.timestamp),
+                    rec.simulationTime,
+                    static_cast<unsigned long>(rec.messageId),
+                    name == names.end() ? "" : name->second.c_str());
+                for (const auto& v : values) {
+                    std::fputc(',', out);
+                    PrintValue(out, v, true);
+                }
+            } else {
+                std::fprintf(out, "%14.6f ms  t=%-12g ",
+                    rec.timestamp * 1e-6,
+                    rec.simulationTime);
+                if (name == names.end()) {
+                    std::fprintf(out, "#%lu", static_cast<unsigned long>(rec.messageId));
+                } else {
+                    std::fprintf(out, "%s", name->second.c_str());
+                }
+                for (const auto& v : values) {
+                    std::fputc(' ', out);
+                    PrintValue(out, v, false);
+                }
+            }
+            std::fputc('\n', out);
+        }
+        return true;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+            files.clear();
+            break;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        std::fprintf(stderr, "Usage: %s [--csv] file...\n", argv[0]);
+        return 2;
+    }
+    if (csv) {
+        std::printf("instance,timestamp_ns,simulation_time,message_id,message_name,values...\n");
+    }
+    bool ok = true;
+    for (const auto f : files) ok = Dump(f, csv, stdout) && ok;
+    return ok ? 0 : 1;
+}